@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // collision detection structures and functions
 // TODO: make sure it actually works
@@ -71,6 +72,40 @@ double aabb_sweep(const AABB *box,
                   int width, int height,
                   AABBEdge *edge);
 
+// Sweeps against len boxes at once and returns the earliest t, or -1.0
+// if none are hit. The boxes are given as arrays of each coordinate.
+// *index is set to the box hit and edge to its edge. The result is the
+// same as calling aabb_sweep on each box in order and keeping the first
+// one with the smallest t, but several boxes are tested at a time.
+double aabb_sweep_many(const int *x1, const int *y1, const int *x2, const int *y2, size_t len,
+                       double x, double y, double idx, double idy,
+                       int width, int height,
+                       size_t *index, AABBEdge *edge);
+
+// Fixed point
+// 16.16 fixed point versions of the sweep functions. They only use
+// integers, so they give the same results with every compiler and on
+// every platform, which lockstep multiplayer needs.
+
+typedef int32_t AABBFixed;
+
+#define AABB_FIXED_SHIFT 16
+#define AABB_FIXED_ONE ((AABBFixed)1 << AABB_FIXED_SHIFT)
+
+// Same as aabb_init_bounding, with x, y, dx and dy in fixed point.
+void aabb_init_bounding_fixed(AABB *a, AABBFixed x, AABBFixed y, AABBFixed dx, AABBFixed dy, int width, int height);
+// Same as aabb_sweep, with x, y, dx and dy in fixed point. Takes the
+// displacement itself instead of its inverse.
+// returns t in fixed point, rounded down, or -1 if no collision.
+// Whether there's a collision and which edge is hit are worked out
+// exactly, before rounding.
+// The box, and the box moved by width and height, must lie between
+// -32768 and 32767, the range of a fixed point position.
+AABBFixed aabb_sweep_fixed(const AABB *box,
+                           AABBFixed x, AABBFixed y, AABBFixed dx, AABBFixed dy,
+                           int width, int height,
+                           AABBEdge *edge);
+
 // Quadtrees
 
 enum quadtree_index_t {
@@ -82,31 +117,148 @@ enum quadtree_index_t {
 
 typedef enum quadtree_index_t QuadtreeIndex;
 
+// Handles stay valid until the element is removed, even when
+// the element is moved around inside the tree.
+typedef size_t QuadtreeHandle;
+
+#define QUADTREE_NO_HANDLE ((QuadtreeHandle)-1)
+
+// deepest tree that location codes (see collision.c) can describe
+#define QUADTREE_MAX_DEPTH 31
+
+// node allocator owned by the root; see collision.c
+struct quadtree_pool_t;
+
+// Controls when nodes are split and merged.
+struct quadtree_config_t {
+    // leaves are split once they hold this many elements
+    size_t split_threshold;
+    // subdivided nodes are merged once their subtree holds fewer
+    // elements than this. Keeping it below split_threshold stops an
+    // element moving back and forth across a boundary from splitting
+    // and merging the same node every time.
+    size_t merge_threshold;
+    // nodes aren't merged until this many inserts, moves and removals
+    // have been done since they were split
+    size_t min_lifetime;
+    // grow the root when an element is inserted or moved outside it, and
+    // shrink it when everything ends up under one of its children. The
+    // old root becomes a child of the new one, so the smallest nodes
+    // stay the same size, but every node and handle is relabeled, which
+    // costs a walk over the whole tree. The root only shrinks once there
+    // have been as many operations as elements since it last changed.
+    // The tree can't grow past QUADTREE_MAX_DEPTH levels or the range
+    // of int; elements outside stay in the root as usual.
+    bool auto_resize;
+    // quadtree_move and quadtree_move_handle only write the new bounds
+    // down, and quadtree_flush moves everything at once. Moving the same
+    // element again before the flush replaces its pending move. Until
+    // then, queries and quadtree_get see the element where it was.
+    // Every move counts towards min_lifetime when it's made, as it
+    // would right away. The root grows to fit them at the flush.
+    bool defer_moves;
+    // with defer_moves, grow the element's AABB in the tree to cover the
+    // new bounds as well as the old, so queries before the flush find
+    // everything they would have, and maybe more. This only restructures
+    // the tree when the grown AABB leaves its node. quadtree_move finds
+    // elements by their AABB in the tree, so use handles with this.
+    bool defer_union;
+};
+
+typedef struct quadtree_config_t QuadtreeConfig;
+
+// Running totals since the tree was created or the counters were reset.
+struct quadtree_counters_t {
+    size_t splits;
+    size_t merges;
+    // levels added above and removed from the root by auto_resize
+    size_t grows;
+    size_t shrinks;
+    // node storage allocated or resized, including copies of storage
+    // shared with a snapshot
+    size_t reallocs;
+    // queries run and the nodes they looked at, counting traversals,
+    // iterators, batches, ray casts and nearest neighbour searches
+    size_t queries;
+    size_t nodes_visited;
+};
+
+typedef struct quadtree_counters_t QuadtreeCounters;
+
+// Shape and memory use of a tree at one point, from quadtree_stats.
+struct quadtree_stats_t {
+    size_t nodes;
+    size_t leaves;
+    size_t depth; // of the deepest node, the root is at 0
+    // nodes and elements at each depth
+    size_t nodes_per_level[QUADTREE_MAX_DEPTH + 1];
+    size_t elements_per_level[QUADTREE_MAX_DEPTH + 1];
+    size_t elements;
+    // element slots allocated, how many are holes left by removals and
+    // how many are past the end, unused
+    size_t capacity;
+    size_t holes;
+    size_t slack;
+    // node storage, and the nodes themselves. storage shared with
+    // snapshots is counted in each tree.
+    size_t data_bytes;
+    size_t node_bytes;
+    size_t pending; // moves waiting for quadtree_flush
+};
+
+typedef struct quadtree_stats_t QuadtreeStats;
+
 struct quadtree_t {
     AABB box[4];
+    // children are allocated together, so child[i] == child[0] + i
     struct quadtree_t *child[4];
+    struct quadtree_pool_t *pool;
+    uint64_t loc; // location code
     size_t max_depth;
     size_t data_len;
     size_t data_cap;
     size_t data_free;
     size_t el_size;
     void *data; // data_len * arbitrary-sized elements
+    QuadtreeHandle *handles; // handle of each element, allocated with data
+    uint64_t *occupied; // bitmap of slots holding an element, allocated with data
+    int *bounds; // copy of element AABBs as x1, y1, x2, y2 arrays, allocated with data
+    bool dirty; // changed by a batch operation that hasn't finished
+    uint8_t edges; // which sides are on the root's sides
+    size_t split_time; // operation count when the node was subdivided
     // element size is given as parameter to methods
     // elements should be POD (no destructor and memcpy-able)
     // element type should be a struct where AABB is the first member
-    // freed elements are represented by a zeroed-out AABB
+    // the first data_len + data_free slots are in use, data_free of
+    // them are holes left by removed elements
 };
 
 typedef struct quadtree_t Quadtree;
 typedef bool (*qt_equal_fn)(void *a, void *b);
 typedef void (*qt_callback_fn)(void *data, void *a);
 
+// depth must be at most QUADTREE_MAX_DEPTH.
 void quadtree_init(Quadtree *q, const AABB *box, size_t depth, size_t el_size);
-// Frees quadtree and children.
+// Same as quadtree_init, but makes a loose quadtree: the box of each
+// child is grown until it is looseness times as wide and high as its
+// quarter of the parent, and an element goes into the child whose
+// quarter has its center if it fits in the grown box. Elements crossing
+// a midline then only stay up in the parent when they're big, at the
+// cost of queries overlapping more children. looseness must be at
+// least 1, which gives a normal quadtree; 2 is usual.
+// box[i] of a node is the grown box. Queries give the same results.
+void quadtree_init_loose(Quadtree *q, const AABB *box, size_t depth, size_t el_size, double looseness);
+// Initializes q and inserts len elements from els at once.
+// The result is the same as inserting them one at a time, but every
+// node's data is only allocated once.
+// If handles is non-NULL, handles[i] is set to the handle of els[i].
+void quadtree_build(Quadtree *q, const AABB *box, size_t depth, size_t el_size, const void *els, size_t len, QuadtreeHandle *handles);
+// Frees quadtree, children and the node pool.
 // Does not free parameter.
 void quadtree_free(Quadtree *q);
 // Insert into a quadtree. Do not insert elements of different sizes.
-void quadtree_insert(Quadtree *q, void *el);
+// Returns a handle to the inserted element.
+QuadtreeHandle quadtree_insert(Quadtree *q, void *el);
 // Move object inside quadtree. Compares data using given comparator.
 // equal is a function pointer that returns something nonzero if
 // the two parameters are equal.
@@ -115,11 +267,438 @@ void quadtree_insert(Quadtree *q, void *el);
 void quadtree_move(Quadtree *q, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf);
 // Remove object from quadtree. Copies to buf if non-NULL.
 void quadtree_remove(Quadtree *q, void *el, qt_equal_fn equal, void *buf);
+// Returns the element for a handle.
+// The pointer is only valid until the quadtree is modified.
+// Use quadtree_move_handle to change the AABB, not this pointer.
+void *quadtree_get(Quadtree *q, QuadtreeHandle h);
+// Same as quadtree_move, but finds the element by handle instead of
+// searching for it. The handle stays valid.
+// Copies the moved element to buf if non-NULL.
+void quadtree_move_handle(Quadtree *q, QuadtreeHandle h, const AABB *new_bounds, void *buf);
+// Moves the element of handles[i] to new_bounds[i] for each i < len.
+// With equal thresholds and no minimum lifetime, the result is the same
+// as calling quadtree_move_handle for each one, but nodes are only
+// split, merged and shrunk once, at the end.
+// A handle may only appear once.
+void quadtree_move_many(Quadtree *q, const QuadtreeHandle *handles, const AABB *new_bounds, size_t len);
+// Does the moves deferred by defer_moves with quadtree_move_many.
+// Moving or removing an element right away, including with
+// quadtree_move_many, drops its pending move. Snapshots and clones don't
+// get the pending moves of the tree they're taken from.
+void quadtree_flush(Quadtree *q);
+// Same as quadtree_remove, but finds the element by handle.
+// The handle is no longer valid afterwards.
+void quadtree_remove_handle(Quadtree *q, QuadtreeHandle h, void *buf);
 // Traverse quadtree, calling callback for each intersection.
 // cb_data will be provided as first argument to callback.
 // The element data is provided as second argument.
 void quadtree_traverse(Quadtree *q, AABB *box, qt_callback_fn callback, void *cb_data);
-// Clone quadtree.
+// Iterator over the elements intersecting a box, in the same order as
+// quadtree_traverse. Keeps its own stack instead of recursing.
+struct quadtree_query_t {
+    AABB box;
+    QuadtreeCounters *counters; // where visited nodes are counted
+    Quadtree *node; // node whose elements are being scanned
+    size_t slot; // start of the next group of slots to scan in node
+    unsigned int hits; // hits in the last group that haven't been returned
+    size_t stack_len;
+    // nodes still to be visited; at most 3 siblings per level wait here
+    Quadtree *stack[3 * QUADTREE_MAX_DEPTH + 4];
+};
+
+typedef struct quadtree_query_t QuadtreeQuery;
+
+// Starts iterating over the elements of q that intersect box.
+// The quadtree must not be modified while iterating.
+void quadtree_query_begin(QuadtreeQuery *it, Quadtree *q, const AABB *box);
+// Returns the next element, or NULL when there are no more.
+void *quadtree_query_next(QuadtreeQuery *it);
+// Writes up to max of the next elements into out and returns how many.
+// Returns less than max only when the iterator is finished, so it can
+// be called again to continue after a full buffer.
+size_t quadtree_query_collect(QuadtreeQuery *it, void **out, size_t max);
+// Sweeps a width by height box at (x, y) by (dx, dy), or casts a ray if
+// both are 0, and returns the first element hit, or NULL. See
+// aabb_tree_raycast. Nodes are visited in the order the box reaches
+// them, and skipped once they're farther than the closest hit so far,
+// so line of sight checks usually only look at a few nodes.
+void *quadtree_raycast(Quadtree *q, double x, double y, double dx, double dy,
+                       int width, int height, double *t_hit, AABBEdge *edge);
+// Finds the k elements nearest to (x, y), measuring to the closest point
+// of their AABBs (0 if inside). Writes them to out, nearest first, and
+// returns how many there were, which is less than k only if the tree
+// has fewer elements. If dist_sq is non-NULL, it gets their squared
+// distances. Nodes are visited nearest first, until the rest are all
+// farther than the k found so far. Ties are broken arbitrarily.
+// x2 and y2 are exclusive, as in aabb_intersect: an AABB covers x1 to
+// x2 - 1 and y1 to y2 - 1, so a point with integer coordinates is at
+// distance 0 exactly when the 1 by 1 box at it intersects the AABB.
+size_t quadtree_nearest(Quadtree *q, double x, double y, size_t k, void **out, double *dist_sq);
+// Calls callback for each element within radius of (x, y), measuring as
+// quadtree_nearest does. Nodes farther than radius are skipped.
+void quadtree_traverse_radius(Quadtree *q, double x, double y, double radius,
+                              qt_callback_fn callback, void *cb_data);
+struct quadtree_pair_t {
+    void *a;
+    void *b;
+};
+
+typedef struct quadtree_pair_t QuadtreePair;
+
+// Finds every pair of elements whose AABBs intersect, in one walk over
+// the tree. Each pair is reported once, in no particular order.
+// In loose quadtrees, where children overlap, the elements below each
+// child are also tested against those below its earlier siblings.
+// Writes up to max pairs into out and returns the total number of
+// pairs, which may be more than max; in that case call it again with a
+// bigger buffer. Pointers are valid until the quadtree is modified.
+size_t quadtree_find_pairs(Quadtree *q, QuadtreePair *out, size_t max);
+// Runs count queries, split between up to threads threads (the calling
+// thread is one of them). The hits of query i end up in
+// results[offsets[i]] up to results[offsets[i + 1]], so offsets needs
+// count + 1 entries. Returns the total number of hits; if it's more
+// than max, only the first max are written, but offsets is complete.
+// Each query runs twice, once to count its hits and once to write
+// them, so every thread writes straight into its own part of results.
+// With results NULL or max 0, only the counting runs.
+// The threads are started by the first call that needs them and then
+// wait in the quadtree until quadtree_free, so later calls cost two
+// wake-ups and waits (one per pass) instead of starting threads; asking
+// for more threads than before restarts them. The quadtree must not be
+// modified, or batch-queried from another thread, during the call.
+size_t quadtree_query_batch(Quadtree *q, const AABB *boxes, size_t count, void **results, size_t max, size_t *offsets, unsigned int threads);
+// Clone quadtree. Handles of src refer to the same elements in dest.
+// The configuration is copied, the counters start at zero.
 void quadtree_clone(Quadtree *dest, const Quadtree *src);
+// Makes dest a snapshot of src in O(1): the trees share all their nodes
+// and copy them lazily, so changing either one costs extra only for the
+// nodes on the way to the change, the first time. Both trees can be
+// modified and must be freed with quadtree_free, in any order.
+// Trees sharing nodes must not be used from different threads at once.
+void quadtree_snapshot(Quadtree *dest, Quadtree *src);
+// Fills config with the defaults: both thresholds 16, no minimum lifetime,
+// no resizing, moves done right away.
+void quadtree_default_config(QuadtreeConfig *config);
+// Changes when nodes of q are split and merged. Existing nodes are left
+// alone until an operation reaches them. quadtree_build always uses
+// the default config, so call this afterwards.
+// merge_threshold must be at most split_threshold.
+void quadtree_set_config(Quadtree *q, const QuadtreeConfig *config);
+void quadtree_get_config(const Quadtree *q, QuadtreeConfig *config);
+void quadtree_get_counters(const Quadtree *q, QuadtreeCounters *counters);
+// Gets the box of the root, which changes if the tree resizes itself.
+void quadtree_get_box(const Quadtree *q, AABB *box);
+void quadtree_reset_counters(Quadtree *q);
+// Walks the whole tree once to fill stats. Unlike the counters, this
+// costs as much as visiting every node, so sample it now and then.
+void quadtree_stats(const Quadtree *q, QuadtreeStats *stats);
+
+// Collision solving
+// Moves boxes through static geometry the way the player in main.c
+// moves through the tilemap: sweep to the first thing hit, stop against
+// it, then slide the rest of the way along it.
+
+struct aabb_mover_t {
+    double x, y;
+    // displacement for this step. whatever a blocked edge cancels is
+    // dropped, and anything left when the iterations run out stays here,
+    // so it's 0 afterwards unless the mover got stuck.
+    double dx, dy;
+    int width, height;
+    // bit (1 << e) is set for each edge e that was hit
+    unsigned int contacts;
+};
+
+typedef struct aabb_mover_t AABBMover;
+
+// Finds the first box in geometry that a width by height box at (x, y)
+// hits when swept by (dx, dy). Returns t as aabb_sweep_many does, and
+// on a hit sets *hit to the box and edge to its edge.
+typedef double (*aabb_hit_fn)(void *geometry, double x, double y, double dx, double dy,
+                              int width, int height, AABB *hit, AABBEdge *edge);
+
+// Moves each mover by its displacement, resolving up to iterations hits
+// each. Positions are snapped against the edge hit, as in main.c.
+void aabb_solve(AABBMover *movers, size_t len, unsigned int iterations, aabb_hit_fn first_hit, void *geometry);
+// Same as aabb_solve, with the elements of q as the static geometry.
+// Ties are broken as aabb_sweep_many would, in quadtree_traverse order.
+void aabb_solve_quadtree(Quadtree *q, AABBMover *movers, size_t len, unsigned int iterations);
+
+// Tilemaps
+// A grid of equally sized tiles that are either solid or not, kept as a
+// bitmap. The bitmap is split into square chunks that are only allocated
+// once one of their tiles is made solid, so big, mostly empty maps stay
+// small. Sweeps only look at the tiles the swept box passes over.
+
+// tiles per side of a chunk; each row of a chunk is one word
+#define TILEMAP_CHUNK_SIZE 64
+
+struct tilemap_t {
+    int x, y; // top left corner of tile (0, 0)
+    int tile_width, tile_height;
+    int width, height; // in tiles
+    int chunks_x, chunks_y;
+    // chunks_x * chunks_y chunks, row by row, NULL if nothing in them
+    // was ever solid. each is TILEMAP_CHUNK_SIZE rows of bits.
+    uint64_t **chunks;
+};
+
+typedef struct tilemap_t Tilemap;
+
+// Makes a width by height map with no solid tiles.
+void tilemap_init(Tilemap *m, int x, int y, int width, int height, int tile_width, int tile_height);
+void tilemap_free(Tilemap *m);
+// (tx, ty) must be inside the map.
+void tilemap_set(Tilemap *m, int tx, int ty, bool solid);
+// Tiles outside the map aren't solid.
+bool tilemap_get(const Tilemap *m, int tx, int ty);
+// Same as aabb_hit_fn, with the solid tiles as the geometry. The tiles
+// under the swept box are visited in the order it reaches them, and the
+// walk stops once they're past the first hit. Ties go to the first tile
+// row by row, as if every tile had been swept against in that order.
+double tilemap_sweep(const Tilemap *m, double x, double y, double dx, double dy,
+                     int width, int height, AABB *hit, AABBEdge *edge);
+// Same as aabb_solve, with the solid tiles of m as the static geometry.
+void aabb_solve_tilemap(Tilemap *m, AABBMover *movers, size_t len, unsigned int iterations);
+
+// Linear quadtrees
+// Same insert/move/remove/traverse semantics as Quadtree, without
+// pointers. Elements are placed in the deepest cell that contains them
+// and kept in one buffer sorted by cell (Z-order), and the non-empty
+// cells are kept in a sorted array.
+// Changes are buffered and sorted into place by linear_quadtree_update,
+// which traverse calls if needed, so it suits query-heavy workloads.
+// Queries walk the cells in order, skipping the ones that miss, and
+// test the elements of neighbouring cells together with the same SIMD
+// scan as Quadtree.
+
+// keys hold 2 bits per level plus the depth
+#define LINEAR_QUADTREE_MAX_DEPTH 29
+
+struct linear_quadtree_node_t;
+
+struct linear_quadtree_t {
+    AABB box;
+    size_t max_depth;
+    size_t el_size;
+    // data_sorted elements sorted by key, then the
+    // elements inserted since the last update
+    void *data;
+    uint64_t *keys;
+    size_t data_len;
+    size_t data_sorted;
+    size_t data_cap;
+    // removed from the sorted part since the last update
+    size_t data_free;
+    struct linear_quadtree_node_t *nodes;
+    size_t nodes_len;
+    size_t nodes_cap;
+    // same size as data and keys, swapped with them on update
+    void *spare_data;
+    uint64_t *spare_keys;
+    void *scratch; // one element, used when moving without buf
+    // x1, y1, x2, y2 arrays of the sorted elements' bounds
+    int *bounds;
+    size_t bounds_stride;
+};
+
+typedef struct linear_quadtree_t LinearQuadtree;
+
+// depth must be at most LINEAR_QUADTREE_MAX_DEPTH.
+void linear_quadtree_init(LinearQuadtree *q, const AABB *box, size_t depth, size_t el_size);
+void linear_quadtree_free(LinearQuadtree *q);
+void linear_quadtree_insert(LinearQuadtree *q, void *el);
+// See quadtree_move.
+void linear_quadtree_move(LinearQuadtree *q, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf);
+// See quadtree_remove.
+void linear_quadtree_remove(LinearQuadtree *q, void *el, qt_equal_fn equal, void *buf);
+// Sorts elements inserted or removed since the last update into place.
+void linear_quadtree_update(LinearQuadtree *q);
+// Traverse quadtree, calling callback for each intersection.
+// Updates first if there were changes.
+void linear_quadtree_traverse(LinearQuadtree *q, AABB *box, qt_callback_fn callback, void *cb_data);
+
+// Spatial hash grids
+// Same insert/move/remove/traverse semantics as Quadtree, on a grid of
+// square cells. Each element is listed in every cell its AABB touches,
+// and only non-empty cells are stored, in a hash table, so the grid has
+// no bounds. Works best when elements are about the size of a cell.
+
+typedef size_t SpatialHashHandle;
+
+#define SPATIAL_HASH_NO_HANDLE ((SpatialHashHandle)-1)
+
+struct spatial_hash_cell_t;
+struct spatial_hash_slot_t;
+
+struct spatial_hash_t {
+    int cell_size;
+    size_t el_size;
+    // elements are kept packed, in no particular order
+    void *data;
+    SpatialHashHandle *data_handles;
+    size_t data_len;
+    size_t data_cap;
+    // slot of each handle, or the next unused handle
+    struct spatial_hash_slot_t *handles;
+    size_t handles_len;
+    size_t handles_cap;
+    SpatialHashHandle handles_free;
+    // open addressing table of non-empty cells
+    struct spatial_hash_cell_t *cells;
+    size_t cells_len;
+    size_t cells_cap;
+    void *scratch; // one element, used when moving by handle
+};
+
+typedef struct spatial_hash_t SpatialHash;
+
+void spatial_hash_init(SpatialHash *g, int cell_size, size_t el_size);
+void spatial_hash_free(SpatialHash *g);
+SpatialHashHandle spatial_hash_insert(SpatialHash *g, void *el);
+// See quadtree_move.
+void spatial_hash_move(SpatialHash *g, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf);
+// See quadtree_remove.
+void spatial_hash_remove(SpatialHash *g, void *el, qt_equal_fn equal, void *buf);
+// See quadtree_get.
+void *spatial_hash_get(SpatialHash *g, SpatialHashHandle h);
+// See quadtree_move_handle. Only the cells the element enters or
+// leaves are changed.
+void spatial_hash_move_handle(SpatialHash *g, SpatialHashHandle h, const AABB *new_bounds, void *buf);
+// See quadtree_remove_handle.
+void spatial_hash_remove_handle(SpatialHash *g, SpatialHashHandle h, void *buf);
+// Calls callback once for each element intersecting box, even if they
+// share several cells.
+void spatial_hash_traverse(SpatialHash *g, AABB *box, qt_callback_fn callback, void *cb_data);
+
+// Dynamic AABB trees
+// Same insert/move/remove/traverse semantics as Quadtree, in a bounding
+// volume hierarchy: each leaf holds one element, and each internal node
+// has the AABB of its two children. Unlike the quadtree, elements
+// straddling a boundary don't collect in upper nodes, since there are
+// no fixed boundaries.
+// Leaves store the element's AABB grown by a margin, so small moves
+// don't change the tree. New leaves go where they add the least
+// perimeter, and the tree is rebalanced with rotations on the way up.
+
+// Handles are leaf nodes, which never move.
+typedef size_t AABBTreeHandle;
+
+#define AABB_TREE_NO_HANDLE ((AABBTreeHandle)-1)
+
+struct aabb_tree_node_t;
+
+struct aabb_tree_t {
+    struct aabb_tree_node_t *nodes;
+    size_t nodes_len;
+    size_t nodes_cap;
+    size_t nodes_free;
+    size_t root; // AABB_TREE_NO_HANDLE if empty
+    int margin;
+    size_t el_size;
+    // elements are kept packed, in no particular order
+    void *data;
+    AABBTreeHandle *data_handles;
+    size_t data_len;
+    size_t data_cap;
+};
+
+typedef struct aabb_tree_t AABBTree;
+
+// margin is how far each side of a leaf's AABB is moved out.
+void aabb_tree_init(AABBTree *t, int margin, size_t el_size);
+void aabb_tree_free(AABBTree *t);
+AABBTreeHandle aabb_tree_insert(AABBTree *t, void *el);
+// See quadtree_move and quadtree_remove. Unlike those, an element that
+// isn't in the tree is left alone rather than asserted on.
+void aabb_tree_move(AABBTree *t, void *el, qt_equal_fn equal, const AABB *new_bounds, void *buf);
+void aabb_tree_remove(AABBTree *t, void *el, qt_equal_fn equal, void *buf);
+// See quadtree_get.
+void *aabb_tree_get(AABBTree *t, AABBTreeHandle h);
+// See quadtree_move_handle. The tree only changes if new_bounds leaves
+// the grown AABB of the leaf.
+void aabb_tree_move_handle(AABBTree *t, AABBTreeHandle h, const AABB *new_bounds, void *buf);
+// See quadtree_remove_handle.
+void aabb_tree_remove_handle(AABBTree *t, AABBTreeHandle h, void *buf);
+void aabb_tree_traverse(AABBTree *t, AABB *box, qt_callback_fn callback, void *cb_data);
+// Sweeps a width by height box at (x, y) by (dx, dy), or casts a ray if
+// both are 0, and returns the first element hit, or NULL.
+// *t_hit is set to the fraction of the displacement before the hit and
+// edge to the edge hit, as in aabb_sweep. Elements the box starts
+// inside of are ignored. Nodes are visited nearest first, and skipped
+// once they're farther than the closest hit so far.
+void *aabb_tree_raycast(AABBTree *t, double x, double y, double dx, double dy,
+                        int width, int height, double *t_hit, AABBEdge *edge);
+
+// Sweep and prune
+// Keeps both ends of every AABB sorted along x and along y. When objects
+// move a little each frame, their ends only swap with a few neighbours,
+// and overlapping pairs are found from those swaps instead of searching
+// again. Pairs are reported through callbacks as they start and stop
+// overlapping, and the current set can be read at any time.
+
+// Handles are reused after the object is removed.
+typedef size_t SweepPruneHandle;
+
+// most objects a sweep and prune can hold at once
+#define SWEEP_PRUNE_MAX_OBJECTS ((size_t)1 << 31)
+
+typedef void (*sweep_prune_pair_fn)(void *cb_data, SweepPruneHandle a, SweepPruneHandle b);
+
+struct sweep_prune_object_t;
+
+struct sweep_prune_pair_t {
+    SweepPruneHandle a;
+    SweepPruneHandle b;
+};
+
+typedef struct sweep_prune_pair_t SweepPrunePair;
+
+struct sweep_prune_t {
+    // ends along x and y, each 2 * number of sorted objects long.
+    // see collision.c for how they're encoded.
+    uint64_t *ends[2];
+    size_t ends_len;
+    size_t ends_cap;
+    struct sweep_prune_object_t *objects;
+    size_t objects_len;
+    size_t objects_cap;
+    SweepPruneHandle objects_free;
+    // inserted since the last update, not in ends yet
+    SweepPruneHandle *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    // removed since the last update, still in ends
+    size_t dead_len;
+    // open addressing set of overlapping pairs
+    uint64_t *pairs;
+    size_t pairs_len;
+    size_t pairs_cap;
+    sweep_prune_pair_fn added;
+    sweep_prune_pair_fn removed;
+    void *cb_data;
+};
+
+typedef struct sweep_prune_t SweepPrune;
+
+// added and removed are called with cb_data when a pair starts and
+// stops overlapping. Either can be NULL.
+void sweep_prune_init(SweepPrune *sp, sweep_prune_pair_fn added, sweep_prune_pair_fn removed, void *cb_data);
+void sweep_prune_free(SweepPrune *sp);
+// Inserts and removals are batched and done all at once by the next
+// update, so filling or emptying it doesn't take quadratic time.
+// Handles of removed objects are reused after that update.
+SweepPruneHandle sweep_prune_insert(SweepPrune *sp, const AABB *box);
+// Sorts objects inserted since the last update into place and takes
+// out removed ones, reporting their pairs. The other functions call
+// this first if needed.
+void sweep_prune_update(SweepPrune *sp);
+// Costs about the number of ends the object passes on the way.
+void sweep_prune_move(SweepPrune *sp, SweepPruneHandle h, const AABB *box);
+void sweep_prune_remove(SweepPrune *sp, SweepPruneHandle h);
+const AABB *sweep_prune_get(SweepPrune *sp, SweepPruneHandle h);
+// Writes up to max overlapping pairs into out and returns the total
+// number, in no particular order. a < b in every pair.
+size_t sweep_prune_pairs(SweepPrune *sp, SweepPrunePair *out, size_t max);
 
 #endif
@@ -1,8 +1,28 @@
 #include "collision.h"
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifndef QUADTREE_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define QUADTREE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUADTREE_SSE2
+#endif
+#endif
 
 // aabb functions
 
@@ -46,6 +66,238 @@ void aabb_init_bounding(AABB *a, double x, double y, double dx, double dy, int w
     a->y2 = (int)ceil(y2);
 }
 
+// bit i of the result is set if box i is hit before best, doing the
+// same math as aabb_sweep. fmin and fmax return the other argument if
+// one is NaN, which min and max instructions don't do on their own.
+#if defined(QUADTREE_AVX2)
+#define AABB_SWEEP_LANES 4
+
+static inline __m256d aabb_sweep_fmin(__m256d a, __m256d b) {
+    return _mm256_blendv_pd(_mm256_min_pd(a, b), a, _mm256_cmp_pd(b, b, _CMP_UNORD_Q));
+}
+
+static inline __m256d aabb_sweep_fmax(__m256d a, __m256d b) {
+    return _mm256_blendv_pd(_mm256_max_pd(a, b), a, _mm256_cmp_pd(b, b, _CMP_UNORD_Q));
+}
+
+static inline unsigned int aabb_sweep_hits(const int *x1, const int *y1, const int *x2, const int *y2,
+                                           double x, double y, double idx, double idy,
+                                           int width, int height, double best) {
+    __m256d vx = _mm256_set1_pd(x), vy = _mm256_set1_pd(y),
+            vidx = _mm256_set1_pd(idx), vidy = _mm256_set1_pd(idy),
+            vw = _mm256_set1_pd(width), vh = _mm256_set1_pd(height);
+    __m256d tx1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)x1)), vx), vw), vidx);
+    __m256d tx2 = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)x2)), vx), vidx);
+    __m256d ty1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)y1)), vy), vh), vidy);
+    __m256d ty2 = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)y2)), vy), vidy);
+    __m256d tmin = aabb_sweep_fmax(aabb_sweep_fmin(tx1, tx2), aabb_sweep_fmin(ty1, ty2));
+    __m256d tmax = aabb_sweep_fmin(aabb_sweep_fmax(tx1, tx2), aabb_sweep_fmax(ty1, ty2));
+    __m256d hit = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(tmin, tmax, _CMP_LT_OQ),
+                                              _mm256_cmp_pd(tmin, _mm256_setzero_pd(), _CMP_GE_OQ)),
+                                _mm256_cmp_pd(tmin, _mm256_set1_pd(best), _CMP_LT_OQ));
+    return (unsigned int)_mm256_movemask_pd(hit);
+}
+#elif defined(QUADTREE_SSE2)
+#define AABB_SWEEP_LANES 4
+
+static inline __m128d aabb_sweep_fmin(__m128d a, __m128d b) {
+    __m128d nan = _mm_cmpunord_pd(b, b);
+    return _mm_or_pd(_mm_and_pd(nan, a), _mm_andnot_pd(nan, _mm_min_pd(a, b)));
+}
+
+static inline __m128d aabb_sweep_fmax(__m128d a, __m128d b) {
+    __m128d nan = _mm_cmpunord_pd(b, b);
+    return _mm_or_pd(_mm_and_pd(nan, a), _mm_andnot_pd(nan, _mm_max_pd(a, b)));
+}
+
+// two boxes, from the low two ints of each vector
+static inline unsigned int aabb_sweep_hits2(__m128i x1, __m128i y1, __m128i x2, __m128i y2,
+                                            __m128d vx, __m128d vy, __m128d vidx, __m128d vidy,
+                                            __m128d vw, __m128d vh, __m128d vbest) {
+    __m128d tx1 = _mm_mul_pd(_mm_sub_pd(_mm_sub_pd(_mm_cvtepi32_pd(x1), vx), vw), vidx);
+    __m128d tx2 = _mm_mul_pd(_mm_sub_pd(_mm_cvtepi32_pd(x2), vx), vidx);
+    __m128d ty1 = _mm_mul_pd(_mm_sub_pd(_mm_sub_pd(_mm_cvtepi32_pd(y1), vy), vh), vidy);
+    __m128d ty2 = _mm_mul_pd(_mm_sub_pd(_mm_cvtepi32_pd(y2), vy), vidy);
+    __m128d tmin = aabb_sweep_fmax(aabb_sweep_fmin(tx1, tx2), aabb_sweep_fmin(ty1, ty2));
+    __m128d tmax = aabb_sweep_fmin(aabb_sweep_fmax(tx1, tx2), aabb_sweep_fmax(ty1, ty2));
+    __m128d hit = _mm_and_pd(_mm_and_pd(_mm_cmplt_pd(tmin, tmax), _mm_cmpge_pd(tmin, _mm_setzero_pd())),
+                             _mm_cmplt_pd(tmin, vbest));
+    return (unsigned int)_mm_movemask_pd(hit);
+}
+
+static inline unsigned int aabb_sweep_hits(const int *x1, const int *y1, const int *x2, const int *y2,
+                                           double x, double y, double idx, double idy,
+                                           int width, int height, double best) {
+    __m128d vx = _mm_set1_pd(x), vy = _mm_set1_pd(y),
+            vidx = _mm_set1_pd(idx), vidy = _mm_set1_pd(idy),
+            vw = _mm_set1_pd(width), vh = _mm_set1_pd(height), vbest = _mm_set1_pd(best);
+    __m128i bx1 = _mm_loadu_si128((const __m128i *)x1), by1 = _mm_loadu_si128((const __m128i *)y1),
+            bx2 = _mm_loadu_si128((const __m128i *)x2), by2 = _mm_loadu_si128((const __m128i *)y2);
+    unsigned int lo = aabb_sweep_hits2(bx1, by1, bx2, by2, vx, vy, vidx, vidy, vw, vh, vbest);
+    // the high two ints
+    bx1 = _mm_srli_si128(bx1, 8);
+    by1 = _mm_srli_si128(by1, 8);
+    bx2 = _mm_srli_si128(bx2, 8);
+    by2 = _mm_srli_si128(by2, 8);
+    return lo | aabb_sweep_hits2(bx1, by1, bx2, by2, vx, vy, vidx, vidy, vw, vh, vbest) << 2;
+}
+#endif
+
+double aabb_sweep_many(const int *x1, const int *y1, const int *x2, const int *y2, size_t len,
+                       double x, double y, double idx, double idy,
+                       int width, int height,
+                       size_t *index, AABBEdge *edge) {
+    double best = 1.0;
+    size_t best_i = len;
+    AABBEdge best_edge = EDGE_WEST;
+    size_t i = 0;
+#ifdef AABB_SWEEP_LANES
+    // hits are rare, so lanes that might be one are checked again with
+    // aabb_sweep, in order, which also gives the edge
+    for (; i + AABB_SWEEP_LANES <= len; i += AABB_SWEEP_LANES) {
+        unsigned int hits = aabb_sweep_hits(x1 + i, y1 + i, x2 + i, y2 + i, x, y, idx, idy, width, height, best);
+        for (unsigned int k = 0; hits; k++, hits >>= 1) {
+            if (!(hits & 1))
+                continue;
+            AABB box;
+            AABBEdge e;
+            aabb_init(&box, x1[i + k], y1[i + k], x2[i + k], y2[i + k]);
+            double t = aabb_sweep(&box, x, y, idx, idy, width, height, &e);
+            if (t >= 0.0 && t < best) {
+                best = t;
+                best_i = i + k;
+                best_edge = e;
+            }
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        AABB box;
+        AABBEdge e;
+        aabb_init(&box, x1[i], y1[i], x2[i], y2[i]);
+        double t = aabb_sweep(&box, x, y, idx, idy, width, height, &e);
+        if (t >= 0.0 && t < best) {
+            best = t;
+            best_i = i;
+            best_edge = e;
+        }
+    }
+    if (best_i == len)
+        return -1.0;
+    if (index)
+        *index = best_i;
+    if (edge)
+        *edge = best_edge;
+    return best;
+}
+
+// fraction of the displacement at which the swept box enters box, 0 if
+// it starts inside, or -1 if it never does before max_t
+static inline double aabb_ray_enter(const AABB *box, double x, double y, double idx, double idy,
+                                    int width, int height, double max_t) {
+    double tx1 = (box->x1 - x - width) * idx;
+    double tx2 = (box->x2 - x) * idx;
+    double ty1 = (box->y1 - y - height) * idy;
+    double ty2 = (box->y2 - y) * idy;
+    double tmin = fmax(fmin(tx1, tx2), fmin(ty1, ty2));
+    double tmax = fmin(fmax(tx1, tx2), fmax(ty1, ty2));
+    if (tmin > tmax || tmax < 0.0 || tmin >= max_t)
+        return -1.0;
+    return fmax(tmin, 0.0);
+}
+
+// fixed point sweeps
+// times are kept as fractions n / d with d > 0, so they can be compared
+// exactly, and only divided out at the end. d == 0 is infinity with the
+// sign of n.
+
+struct aabb_fixed_time_t {
+    int64_t n, d;
+};
+
+// for coordinates in range |n| < 2^33 and d <= 2^31, so the products
+// fit in 64 bits without their signs
+static bool aabb_fixed_less(struct aabb_fixed_time_t a, struct aabb_fixed_time_t b) {
+    if (!a.d || !b.d) {
+        if (a.d)
+            return b.n > 0;
+        if (b.d)
+            return a.n < 0;
+        return a.n < b.n;
+    }
+    if ((a.n < 0) != (b.n < 0))
+        return a.n < 0;
+    uint64_t l = (uint64_t)(a.n < 0 ? -a.n : a.n) * (uint64_t)b.d,
+             r = (uint64_t)(b.n < 0 ? -b.n : b.n) * (uint64_t)a.d;
+    return a.n < 0 ? l > r : l < r;
+}
+
+// when the span from v to v + size overlaps [lo, hi) along one axis.
+// returns false if it doesn't between t = 0 and 1.
+static bool aabb_fixed_axis(int lo, int hi, AABBFixed v, AABBFixed dv, int size,
+                            struct aabb_fixed_time_t *enter, struct aabb_fixed_time_t *leave) {
+    int64_t n1 = (int64_t)(lo - size) * AABB_FIXED_ONE - v,
+            n2 = (int64_t)hi * AABB_FIXED_ONE - v;
+    if (dv > 0) {
+        enter->n = n1;
+        leave->n = n2;
+        enter->d = leave->d = dv;
+    } else if (dv < 0) {
+        enter->n = -n2;
+        leave->n = -n1;
+        enter->d = leave->d = -(int64_t)dv;
+    } else {
+        if (!(n1 < 0 && n2 > 0))
+            return false;
+        enter->n = -1;
+        leave->n = 1;
+        enter->d = leave->d = 0;
+        return true;
+    }
+    // most sweeps miss because of one axis alone
+    return enter->n < enter->d && leave->n > 0;
+}
+
+// rounds down, unlike integer division
+static inline int64_t aabb_fixed_floor(int64_t v) {
+    return v >= 0 ? v / AABB_FIXED_ONE : -((-v + AABB_FIXED_ONE - 1) / AABB_FIXED_ONE);
+}
+
+void aabb_init_bounding_fixed(AABB *a, AABBFixed x, AABBFixed y, AABBFixed dx, AABBFixed dy, int width, int height) {
+    int64_t x1 = x, x2 = x + (int64_t)width * AABB_FIXED_ONE;
+    int64_t y1 = y, y2 = y + (int64_t)height * AABB_FIXED_ONE;
+    if (dx < 0) x1 += dx;
+    else        x2 += dx;
+    if (dy < 0) y1 += dy;
+    else        y2 += dy;
+    a->x1 = (int)aabb_fixed_floor(x1);
+    a->x2 = (int)-aabb_fixed_floor(-x2);
+    a->y1 = (int)aabb_fixed_floor(y1);
+    a->y2 = (int)-aabb_fixed_floor(-y2);
+}
+
+AABBFixed aabb_sweep_fixed(const AABB *box,
+                           AABBFixed x, AABBFixed y, AABBFixed dx, AABBFixed dy,
+                           int width, int height,
+                           AABBEdge *edge) {
+    // same slab method as aabb_sweep
+    struct aabb_fixed_time_t xin, xout, yin, yout;
+    if (!aabb_fixed_axis(box->x1, box->x2, x, dx, width, &xin, &xout)
+     || !aabb_fixed_axis(box->y1, box->y2, y, dy, height, &yin, &yout))
+        return -1;
+    bool isy = !aabb_fixed_less(yin, xin);
+    struct aabb_fixed_time_t tmin = isy ? yin : xin,
+                             tmax = aabb_fixed_less(xout, yout) ? xout : yout;
+    const struct aabb_fixed_time_t zero = {0, 1}, one = {1, 1};
+    if (!aabb_fixed_less(tmin, tmax) || aabb_fixed_less(tmin, zero) || !aabb_fixed_less(tmin, one))
+        return -1;
+    if (edge)
+        *edge = isy ? dy > 0 ? EDGE_NORTH : EDGE_SOUTH
+                    : dx > 0 ? EDGE_WEST  : EDGE_EAST;
+    // 0 <= n < d here, so this can't overflow
+    return (AABBFixed)(tmin.n * AABB_FIXED_ONE / tmin.d);
+}
+
 #ifndef __cplusplus
 // inline aabb functions
 void aabb_init(AABB *ret, int x1, int y1, int x2, int y2);
@@ -57,86 +309,620 @@ bool aabb_contains(const AABB *a, const AABB *b);
 
 static const unsigned int QUADTREE_THRESHOLD = 16;
 
+// quadtree node pool
+// children are always created and destroyed four at a time, so the pool
+// hands out blocks of four siblings and keeps released blocks on a free
+// list. memory is only given back to the system when the last tree using
+// the allocator is freed.
+// the pool also owns the handle table, since both are per-tree.
+//
+// snapshots share nodes with the tree they were taken from. blocks and
+// node data are reference counted, and a tree copies them before writing
+// if anyone else can see them, so a change only copies the nodes on the
+// way to it. the handle table is split into pages that are shared the
+// same way.
+
+#define QUADTREE_POOL_CHUNK_BLOCKS 64
+#define QUADTREE_HANDLE_PAGE 256
+
+struct quadtree_block_t {
+    union {
+        size_t refs; // number of nodes with these as children
+        struct quadtree_block_t *next; // next free block
+    };
+    // set when a reference is dropped while the block is shared, since
+    // the pool pointers of the nodes may belong to whoever dropped it
+    bool stale;
+    Quadtree node[4];
+};
+
+struct quadtree_chunk_t {
+    struct quadtree_chunk_t *next;
+    struct quadtree_block_t block[QUADTREE_POOL_CHUNK_BLOCKS];
+};
+
+// blocks can be shared between trees, so they come from an allocator
+// that lives until the last of those trees is freed
+struct quadtree_alloc_t {
+    struct quadtree_block_t *free_list;
+    struct quadtree_chunk_t *chunks;
+    size_t refs; // number of trees using it
+};
+
+// nodes are identified by location codes: the root is 1, and
+// child i of a node with code c is (c << 2) | i.
+// a handle stores where its element is, so it can be found by
+// following the code down from the root without comparing anything.
+struct quadtree_handle_entry_t {
+    uint64_t loc; // location code of node holding the element, 0 if unused
+    size_t slot;  // index into node data, or next unused handle
+};
+
+struct quadtree_handle_page_t {
+    size_t refs; // number of trees using it
+    struct quadtree_handle_entry_t entry[QUADTREE_HANDLE_PAGE];
+};
+
+struct quadtree_pool_t {
+    struct quadtree_alloc_t *alloc;
+    struct quadtree_handle_page_t **pages;
+    bool pages_shared; // if some pages may be shared with another tree
+    size_t handles_len;
+    size_t handles_cap; // number of pages times QUADTREE_HANDLE_PAGE
+    size_t handles_used; // handles in use, one per element
+    QuadtreeHandle handles_free;
+    void *scratch; // one element, used when moving by handle
+    double looseness; // 1 for a normal quadtree
+    QuadtreeConfig config;
+    size_t time; // number of inserts, moves and removals so far
+    QuadtreeCounters counters;
+    // moves waiting for quadtree_flush, one per handle
+    QuadtreeHandle *pending_handles;
+    AABB *pending_bounds;
+    size_t pending_len;
+    size_t pending_cap;
+    size_t *pending_at; // 1 + index of each handle's pending move, or 0
+    size_t pending_at_len;
+    struct quadtree_workers_t *workers; // for quadtree_query_batch, or NULL
+};
+
+static void quadtree_workers_delete(struct quadtree_workers_t *w);
+
+// alloc is shared with another tree, or NULL for a new one
+static struct quadtree_pool_t *quadtree_pool_new(size_t el_size, struct quadtree_alloc_t *alloc) {
+    struct quadtree_pool_t *pool = malloc(sizeof *pool);
+    if (!alloc) {
+        alloc = malloc(sizeof *alloc);
+        alloc->free_list = NULL;
+        alloc->chunks = NULL;
+        alloc->refs = 0;
+    }
+    alloc->refs++;
+    pool->alloc = alloc;
+    pool->pages = NULL;
+    pool->pages_shared = false;
+    pool->handles_len = 0;
+    pool->handles_cap = 0;
+    pool->handles_used = 0;
+    pool->handles_free = QUADTREE_NO_HANDLE;
+    pool->scratch = malloc(el_size);
+    pool->looseness = 1.0;
+    quadtree_default_config(&pool->config);
+    pool->time = 0;
+    pool->counters.splits = 0;
+    pool->counters.merges = 0;
+    pool->counters.grows = 0;
+    pool->counters.shrinks = 0;
+    pool->counters.reallocs = 0;
+    pool->counters.queries = 0;
+    pool->counters.nodes_visited = 0;
+    pool->pending_handles = NULL;
+    pool->pending_bounds = NULL;
+    pool->pending_len = 0;
+    pool->pending_cap = 0;
+    pool->pending_at = NULL;
+    pool->pending_at_len = 0;
+    pool->workers = NULL;
+    return pool;
+}
+
+static void quadtree_pool_delete(struct quadtree_pool_t *pool) {
+    struct quadtree_alloc_t *alloc = pool->alloc;
+    if (--alloc->refs == 0) {
+        while (alloc->chunks) {
+            struct quadtree_chunk_t *next = alloc->chunks->next;
+            free(alloc->chunks);
+            alloc->chunks = next;
+        }
+        free(alloc);
+    }
+    for (size_t i = 0; i < pool->handles_cap / QUADTREE_HANDLE_PAGE; i++) {
+        if (--pool->pages[i]->refs == 0)
+            free(pool->pages[i]);
+    }
+    free(pool->pages);
+    free(pool->scratch);
+    free(pool->pending_handles);
+    free(pool->pending_bounds);
+    free(pool->pending_at);
+    quadtree_workers_delete(pool->workers);
+    free(pool);
+}
+
+// returns four contiguous uninitialized nodes
+static Quadtree *quadtree_pool_alloc(struct quadtree_pool_t *pool) {
+    struct quadtree_alloc_t *alloc = pool->alloc;
+    if (!alloc->free_list) {
+        struct quadtree_chunk_t *chunk = malloc(sizeof *chunk);
+        chunk->next = alloc->chunks;
+        alloc->chunks = chunk;
+        // push in reverse so blocks are handed out in address order
+        for (size_t i = QUADTREE_POOL_CHUNK_BLOCKS; i-- > 0;) {
+            chunk->block[i].next = alloc->free_list;
+            alloc->free_list = &chunk->block[i];
+        }
+    }
+    struct quadtree_block_t *block = alloc->free_list;
+    alloc->free_list = block->next;
+    block->refs = 1;
+    block->stale = false;
+    return block->node;
+}
+
+// children must be a pointer returned by quadtree_pool_alloc
+static inline struct quadtree_block_t *quadtree_block_of(Quadtree *children) {
+    return (struct quadtree_block_t *)((char *)children - offsetof(struct quadtree_block_t, node));
+}
+
+static void quadtree_data_release(Quadtree *q);
+
+// drops a reference to children, freeing them and everything below
+// them once nothing refers to them.
+// pool must belong to the tree letting go, since the pool pointers of
+// shared nodes may point at a tree that has already been freed.
+static void quadtree_pool_release(struct quadtree_pool_t *pool, Quadtree *children) {
+    struct quadtree_block_t *block = quadtree_block_of(children);
+    if (--block->refs) {
+        block->stale = true;
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        quadtree_data_release(&children[i]);
+        if (children[i].child[0])
+            quadtree_pool_release(pool, children[i].child[0]);
+    }
+    block->next = pool->alloc->free_list;
+    pool->alloc->free_list = block;
+}
+
+static inline const struct quadtree_handle_entry_t *quadtree_handle_get(const struct quadtree_pool_t *pool, QuadtreeHandle h) {
+    return &pool->pages[h / QUADTREE_HANDLE_PAGE]->entry[h % QUADTREE_HANDLE_PAGE];
+}
+
+// same as quadtree_handle_get, but copies the page first if it's shared
+static inline struct quadtree_handle_entry_t *quadtree_handle_write(struct quadtree_pool_t *pool, QuadtreeHandle h) {
+    struct quadtree_handle_page_t **page = &pool->pages[h / QUADTREE_HANDLE_PAGE];
+    if (pool->pages_shared && (*page)->refs > 1) {
+        struct quadtree_handle_page_t *copy = malloc(sizeof *copy);
+        memcpy(copy->entry, (*page)->entry, sizeof copy->entry);
+        copy->refs = 1;
+        (*page)->refs--;
+        *page = copy;
+    }
+    return &(*page)->entry[h % QUADTREE_HANDLE_PAGE];
+}
+
+// makes room for len handles
+static void quadtree_handle_reserve(struct quadtree_pool_t *pool, size_t len) {
+    if (len <= pool->handles_cap)
+        return;
+    size_t pages = pool->handles_cap / QUADTREE_HANDLE_PAGE,
+           new_pages = (len + QUADTREE_HANDLE_PAGE - 1) / QUADTREE_HANDLE_PAGE;
+    // page pointers grow geometrically, pages one at a time
+    size_t ptr_cap = 1;
+    while (ptr_cap < new_pages)
+        ptr_cap *= 2;
+    pool->pages = realloc(pool->pages, ptr_cap * sizeof *pool->pages);
+    for (size_t i = pages; i < new_pages; i++) {
+        pool->pages[i] = malloc(sizeof *pool->pages[i]);
+        pool->pages[i]->refs = 1;
+    }
+    pool->handles_cap = new_pages * QUADTREE_HANDLE_PAGE;
+}
+
+// gives dest a copy of the handles of src
+static void quadtree_handle_copy(struct quadtree_pool_t *dest, const struct quadtree_pool_t *src) {
+    quadtree_handle_reserve(dest, src->handles_len);
+    for (size_t i = 0; i * QUADTREE_HANDLE_PAGE < src->handles_len; i++)
+        memcpy(dest->pages[i]->entry, src->pages[i]->entry, sizeof dest->pages[i]->entry);
+    dest->handles_len = src->handles_len;
+    dest->handles_used = src->handles_used;
+    dest->handles_free = src->handles_free;
+}
+
+// makes dest use the same handles as src, sharing the pages
+static void quadtree_handle_share(struct quadtree_pool_t *dest, struct quadtree_pool_t *src) {
+    size_t pages = src->handles_cap / QUADTREE_HANDLE_PAGE, ptr_cap = 1;
+    while (ptr_cap < pages)
+        ptr_cap *= 2;
+    dest->pages = malloc(ptr_cap * sizeof *dest->pages);
+    for (size_t i = 0; i < pages; i++) {
+        dest->pages[i] = src->pages[i];
+        dest->pages[i]->refs++;
+    }
+    dest->pages_shared = src->pages_shared = true;
+    dest->handles_len = src->handles_len;
+    dest->handles_cap = src->handles_cap;
+    dest->handles_used = src->handles_used;
+    dest->handles_free = src->handles_free;
+}
+
+static QuadtreeHandle quadtree_handle_new(struct quadtree_pool_t *pool) {
+    pool->handles_used++;
+    QuadtreeHandle h = pool->handles_free;
+    if (h != QUADTREE_NO_HANDLE) {
+        pool->handles_free = quadtree_handle_get(pool, h)->slot;
+        return h;
+    }
+    quadtree_handle_reserve(pool, pool->handles_len + 1);
+    return pool->handles_len++;
+}
+
+static void quadtree_handle_delete(struct quadtree_pool_t *pool, QuadtreeHandle h) {
+    struct quadtree_handle_entry_t *e = quadtree_handle_write(pool, h);
+    e->loc = 0;
+    e->slot = pool->handles_free;
+    pool->handles_free = h;
+    pool->handles_used--;
+}
+
+static inline void quadtree_handle_set(struct quadtree_pool_t *pool, QuadtreeHandle h, uint64_t loc, size_t slot) {
+    struct quadtree_handle_entry_t *e = quadtree_handle_write(pool, h);
+    e->loc = loc;
+    e->slot = slot;
+}
+
 // quadtree data functions
 
-static const char FREE_AABB[sizeof(AABB)];
+static inline void *quadtree_data_at(const Quadtree *q, size_t i) {
+    return (char *)q->data + i * q->el_size;
+}
 
 static inline void quadtree_data_init(Quadtree *q) {
     q->data_len = 0;
     q->data_cap = 0;
     q->data_free = 0;
     q->data = NULL;
+    q->handles = NULL;
+    q->occupied = NULL;
+    q->bounds = NULL;
 }
 
-static inline void quadtree_data_delete(Quadtree *q) {
-    free(q->data);
+// node data starts after a reference count, since snapshots share it
+union quadtree_data_header_t {
+    size_t refs;
+    long double align_ld;
+    long long align_ll;
+    void *align_p;
+};
+
+static inline size_t *quadtree_data_refs(const Quadtree *q) {
+    return &((union quadtree_data_header_t *)q->data - 1)->refs;
 }
 
-static void quadtree_data_remove_free(Quadtree *q) {
-    if (q->data_free) {
-        // similar to split_into_child
-        size_t end = q->data_len + q->data_free, out = 0,
-               block_start = 0, block_len;
-        for (size_t in = 0; in < end; in++) {
-            if (memcmp((char *)q->data + in * q->el_size, FREE_AABB, sizeof(AABB)) == 0) {
-                block_len = in - block_start;
-                memmove((char *)q->data + out * q->el_size, (char *)q->data + block_start * q->el_size, block_len * q->el_size);
-                out += block_len;
-                block_start = in + 1;
-#ifndef NDEBUG
-                q->data_free--;
+static void quadtree_data_release(Quadtree *q) {
+    if (q->data && --*quadtree_data_refs(q) == 0)
+        free((union quadtree_data_header_t *)q->data - 1);
+}
+
+static inline unsigned int quadtree_ctz(uint64_t x) {
+    assert(x != 0);
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (unsigned int)i;
+#else
+    unsigned int i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
+    }
+    return i;
 #endif
-            }
+}
+
+// number of words in an occupancy bitmap with n bits
+static inline size_t quadtree_data_words(size_t n) {
+    return (n + 63) / 64;
+}
+
+static inline bool quadtree_data_is_free(const Quadtree *q, size_t i) {
+    return !(q->occupied[i / 64] >> (i % 64) & 1);
+}
+
+static inline void quadtree_data_mark(Quadtree *q, size_t i) {
+    q->occupied[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static inline void quadtree_data_unmark(Quadtree *q, size_t i) {
+    q->occupied[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+// sets occupancy bits [from, to)
+static void quadtree_data_mark_range(Quadtree *q, size_t from, size_t to) {
+    while (from < to) {
+        size_t bit = from % 64, n = to - from < 64 - bit ? to - from : 64 - bit;
+        q->occupied[from / 64] |= (n == 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1) << bit;
+        from += n;
+    }
+}
+
+// bounds are scanned this many at a time
+#define QUADTREE_LANES 8
+
+// length of each bounds array, padded so scans can read whole groups
+static inline size_t quadtree_data_stride(size_t cap) {
+    return (cap + QUADTREE_LANES - 1) / QUADTREE_LANES * QUADTREE_LANES;
+}
+
+// node storage is a single allocation: data_cap elements, then
+// data_cap handles, the occupancy bitmap and the x1, y1, x2, y2 bounds
+// arrays. off receives the offsets of the handles, the bitmap and the
+// four bounds arrays, and the total size is returned.
+static size_t quadtree_data_layout(size_t cap, size_t el_size, size_t off[6]) {
+    const size_t align = sizeof(QuadtreeHandle) > sizeof(uint64_t) ? sizeof(QuadtreeHandle) : sizeof(uint64_t);
+    size_t stride = quadtree_data_stride(cap) * sizeof(int);
+    off[0] = (cap * el_size + align - 1) / align * align;
+    off[1] = off[0] + cap * sizeof(QuadtreeHandle);
+    off[2] = off[1] + quadtree_data_words(cap) * sizeof(uint64_t);
+    for (int k = 3; k < 6; k++)
+        off[k] = off[k - 1] + stride;
+    return off[5] + stride;
+}
+
+// changes capacity, keeping the first data_len + data_free slots.
+// if the data is shared, it's copied even if cap stays the same.
+static void quadtree_data_resize(Quadtree *q, size_t cap) {
+    size_t used = q->data_len + q->data_free;
+    assert(used <= cap);
+    if (cap == 0) {
+        quadtree_data_release(q);
+        q->data = NULL;
+        q->handles = NULL;
+        q->occupied = NULL;
+        q->bounds = NULL;
+        q->data_cap = 0;
+        return;
+    }
+    const size_t header = sizeof(union quadtree_data_header_t);
+    size_t old_off[6], new_off[6], len[6];
+    quadtree_data_layout(q->data_cap, q->el_size, old_off);
+    size_t size = quadtree_data_layout(cap, q->el_size, new_off);
+    len[0] = used * sizeof(QuadtreeHandle);
+    len[1] = quadtree_data_words(used) * sizeof(uint64_t);
+    for (int k = 2; k < 6; k++)
+        len[k] = used * sizeof(int);
+    char *mem;
+    if (q->data && *quadtree_data_refs(q) > 1) {
+        // leave the shared copy alone
+        mem = (char *)malloc(header + size) + header;
+        memcpy(mem, q->data, used * q->el_size);
+        for (int k = 0; k < 6; k++)
+            memcpy(mem + new_off[k], (char *)q->data + old_off[k], len[k]);
+        (*quadtree_data_refs(q))--;
+    } else {
+        if (cap == q->data_cap)
+            return;
+        mem = q->data;
+        // the arrays after the elements have to move down before shrinking
+        // or up after growing, in an order that doesn't overwrite each other
+        if (cap < q->data_cap)
+            for (int k = 0; k < 6; k++)
+                memmove(mem + new_off[k], mem + old_off[k], len[k]);
+        mem = (char *)realloc(mem ? mem - header : NULL, header + size) + header;
+        if (cap > q->data_cap)
+            for (int k = 5; k >= 0; k--)
+                memmove(mem + new_off[k], mem + old_off[k], len[k]);
+    }
+    // bits past the used slots are always clear
+    memset(mem + new_off[1] + len[1], 0, new_off[2] - new_off[1] - len[1]);
+    q->data = mem;
+    *quadtree_data_refs(q) = 1;
+    q->handles = (QuadtreeHandle *)(mem + new_off[0]);
+    q->occupied = (uint64_t *)(mem + new_off[1]);
+    q->bounds = (int *)(mem + new_off[2]);
+    q->data_cap = cap;
+    q->pool->counters.reallocs++;
+}
+
+// copies the data of q if it's shared, so it can be written
+static inline void quadtree_data_own(Quadtree *q) {
+    if (q->data && *quadtree_data_refs(q) > 1)
+        quadtree_data_resize(q, q->data_cap);
+}
+
+static inline void quadtree_data_set_bounds(Quadtree *q, size_t i, const AABB *box) {
+    size_t stride = quadtree_data_stride(q->data_cap);
+    int *b = q->bounds + i;
+    b[0] = box->x1;
+    b[stride] = box->y1;
+    b[2 * stride] = box->x2;
+    b[3 * stride] = box->y2;
+}
+
+// copy bounds of len slots from src to dst (may overlap)
+static inline void quadtree_data_copy_bounds(Quadtree *dest, size_t dst, const Quadtree *src, size_t from, size_t len) {
+    size_t dest_stride = quadtree_data_stride(dest->data_cap),
+           src_stride = quadtree_data_stride(src->data_cap);
+    for (int k = 0; k < 4; k++)
+        memmove(dest->bounds + k * dest_stride + dst, src->bounds + k * src_stride + from, len * sizeof(int));
+}
+
+// point handles of slots [from, to) at their slots
+static inline void quadtree_data_rehandle(Quadtree *q, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++)
+        quadtree_handle_set(q->pool, q->handles[i], q->loc, i);
+}
+
+// copy el into slot i
+static inline void quadtree_data_put(Quadtree *q, size_t i, const void *el, QuadtreeHandle h) {
+    memcpy(quadtree_data_at(q, i), el, q->el_size);
+    quadtree_data_set_bounds(q, i, (const AABB *)el);
+    quadtree_data_mark(q, i);
+    q->handles[i] = h;
+    quadtree_handle_set(q->pool, h, q->loc, i);
+}
+
+// move len slots starting at src to dst (may overlap),
+// leaving the occupancy bits to the caller
+static void quadtree_data_move(Quadtree *q, size_t dst, size_t src, size_t len) {
+    if (dst == src || len == 0) return;
+    memmove(quadtree_data_at(q, dst), quadtree_data_at(q, src), len * q->el_size);
+    memmove(&q->handles[dst], &q->handles[src], len * sizeof(QuadtreeHandle));
+    quadtree_data_copy_bounds(q, dst, q, src, len);
+    quadtree_data_rehandle(q, dst, dst + len);
+}
+
+// closes the holes, keeping elements in order.
+// holes are found by scanning the bitmap a word at a time, and each
+// one costs a single block move.
+static void quadtree_data_remove_free(Quadtree *q) {
+    if (!q->data_free)
+        return;
+    quadtree_data_own(q);
+    size_t end = q->data_len + q->data_free, words = quadtree_data_words(end),
+           out = 0, block_start = 0, block_len;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t holes = ~q->occupied[w];
+        if (w == words - 1 && end % 64)
+            holes &= ((uint64_t)1 << (end % 64)) - 1;
+        for (; holes; holes &= holes - 1) {
+            size_t hole = w * 64 + quadtree_ctz(holes);
+            block_len = hole - block_start;
+            quadtree_data_move(q, out, block_start, block_len);
+            out += block_len;
+            block_start = hole + 1;
         }
-        // move last block
-        block_len = end - block_start;
-        memmove((char *)q->data + out * q->el_size, (char *)q->data + block_start * q->el_size, block_len * q->el_size);
-        assert(q->data_free == 0);
-        q->data_free = 0;
     }
+    // move last block
+    block_len = end - block_start;
+    quadtree_data_move(q, out, block_start, block_len);
+    assert(out + block_len == q->data_len);
+    memset(q->occupied, 0, words * sizeof(uint64_t));
+    quadtree_data_mark_range(q, 0, q->data_len);
+    q->data_free = 0;
 }
 
-static void quadtree_data_insert(Quadtree *q, void *el) {
+static void quadtree_data_insert(Quadtree *q, void *el, QuadtreeHandle h) {
+    quadtree_data_own(q);
     if (q->data_cap == 0) {
         assert(q->data_len == 0 && q->data_free == 0);
-        q->data_cap = 1;
-        q->data = malloc(q->data_cap * q->el_size);
+        quadtree_data_resize(q, 1);
     }
     if (q->data_len + q->data_free >= q->data_cap) {
         quadtree_data_remove_free(q);
     }
     if (q->data_len == q->data_cap) {
         assert(q->data_free == 0);
-        q->data_cap *= 2;
-        q->data = realloc(q->data, q->data_cap * q->el_size);
+        quadtree_data_resize(q, q->data_cap * 2);
     }
-    memcpy((char *)q->data + (q->data_len + q->data_free) * q->el_size, el, q->el_size);
+    quadtree_data_put(q, q->data_len + q->data_free, el, h);
     q->data_len++;
 }
 
+// bits of Quadtree.edges
+#define QUADTREE_EDGE_WEST 1
+#define QUADTREE_EDGE_EAST 2
+#define QUADTREE_EDGE_NORTH 4
+#define QUADTREE_EDGE_SOUTH 8
+
+// sides of the node with location code loc that lie on the root's sides
+static inline uint8_t quadtree_edges_of(uint64_t loc) {
+    uint8_t edges = QUADTREE_EDGE_WEST | QUADTREE_EDGE_EAST | QUADTREE_EDGE_NORTH | QUADTREE_EDGE_SOUTH;
+    for (; loc > 1; loc >>= 2) {
+        edges &= loc & 1 ? ~QUADTREE_EDGE_WEST : ~QUADTREE_EDGE_EAST;
+        edges &= loc & 2 ? ~QUADTREE_EDGE_NORTH : ~QUADTREE_EDGE_SOUTH;
+    }
+    return edges;
+}
+
+// how far each side of a child of a node size wide is moved out.
+// children end up looseness times as big as their share of the node.
+static inline int quadtree_loose_pad(double looseness, int size) {
+    return (int)((looseness - 1.0) * size / 4);
+}
+
+// index of the child that el goes into, or 4 if it stays in q.
+// in a normal quadtree that's the first child that contains el. in a
+// loose one it's the child whose share of q has el's center, if el
+// fits in that child's grown box.
+// the center also has to be inside q itself, except past the edges of
+// the root. otherwise moving an element could put it below a node that
+// inserting it from the root never reaches, since a grown box reaches
+// outside its parent.
+static inline int quadtree_child_of(const Quadtree *q, const AABB *el) {
+    // the grown boxes of neighboring children overlap by twice the pad.
+    // everything is doubled so the center is a whole number.
+    int64_t mx = (int64_t)q->box[0].x2 + q->box[1].x1, my = (int64_t)q->box[0].y2 + q->box[2].y1;
+    if (mx == 2 * (int64_t)q->box[0].x2 && my == 2 * (int64_t)q->box[0].y2) {
+        int i = 0;
+        while (i < 4 && !aabb_contains(&q->box[i], el)) i++;
+        return i;
+    }
+    int64_t px = (int64_t)q->box[0].x2 - q->box[1].x1, py = (int64_t)q->box[0].y2 - q->box[2].y1,
+            ex = (int64_t)el->x1 + el->x2, ey = (int64_t)el->y1 + el->y2;
+    if ((!(q->edges & QUADTREE_EDGE_WEST) && ex < 2 * (int64_t)q->box[0].x1 + px)
+     || (!(q->edges & QUADTREE_EDGE_EAST) && ex >= 2 * (int64_t)q->box[1].x2 - px)
+     || (!(q->edges & QUADTREE_EDGE_NORTH) && ey < 2 * (int64_t)q->box[0].y1 + py)
+     || (!(q->edges & QUADTREE_EDGE_SOUTH) && ey >= 2 * (int64_t)q->box[2].y2 - py))
+        return 4;
+    int i = (ex >= mx) | (ey >= my) << 1;
+    return aabb_contains(&q->box[i], el) ? i : 4;
+}
+
+// the part of q that child i covers, before it was grown
+static inline void quadtree_child_box(const Quadtree *q, int i, AABB *out) {
+    int px = (q->box[0].x2 - q->box[1].x1) / 2, py = (q->box[0].y2 - q->box[2].y1) / 2;
+    const AABB *b = &q->box[i];
+    aabb_init(out, b->x1 + px, b->y1 + py, b->x2 - px, b->y2 - py);
+}
+
+// the box that q shares out between its children
+static inline void quadtree_node_box(const Quadtree *q, AABB *out) {
+    AABB nw, se;
+    quadtree_child_box(q, NORTHWEST, &nw);
+    quadtree_child_box(q, SOUTHEAST, &se);
+    aabb_init(out, nw.x1, nw.y1, se.x2, se.y2);
+}
+
 // move elements from us to children satisfying predicate
 // i is index of child
 static void quadtree_data_split_into_child(Quadtree *q, int i) {
-    size_t end = q->data_len + q->data_free, out = 0;
+    quadtree_data_own(q);
+    size_t end = q->data_len + q->data_free, words = quadtree_data_words(end), out = 0;
     // remove freed elements while we're at it
-    for (size_t in = 0; in < end; in++) {
-        void *inptr = (void *)((char *)q->data + in * q->el_size);
-        if (memcmp(inptr, FREE_AABB, sizeof(AABB)) == 0) {
-            // do nothing
-#ifndef NDEBUG
-            q->data_free--;
-#endif
-        } if (aabb_contains(&q->box[i], (AABB *)inptr)) {
-            quadtree_data_insert(q->child[i], inptr);
-        } else {
-            if (in != out) {
-                memcpy((char *)q->data + out * q->el_size, inptr, q->el_size);
+    for (size_t w = 0; w < words; w++) {
+        uint64_t bits = q->occupied[w];
+        q->occupied[w] = 0;
+        while (bits) {
+            size_t in = w * 64 + quadtree_ctz(bits);
+            bits &= bits - 1;
+            void *inptr = quadtree_data_at(q, in);
+            if (quadtree_child_of(q, (AABB *)inptr) == i) {
+                quadtree_data_insert(q->child[i], inptr, q->handles[in]);
+            } else {
+                // out <= in, so this never overwrites an unvisited slot
+                if (in != out)
+                    quadtree_data_put(q, out, inptr, q->handles[in]);
+                else
+                    quadtree_data_mark(q, out);
+                out++;
             }
-            out++;
         }
     }
     q->data_len = out;
-    assert(q->data_free == 0);
     q->data_free = 0;
 }
 
@@ -144,149 +930,280 @@ static void quadtree_data_cleanup_after_split(Quadtree *q) {
     // shrink data if necessary
     assert(q->data_free == 0);
     if (q->data_cap / 2 >= q->data_len) {
-        q->data_cap /= 2;
-        while (q->data_cap && q->data_cap / 2 >= q->data_len)
-            q->data_cap /= 2;
-        if (q->data_cap == 0) {
-            free(q->data);
-            q->data = NULL;
-        } else {
-            q->data = realloc(q->data, q->data_cap * q->el_size);
-        }
+        size_t cap = q->data_cap / 2;
+        while (cap && cap / 2 >= q->data_len)
+            cap /= 2;
+        quadtree_data_resize(q, cap);
     }
 }
 
+// capacity a node ends up with after len insertions
+static inline size_t quadtree_data_fit_cap(size_t len) {
+    size_t cap = len ? 1 : 0;
+    while (cap < len)
+        cap *= 2;
+    return cap;
+}
+
 static void quadtree_data_reserve(Quadtree *q, size_t new_len) {
-    if (q->data_cap == 0) q->data_cap = 1;
+    size_t cap = q->data_cap ? q->data_cap : 1;
     // if removing element from node with all zero-element children
     // while number of elements is one more than a power of two
-    if (q->data_cap / 2 >= new_len) q->data_cap /= 2;
+    if (cap / 2 >= new_len) cap /= 2;
     // not really necessary, but I like having powers of two
-    while (q->data_cap < new_len) {
-        q->data_cap *= 2;
-    }
-    // possibility that we just reduced data_cap to 0
-    if (q->data_cap) {
-        quadtree_data_remove_free(q);
-        q->data = realloc(q->data, q->data_cap * q->el_size);
-    } else {
-        free(q->data);
-        q->data = NULL;
-        q->data_free = 0;
+    while (cap < new_len) {
+        cap *= 2;
     }
+    // possibility that we just reduced cap to 0
+    quadtree_data_remove_free(q);
+    quadtree_data_resize(q, cap);
 }
 
 static inline void quadtree_data_unsplit_from_child(Quadtree *q, int i) {
     assert(q->data_free == 0);
-    quadtree_data_remove_free(q->child[i]);
-    memcpy((char *)q->data + q->data_len * q->el_size, q->child[i]->data, q->child[i]->data_len * q->el_size);
-    q->data_len += q->child[i]->data_len;
+    const Quadtree *c = q->child[i];
+    if (c->data_free) {
+        // c may be shared with a snapshot, so copy around the holes
+        // instead of closing them
+        size_t words = quadtree_data_words(c->data_len + c->data_free);
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = c->occupied[w]; bits; bits &= bits - 1) {
+                size_t j = w * 64 + quadtree_ctz(bits);
+                quadtree_data_put(q, q->data_len++, quadtree_data_at(c, j), c->handles[j]);
+            }
+        }
+        return;
+    }
+    memcpy(quadtree_data_at(q, q->data_len), c->data, c->data_len * q->el_size);
+    memcpy(&q->handles[q->data_len], c->handles, c->data_len * sizeof(QuadtreeHandle));
+    quadtree_data_copy_bounds(q, q->data_len, c, 0, c->data_len);
+    quadtree_data_mark_range(q, q->data_len, q->data_len + c->data_len);
+    quadtree_data_rehandle(q, q->data_len, q->data_len + c->data_len);
+    q->data_len += c->data_len;
+}
+
+// bit i of the result is set if bounds i intersect box,
+// for QUADTREE_LANES bounds starting at x1, y1, x2, y2
+#if defined(QUADTREE_AVX2)
+static inline unsigned int quadtree_bounds_hits(const AABB *box, const int *x1, const int *y1, const int *x2, const int *y2) {
+    __m256i bx1 = _mm256_set1_epi32(box->x1), by1 = _mm256_set1_epi32(box->y1),
+            bx2 = _mm256_set1_epi32(box->x2), by2 = _mm256_set1_epi32(box->y2);
+    // same test as aabb_intersect
+    __m256i x = _mm256_and_si256(_mm256_cmpgt_epi32(bx2, _mm256_loadu_si256((const __m256i *)x1)),
+                                 _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)x2), bx1));
+    __m256i y = _mm256_and_si256(_mm256_cmpgt_epi32(by2, _mm256_loadu_si256((const __m256i *)y1)),
+                                 _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)y2), by1));
+    return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(x, y)));
+}
+#elif defined(QUADTREE_SSE2)
+static inline unsigned int quadtree_bounds_hits4(__m128i bx1, __m128i by1, __m128i bx2, __m128i by2, const int *x1, const int *y1, const int *x2, const int *y2) {
+    __m128i x = _mm_and_si128(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)x1), bx2),
+                              _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)x2), bx1));
+    __m128i y = _mm_and_si128(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)y1), by2),
+                              _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)y2), by1));
+    return (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(x, y)));
+}
+
+static inline unsigned int quadtree_bounds_hits(const AABB *box, const int *x1, const int *y1, const int *x2, const int *y2) {
+    __m128i bx1 = _mm_set1_epi32(box->x1), by1 = _mm_set1_epi32(box->y1),
+            bx2 = _mm_set1_epi32(box->x2), by2 = _mm_set1_epi32(box->y2);
+    return quadtree_bounds_hits4(bx1, by1, bx2, by2, x1, y1, x2, y2)
+         | quadtree_bounds_hits4(bx1, by1, bx2, by2, x1 + 4, y1 + 4, x2 + 4, y2 + 4) << 4;
+}
+#else
+static inline unsigned int quadtree_bounds_hits(const AABB *box, const int *x1, const int *y1, const int *x2, const int *y2) {
+    unsigned int mask = 0;
+    for (int i = 0; i < QUADTREE_LANES; i++)
+        mask |= (unsigned int)(x1[i] < box->x2 && x2[i] > box->x1
+                            && y1[i] < box->y2 && y2[i] > box->y1) << i;
+    return mask;
+}
+#endif
+
+// hits among the QUADTREE_LANES slots starting at i
+static inline unsigned int quadtree_data_hits(const Quadtree *q, const AABB *box, size_t i) {
+    size_t stride = quadtree_data_stride(q->data_cap);
+    const int *x1 = q->bounds + i, *y1 = x1 + stride, *x2 = y1 + stride, *y2 = x2 + stride;
+    // free slots and the padding after the last slot have clear bits
+    return quadtree_bounds_hits(box, x1, y1, x2, y2)
+         & (unsigned int)(q->occupied[i / 64] >> (i % 64));
 }
 
 static void quadtree_data_traverse(Quadtree *q, AABB *box, qt_callback_fn callback, void *cb_data) {
-    for (size_t i = 0; i < q->data_len + q->data_free; i++) {
-        void *d = (void *)((char *)q->data + i * q->el_size);
-        if (memcmp(d, FREE_AABB, sizeof(AABB)) == 0) continue;
-        AABB *dbox = (AABB *)d;
-        if (aabb_intersect(box, dbox))
-            callback(cb_data, d);
-    }
-}
-
-// remove el from data and copy into buf, if given
-static void quadtree_data_remove(Quadtree *q, void *el, qt_equal_fn equal, void *buf) {
-    bool found = false;
-    for (size_t i = 0; i < q->data_len + q->data_free; i++) {
-        if (equal(el, (char *)q->data + i * q->el_size)) {
-            if (buf)
-                memcpy(buf, (char *)q->data + i * q->el_size, q->el_size);
-            // mark as free
-            memcpy((char *)q->data + i * q->el_size, FREE_AABB, sizeof(AABB));
-            q->data_len--;
-            q->data_free++;
-            found = true;
-            break;
+    size_t end = q->data_len + q->data_free;
+    for (size_t i = 0; i < end; i += QUADTREE_LANES) {
+        unsigned int mask = quadtree_data_hits(q, box, i);
+        while (mask) {
+            size_t j = i + quadtree_ctz(mask);
+            mask &= mask - 1;
+            callback(cb_data, quadtree_data_at(q, j));
+        }
+    }
+}
+
+// returns slot of el, or data_len + data_free if not found
+static size_t quadtree_data_find(const Quadtree *q, void *el, qt_equal_fn equal) {
+    size_t end = q->data_len + q->data_free, words = quadtree_data_words(end);
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = q->occupied[w]; bits; bits &= bits - 1) {
+            size_t i = w * 64 + quadtree_ctz(bits);
+            if (equal(el, quadtree_data_at(q, i)))
+                return i;
         }
     }
-    if (!found) assert(!"element was not found in quadtree");
-    // memmove((char *)q->data + i * q->el_size, (char *)q->data + (i + 1) * q->el_size, (q->data_len - i) * q->el_size);
+    assert(!"element was not found in quadtree");
+    return end;
+}
+
+// remove slot i from data and copy into buf, if given
+static void quadtree_data_remove_slot(Quadtree *q, size_t i, void *buf) {
+    if (buf)
+        memcpy(buf, quadtree_data_at(q, i), q->el_size);
+    quadtree_data_own(q);
+    quadtree_data_unmark(q, i);
+    q->data_len--;
+    q->data_free++;
     // check if we can reduce capacity
     if (q->data_cap / 2 >= q->data_len) {
-        q->data_cap /= 2;
-        if (q->data_cap) {
+        size_t cap = q->data_cap / 2;
+        if (cap)
             quadtree_data_remove_free(q);
-            q->data = realloc(q->data, q->data_cap * q->el_size);
-        } else {
-            free(q->data);
-            q->data = NULL;
+        else
             q->data_free = 0;
-        }
+        quadtree_data_resize(q, cap);
     }
 }
 
 static void quadtree_data_clone(Quadtree *dest, const Quadtree *src) {
-    dest->data_cap = src->data_cap;
-    dest->data_len = src->data_len;
-    dest->data_free = 0;
-    if (!src->data) {
-        dest->data = NULL;
+    quadtree_data_init(dest);
+    if (!src->data)
+        return;
+    quadtree_data_resize(dest, src->data_cap);
+    if (!src->data_free) {
+        // slots stay the same, so the whole allocation can be copied
+        size_t off[6];
+        memcpy(dest->data, src->data, quadtree_data_layout(src->data_cap, src->el_size, off));
+        dest->data_len = src->data_len;
         return;
     }
-    dest->data = malloc(src->data_cap * src->el_size);
     // remove free while we're at it
-    if (src->data_free) {
-        // similar to quadtree_data_remove_free
-        size_t end = src->data_len + src->data_free, out = 0,
-               block_start = 0, block_len;
-        for (size_t in = 0; in < end; in++) {
-            if (memcmp((char *)src->data + in * src->el_size, FREE_AABB, sizeof(AABB)) == 0) {
-                block_len = in - block_start;
-                memcpy((char *)dest->data + out * dest->el_size, (char *)src->data + block_start * src->el_size, block_len * src->el_size);
-                out += block_len;
-                block_start = in + 1;
-            }
+    size_t words = quadtree_data_words(src->data_len + src->data_free);
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = src->occupied[w]; bits; bits &= bits - 1) {
+            size_t i = w * 64 + quadtree_ctz(bits);
+            quadtree_data_put(dest, dest->data_len++, quadtree_data_at(src, i), src->handles[i]);
         }
-        // move last block
-        block_len = end - block_start;
-        memcpy((char *)dest->data + out * dest->el_size, (char *)src->data + block_start * src->el_size, block_len * src->el_size);
-    } else {
-        memcpy(dest->data, src->data, src->data_len * src->el_size);
     }
+    assert(dest->data_len == src->data_len);
 }
 
 // quadtree functions
 
-void quadtree_init(Quadtree *q, const AABB *box, size_t depth, size_t el_size) {
+static void quadtree_node_init(Quadtree *q, const AABB *box, size_t depth, size_t el_size, struct quadtree_pool_t *pool, uint64_t loc) {
     int x[] = {box->x1, (box->x1 + box->x2) / 2, box->x2};
     int y[] = {box->y1, (box->y1 + box->y2) / 2, box->y2};
+    int px = quadtree_loose_pad(pool->looseness, box->x2 - box->x1),
+        py = quadtree_loose_pad(pool->looseness, box->y2 - box->y1);
     for (int i = 0; i < 4; i++) {
-        aabb_init(&q->box[i], x[i & 1], y[i >> 1], x[(i & 1) + 1], y[(i >> 1) + 1]);
+        aabb_init(&q->box[i], x[i & 1] - px, y[i >> 1] - py, x[(i & 1) + 1] + px, y[(i >> 1) + 1] + py);
         q->child[i] = NULL;
     }
+    q->pool = pool;
+    q->loc = loc;
+    q->edges = quadtree_edges_of(loc);
     q->max_depth = depth;
     q->el_size = el_size;
+    q->dirty = false;
+    q->split_time = 0;
     quadtree_data_init(q);
 }
 
+void quadtree_init(Quadtree *q, const AABB *box, size_t depth, size_t el_size) {
+    quadtree_init_loose(q, box, depth, el_size, 1.0);
+}
+
+void quadtree_init_loose(Quadtree *q, const AABB *box, size_t depth, size_t el_size, double looseness) {
+    assert(depth <= QUADTREE_MAX_DEPTH);
+    assert(looseness >= 1.0);
+    struct quadtree_pool_t *pool = quadtree_pool_new(el_size, NULL);
+    pool->looseness = looseness;
+    quadtree_node_init(q, box, depth, el_size, pool, 1);
+}
+
+// makes the children of q private to this tree, copying them if a
+// snapshot can see them. q must already be private.
+// their data and children stay shared until they're written to.
+static void quadtree_own_children(Quadtree *q) {
+    struct quadtree_block_t *block = quadtree_block_of(q->child[0]);
+    if (block->refs > 1) {
+        Quadtree *children = quadtree_pool_alloc(q->pool);
+        memcpy(children, q->child[0], 4 * sizeof(Quadtree));
+        for (int i = 0; i < 4; i++) {
+            if (children[i].data)
+                (*quadtree_data_refs(&children[i]))++;
+            if (children[i].child[0])
+                quadtree_block_of(children[i].child[0])->refs++;
+            q->child[i] = &children[i];
+        }
+        block->refs--;
+        block->stale = true;
+    } else if (!block->stale) {
+        return;
+    }
+    for (int i = 0; i < 4; i++)
+        q->child[i]->pool = q->pool;
+    quadtree_block_of(q->child[0])->stale = false;
+}
+
+// makes path[0..depth] private, fixing up the pointers in path
+static void quadtree_own_path(Quadtree **path, size_t depth) {
+    for (size_t d = 0; d < depth; d++) {
+        quadtree_own_children(path[d]);
+        path[d + 1] = path[d]->child[path[d + 1]->loc & 3];
+    }
+}
+
 void quadtree_free(Quadtree *q) {
     if (q == NULL) return;
-    quadtree_data_delete(q);
-    for (int i = 0; i < 4; i++) {
-        quadtree_free(q->child[i]);
-        free(q->child[i]);
-    }
+    quadtree_data_release(q);
+    if (q->child[0])
+        quadtree_pool_release(q->pool, q->child[0]);
+    quadtree_pool_delete(q->pool);
+    q->pool = NULL;
 }
 
 static inline bool quadtree_should_subdivide(Quadtree *q) {
-    return q->data_len >= QUADTREE_THRESHOLD && q->max_depth > 0;
+    return q->data_len >= q->pool->config.split_threshold && q->max_depth > 0;
+}
+
+// if q and its children have few enough elements to be merged
+static bool quadtree_should_unsubdivide(Quadtree *q) {
+    const struct quadtree_pool_t *pool = q->pool;
+    if (pool->time - q->split_time < pool->config.min_lifetime)
+        return false;
+    size_t len = q->data_len;
+    // if children have children, they must be over threshold
+    for (int i = 0; i < 4; i++) {
+        if (q->child[i]->child[0])
+            return false;
+        len += q->child[i]->data_len;
+    }
+    return len < pool->config.merge_threshold;
 }
 
 static void quadtree_subdivide(Quadtree *q) {
     assert(q->max_depth > 0);
+    assert(!q->child[0] && "subdividing when already subdivided");
+    Quadtree *children = quadtree_pool_alloc(q->pool);
+    q->pool->counters.splits++;
+    q->split_time = q->pool->time;
+    for (int i = 0; i < 4; i++)
+        q->child[i] = &children[i];
     for (int i = 0; i < 4; i++) {
-        assert(!q->child[i] && "subdividing when already subdivided");
-        Quadtree *c = q->child[i] = malloc(sizeof(Quadtree));
-        quadtree_init(c, &q->box[i], q->max_depth - 1, q->el_size);
+        Quadtree *c = q->child[i];
+        AABB box;
+        quadtree_child_box(q, i, &box);
+        quadtree_node_init(c, &box, q->max_depth - 1, q->el_size, q->pool, q->loc << 2 | i);
         quadtree_data_split_into_child(q, i);
         // subdivide if necessary
         if (quadtree_should_subdivide(c))
@@ -295,148 +1212,3324 @@ static void quadtree_subdivide(Quadtree *q) {
     quadtree_data_cleanup_after_split(q);
 }
 
-static void quadtree_insert_leaf(Quadtree *q, void *el) {
-    quadtree_data_insert(q, el);
+static void quadtree_insert_node(Quadtree *q, void *el, QuadtreeHandle h);
+
+static void quadtree_insert_leaf(Quadtree *q, void *el, QuadtreeHandle h) {
+    quadtree_data_insert(q, el, h);
     if (!q->child[0] && quadtree_should_subdivide(q))
         quadtree_subdivide(q);
 }
 
-// returns true if it was contained in one of box
-static bool quadtree_insert_children(Quadtree *q, void *el) {
-    for (int i = 0; i < 4; i++) {
-        if (aabb_contains(&q->box[i], (AABB *)el)) {
-            quadtree_insert(q->child[i], el);
-            return true;
-        }
-    }
-    return false;
+// returns true if it went into one of the children
+static bool quadtree_insert_children(Quadtree *q, void *el, QuadtreeHandle h) {
+    int i = quadtree_child_of(q, (AABB *)el);
+    if (i == 4)
+        return false;
+    quadtree_own_children(q);
+    quadtree_insert_node(q->child[i], el, h);
+    return true;
 }
 
-void quadtree_insert(Quadtree *q, void *el) {
+static void quadtree_insert_node(Quadtree *q, void *el, QuadtreeHandle h) {
     if (q->child[0] == NULL) {
         // unsubdivided
-        quadtree_insert_leaf(q, el);
+        quadtree_insert_leaf(q, el, h);
     } else {
-        if (!quadtree_insert_children(q, el)) {
-            quadtree_insert_leaf(q, el);
+        if (!quadtree_insert_children(q, el, h)) {
+            quadtree_insert_leaf(q, el, h);
         }
     }
 }
 
+static void quadtree_fit(Quadtree *q, const AABB *box);
+
+QuadtreeHandle quadtree_insert(Quadtree *q, void *el) {
+    q->pool->time++;
+    quadtree_fit(q, (AABB *)el);
+    QuadtreeHandle h = quadtree_handle_new(q->pool);
+    quadtree_insert_node(q, el, h);
+    return h;
+}
+
 // all children must not have children
 static void quadtree_unsubdivide(Quadtree *q) {
     for (int i = 0; i < 4; i++) assert(!q->child[i]->child[0]);
     size_t new_len = q->data_len;
     for (int i = 0; i < 4; i++) new_len += q->child[i]->data_len;
     quadtree_data_reserve(q, new_len);
-    // copy elements from children and delete
+    // copy elements from children, which are freed with the block
     for (int i = 0; i < 4; i++) {
         if (q->child[i]->data_len) {
             quadtree_data_unsplit_from_child(q, i);
         }
-        quadtree_free(q->child[i]);
-        free(q->child[i]);
-        q->child[i] = NULL;
     }
+    quadtree_pool_release(q->pool, q->child[0]);
+    q->pool->counters.merges++;
+    for (int i = 0; i < 4; i++)
+        q->child[i] = NULL;
 }
 
-// returns true if element was inserted into its new position
-// OR if we're just removing AND current node has children, so
-// no need to prune further
-static bool quadtree_move_impl(Quadtree *q, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf) {
-    // walk through tree to find where it should be inserted
-    // pretty similar to insert
+// path[0] is the root and path[depth] is the node holding the element.
+// finds the element by descending by its AABB and comparing with equal.
+// returns its slot, or data_len + data_free of path[depth] if not found
+static size_t quadtree_find(Quadtree *q, void *el, qt_equal_fn equal, Quadtree **path, size_t *depth) {
     AABB *box = (AABB *)el;
-    if (q->child[0] == NULL) {
-        // unsubdivided
-        quadtree_data_remove(q, el, equal, buf);
-        if (new_bounds)
-            memcpy(buf, new_bounds, sizeof(AABB));
-        // since we don't have any children, we can't recurse
-        // no children, so can't unsubdivide
-        return false;
-    } else {
-        bool found = false;
-        for (int i = 0; i < 4; i++) {
-            if (aabb_contains(&q->box[i], box)) {
-                found = true;
-                if (quadtree_move_impl(q->child[i], el, equal, new_bounds, buf))
-                    return true;
-                break; // no point in exploring other children
-            }
-        }
-        if (!found) {
-            // it's stored in here as a "leaf"
-            quadtree_data_remove(q, el, equal, buf);
-            if (new_bounds)
-                memcpy(buf, new_bounds, sizeof(AABB));
-        }
-        // by now, we've already moved the element into buf and modified its AABB
-        // so just try to insert, but don't add it as a leaf node because it might
-        // not fit into here
-        // return true if not unsubdividing because impossible to unsubdivide when
-        // children have children
-        bool ret = new_bounds ? quadtree_insert_children(q, buf) : true;
-        // prune if few children
-        // it's *probably* OK to prune after reinserting.
-        size_t len = q->data_len;
-        bool children_have_children = false;
-        // if children have children, they must be over threshold
-        // otherwise it'd be caught by recursive call already
-        for (int i = 0; i < 4; i++) {
-            if (q->child[i]->child[0]) {
-                children_have_children = true;
-                break;
-            }
-            len += q->child[i]->data_len;
-        }
-        if (len < QUADTREE_THRESHOLD && !children_have_children) {
-            quadtree_unsubdivide(q);
-            // we no longer have children, so caller should
+    size_t d = 0;
+    path[0] = q;
+    while (q->child[0]) {
+        int i = quadtree_child_of(q, box);
+        // it's stored in here as a "leaf"
+        if (i == 4) break;
+        q = q->child[i];
+        path[++d] = q;
+    }
+    *depth = d;
+    return quadtree_data_find(q, el, equal);
+}
+
+// same as quadtree_find, but follows the location code of a handle
+static size_t quadtree_handle_find(Quadtree *q, QuadtreeHandle h, Quadtree **path, size_t *depth) {
+    const struct quadtree_handle_entry_t *e = quadtree_handle_get(q->pool, h);
+    assert(e->loc && "handle is not in use");
+    unsigned int shift = 0;
+    while (e->loc >> shift >> 2)
+        shift += 2;
+    *depth = shift / 2;
+    path[0] = q;
+    for (size_t d = 1; shift; d++) {
+        shift -= 2;
+        q = q->child[(e->loc >> shift) & 3];
+        path[d] = q;
+    }
+    return e->slot;
+}
+
+// if an element in path[depth] with new_bounds would be inserted into
+// path[depth] again, so it can be updated in place
+static bool quadtree_stays(Quadtree **path, size_t depth, const AABB *new_bounds) {
+    for (size_t d = 0; d < depth; d++) {
+        Quadtree *q = path[d];
+        if (quadtree_child_of(q, new_bounds) != path[d + 1] - q->child[0]) return false;
+    }
+    Quadtree *q = path[depth];
+    return !q->child[0] || quadtree_child_of(q, new_bounds) == 4;
+}
+
+// removes the element in slot of path[depth], copying it into buf,
+// then reinserts it with new_bounds if given.
+// walks back up the path, pruning nodes that became too small and
+// reinserting the element below the lowest node that can contain it.
+static void quadtree_move_slot(Quadtree **path, size_t depth, size_t slot, const AABB *new_bounds, void *buf) {
+    quadtree_own_path(path, depth);
+    Quadtree *q = path[depth];
+    QuadtreeHandle h = q->handles[slot];
+    quadtree_data_remove_slot(q, slot, buf);
+    if (new_bounds)
+        memcpy(buf, new_bounds, sizeof(AABB));
+    // nothing to place if we're just removing
+    bool placed = !new_bounds;
+    for (size_t d = depth + 1; d-- > 0;) {
+        q = path[d];
+        // leaves can't take the element without knowing it fits
+        // and can't be pruned
+        if (!q->child[0]) continue;
+        // try to insert, but don't add it as a leaf node because it
+        // might not fit into here
+        if (!placed)
+            placed = quadtree_insert_children(q, buf, h);
+        // it's *probably* OK to prune after reinserting.
+        if (quadtree_should_unsubdivide(q)) {
+            // we no longer have children, so parent should
             // check if it should also unsubdivide
-            return false;
+            quadtree_unsubdivide(q);
+        } else if (placed) {
+            // impossible to unsubdivide above when children have children
+            return;
+        }
+    }
+    if (!placed) {
+        // insert into root
+        quadtree_insert_leaf(path[0], buf, h);
+    }
+}
+
+// quadtree resizing
+// the root is the caller's struct, so growing copies it into a new block
+// of children and makes it the new root in place, and shrinking copies
+// the child that's kept over it. either way every node ends up with a
+// different location code, so quadtree_relocate walks the whole tree.
+
+// elements taken out by quadtree_relocate, to be inserted again
+struct quadtree_relocated_t {
+    char *els;
+    QuadtreeHandle *handles;
+    size_t len;
+    size_t cap;
+};
+
+// gives path[depth] and everything below it the location codes they now
+// have, starting with loc, and points the handles at them. elements that
+// inserting would now put somewhere else are taken out, leaving holes.
+// that only happens to elements the old root kept outside its box, and
+// in loose trees to ones near the old root's sides, since those stop
+// being special once the sides are inside the tree.
+static void quadtree_relocate_rec(Quadtree **path, size_t depth, uint64_t loc, struct quadtree_relocated_t *out) {
+    Quadtree *q = path[depth];
+    q->loc = loc;
+    q->edges = quadtree_edges_of(loc);
+    size_t words = quadtree_data_words(q->data_len + q->data_free);
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = q->occupied[w]; bits; bits &= bits - 1) {
+            size_t i = w * 64 + quadtree_ctz(bits);
+            void *el = quadtree_data_at(q, i);
+            if (quadtree_stays(path, depth, el)) {
+                quadtree_handle_set(q->pool, q->handles[i], loc, i);
+                continue;
+            }
+            if (out->len == out->cap) {
+                out->cap = out->cap ? 2 * out->cap : 16;
+                out->els = realloc(out->els, out->cap * q->el_size);
+                out->handles = realloc(out->handles, out->cap * sizeof(QuadtreeHandle));
+            }
+            memcpy(out->els + out->len * q->el_size, el, q->el_size);
+            out->handles[out->len++] = q->handles[i];
+            // the bits being walked are a copy, so this is safe
+            quadtree_data_own(q);
+            quadtree_data_unmark(q, i);
+            q->data_len--;
+            q->data_free++;
+        }
+    }
+    if (!q->child[0])
+        return;
+    quadtree_own_children(q);
+    for (int i = 0; i < 4; i++) {
+        path[depth + 1] = q->child[i];
+        quadtree_relocate_rec(path, depth + 1, loc << 2 | i, out);
+    }
+}
+
+static void quadtree_relocate(Quadtree *q) {
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    struct quadtree_relocated_t out = {NULL, NULL, 0, 0};
+    path[0] = q;
+    quadtree_relocate_rec(path, 0, 1, &out);
+    for (size_t i = 0; i < out.len; i++)
+        quadtree_insert_node(q, out.els + i * q->el_size, out.handles[i]);
+    free(out.els);
+    free(out.handles);
+}
+
+// adds a level above the root, doubling its box towards el, so the old
+// root becomes one of the children. returns false if it can't.
+static bool quadtree_grow(Quadtree *q, const AABB *el) {
+    AABB box;
+    quadtree_node_box(q, &box);
+    int64_t w = (int64_t)box.x2 - box.x1, h = (int64_t)box.y2 - box.y1;
+    // grow past whichever side el is outside of, or else towards its
+    // center, so the next step can go the other way
+    bool west = el->x1 < box.x1
+             || (el->x2 <= box.x2 && (int64_t)el->x1 + el->x2 < (int64_t)box.x1 + box.x2);
+    bool north = el->y1 < box.y1
+              || (el->y2 <= box.y2 && (int64_t)el->y1 + el->y2 < (int64_t)box.y1 + box.y2);
+    int64_t x1 = west ? box.x1 - w : box.x1, x2 = west ? box.x2 : box.x2 + w,
+            y1 = north ? box.y1 - h : box.y1, y2 = north ? box.y2 : box.y2 + h;
+    if (q->max_depth >= QUADTREE_MAX_DEPTH || w <= 0 || h <= 0
+     || x1 < INT_MIN || x2 > INT_MAX || y1 < INT_MIN || y2 > INT_MAX)
+        return false;
+    int old = west | north << 1;
+    Quadtree *children = quadtree_pool_alloc(q->pool);
+    children[old] = *q;
+    aabb_init(&box, (int)x1, (int)y1, (int)x2, (int)y2);
+    quadtree_node_init(q, &box, q->max_depth + 1, q->el_size, q->pool, 1);
+    q->split_time = q->pool->time;
+    for (int i = 0; i < 4; i++) {
+        q->child[i] = &children[i];
+        if (i == old)
+            continue;
+        quadtree_child_box(q, i, &box);
+        quadtree_node_init(q->child[i], &box, q->max_depth - 1, q->el_size, q->pool, q->loc << 2 | i);
+    }
+    q->pool->counters.grows++;
+    return true;
+}
+
+// makes the deepest node that has all the elements below it the root,
+// if that's not the root already. returns false if it is.
+static bool quadtree_shrink(Quadtree *q) {
+    Quadtree *keep = q;
+    while (keep->child[0] && !keep->data_len) {
+        int only = -1;
+        for (int i = 0; i < 4 && only != 4; i++) {
+            if (keep->child[i]->child[0] || keep->child[i]->data_len)
+                only = only < 0 ? i : 4;
         }
-        return ret;
+        // an empty tree keeps its box
+        if (only < 0 || only == 4)
+            break;
+        keep = keep->child[only];
+        q->pool->counters.shrinks++;
+    }
+    if (keep == q)
+        return false;
+    // hold on to what's kept while the rest is released, since a
+    // snapshot may share it
+    struct quadtree_pool_t *pool = q->pool;
+    Quadtree node = *keep;
+    if (node.data)
+        (*quadtree_data_refs(&node))++;
+    if (node.child[0])
+        quadtree_block_of(node.child[0])->refs++;
+    quadtree_data_release(q);
+    quadtree_pool_release(pool, q->child[0]);
+    *q = node;
+    q->pool = pool;
+    q->split_time = pool->time;
+    return true;
+}
+
+// grows the root until box fits, if the tree resizes itself
+static void quadtree_fit(Quadtree *q, const AABB *box) {
+    if (!q->pool->config.auto_resize)
+        return;
+    AABB root;
+    quadtree_node_box(q, &root);
+    bool grew = false;
+    while (!aabb_contains(&root, box) && quadtree_grow(q, box)) {
+        quadtree_node_box(q, &root);
+        grew = true;
+    }
+    if (grew)
+        quadtree_relocate(q);
+}
+
+// shrinks the root after elements were moved or removed, if the tree
+// resizes itself and it's been long enough to pay for the walk
+static void quadtree_trim(Quadtree *q) {
+    const struct quadtree_pool_t *pool = q->pool;
+    if (!pool->config.auto_resize || !q->child[0] || q->data_len
+     || pool->time - q->split_time < pool->handles_used)
+        return;
+    if (quadtree_shrink(q))
+        quadtree_relocate(q);
+}
+
+// quadtree deferred moves
+// with defer_moves set, moves are only written down, one per handle, and
+// quadtree_flush hands them all to quadtree_move_many. a handle that's
+// moved or removed right away loses its pending move, so the latest
+// change always wins.
+
+static void quadtree_pending_drop(struct quadtree_pool_t *pool, QuadtreeHandle h) {
+    if (h >= pool->pending_at_len || !pool->pending_at[h])
+        return;
+    size_t i = pool->pending_at[h] - 1, last = --pool->pending_len;
+    pool->pending_at[h] = 0;
+    if (i == last)
+        return;
+    pool->pending_handles[i] = pool->pending_handles[last];
+    pool->pending_bounds[i] = pool->pending_bounds[last];
+    pool->pending_at[pool->pending_handles[i]] = i + 1;
+}
+
+static void quadtree_pending_set(struct quadtree_pool_t *pool, QuadtreeHandle h, const AABB *new_bounds) {
+    if (h >= pool->pending_at_len) {
+        size_t len = pool->handles_cap;
+        pool->pending_at = realloc(pool->pending_at, len * sizeof *pool->pending_at);
+        memset(pool->pending_at + pool->pending_at_len, 0, (len - pool->pending_at_len) * sizeof *pool->pending_at);
+        pool->pending_at_len = len;
+    }
+    if (pool->pending_at[h]) {
+        pool->pending_bounds[pool->pending_at[h] - 1] = *new_bounds;
+        return;
+    }
+    if (pool->pending_len == pool->pending_cap) {
+        pool->pending_cap = pool->pending_cap ? 2 * pool->pending_cap : 16;
+        pool->pending_handles = realloc(pool->pending_handles, pool->pending_cap * sizeof *pool->pending_handles);
+        pool->pending_bounds = realloc(pool->pending_bounds, pool->pending_cap * sizeof *pool->pending_bounds);
+    }
+    pool->pending_handles[pool->pending_len] = h;
+    pool->pending_bounds[pool->pending_len] = *new_bounds;
+    pool->pending_at[h] = ++pool->pending_len;
+}
+
+static void quadtree_move_handle_slot(Quadtree *q, Quadtree **path, size_t depth, size_t slot, const AABB *new_bounds, void *buf);
+
+// writes down a move of the element in slot of path[depth]. the caller
+// counts the move now, as it would right away, so quadtree_flush doesn't
+// count it again. with defer_union, the element's AABB in the tree is
+// grown to cover new_bounds too, as part of the same move.
+static void quadtree_defer(Quadtree *q, Quadtree **path, size_t depth, size_t slot, const AABB *new_bounds, void *buf) {
+    struct quadtree_pool_t *pool = q->pool;
+    QuadtreeHandle h = path[depth]->handles[slot];
+    if (buf) {
+        memcpy(buf, quadtree_data_at(path[depth], slot), q->el_size);
+        memcpy(buf, new_bounds, sizeof(AABB));
     }
+    quadtree_pending_set(pool, h, new_bounds);
+    if (!pool->config.defer_union)
+        return;
+    const AABB *old = quadtree_data_at(path[depth], slot);
+    AABB grown;
+    aabb_init(&grown, old->x1 < new_bounds->x1 ? old->x1 : new_bounds->x1,
+              old->y1 < new_bounds->y1 ? old->y1 : new_bounds->y1,
+              old->x2 > new_bounds->x2 ? old->x2 : new_bounds->x2,
+              old->y2 > new_bounds->y2 ? old->y2 : new_bounds->y2);
+    if (!aabb_contains(old, &grown))
+        quadtree_move_handle_slot(q, path, depth, slot, &grown, NULL);
 }
 
 // NOTE: *guaranteed* that this is equivalent to removing then inserting again
 // NOTE: moved element will be modified; new_bounds will be copied to the start
 void quadtree_move(Quadtree *q, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf) {
-    if (!quadtree_move_impl(q, el, equal, new_bounds, buf)) {
-        // insert into root
-        quadtree_insert_leaf(q, buf);
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    q->pool->time++;
+    if (q->pool->config.defer_moves) {
+        size_t depth, slot = quadtree_find(q, el, equal, path, &depth);
+        if (slot == path[depth]->data_len + path[depth]->data_free) return;
+        quadtree_defer(q, path, depth, slot, new_bounds, buf);
+        return;
     }
+    quadtree_fit(q, new_bounds);
+    size_t depth, slot = quadtree_find(q, el, equal, path, &depth);
+    if (slot == path[depth]->data_len + path[depth]->data_free) return;
+    quadtree_pending_drop(q->pool, path[depth]->handles[slot]);
+    quadtree_move_slot(path, depth, slot, new_bounds, buf ? buf : q->pool->scratch);
+    quadtree_trim(q);
 }
 
 void quadtree_remove(Quadtree *q, void *el, qt_equal_fn equal, void *buf) {
-    quadtree_move_impl(q, el, equal, NULL, buf);
+    q->pool->time++;
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    size_t depth, slot = quadtree_find(q, el, equal, path, &depth);
+    if (slot == path[depth]->data_len + path[depth]->data_free) return;
+    QuadtreeHandle h = path[depth]->handles[slot];
+    quadtree_pending_drop(q->pool, h);
+    quadtree_move_slot(path, depth, slot, NULL, buf);
+    quadtree_handle_delete(q->pool, h);
+    quadtree_trim(q);
 }
 
-void quadtree_traverse(Quadtree *q, AABB *box, qt_callback_fn callback, void *cb_data) {
-    if (!q) return;
+void *quadtree_get(Quadtree *q, QuadtreeHandle h) {
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    size_t depth, slot = quadtree_handle_find(q, h, path, &depth);
+    // the caller may write to it
+    quadtree_own_path(path, depth);
+    quadtree_data_own(path[depth]);
+    return quadtree_data_at(path[depth], slot);
+}
+
+// moves the element in slot of path[depth] right away. the caller
+// counts the move.
+static void quadtree_move_handle_slot(Quadtree *q, Quadtree **path, size_t depth, size_t slot, const AABB *new_bounds, void *buf) {
+    if (q->pool->config.auto_resize) {
+        AABB root;
+        quadtree_node_box(q, &root);
+        if (!aabb_contains(&root, new_bounds)) {
+            // growing moves every node, so find it again afterwards
+            QuadtreeHandle h = path[depth]->handles[slot];
+            quadtree_fit(q, new_bounds);
+            slot = quadtree_handle_find(q, h, path, &depth);
+        }
+    }
+    if (quadtree_stays(path, depth, new_bounds)) {
+        quadtree_own_path(path, depth);
+        quadtree_data_own(path[depth]);
+        void *el = quadtree_data_at(path[depth], slot);
+        memcpy(el, new_bounds, sizeof(AABB));
+        quadtree_data_set_bounds(path[depth], slot, new_bounds);
+        if (buf)
+            memcpy(buf, el, q->el_size);
+        return;
+    }
+    quadtree_move_slot(path, depth, slot, new_bounds, buf ? buf : q->pool->scratch);
+    quadtree_trim(q);
+}
+
+// NOTE: also equivalent to removing then inserting again, but elements
+// that stay in the same node are updated in place
+void quadtree_move_handle(Quadtree *q, QuadtreeHandle h, const AABB *new_bounds, void *buf) {
+    const QuadtreeConfig *config = &q->pool->config;
+    q->pool->time++;
+    // the element itself is only needed to copy it or grow it
+    if (config->defer_moves && !config->defer_union && !buf) {
+        quadtree_pending_set(q->pool, h, new_bounds);
+        return;
+    }
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    size_t depth, slot = quadtree_handle_find(q, h, path, &depth);
+    if (config->defer_moves) {
+        quadtree_defer(q, path, depth, slot, new_bounds, buf);
+        return;
+    }
+    quadtree_pending_drop(q->pool, h);
+    quadtree_move_handle_slot(q, path, depth, slot, new_bounds, buf);
+}
+
+void quadtree_remove_handle(Quadtree *q, QuadtreeHandle h, void *buf) {
+    quadtree_pending_drop(q->pool, h);
+    q->pool->time++;
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    size_t depth, slot = quadtree_handle_find(q, h, path, &depth);
+    quadtree_move_slot(path, depth, slot, NULL, buf);
+    quadtree_handle_delete(q->pool, h);
+    quadtree_trim(q);
+}
+
+// returns the number of nodes visited
+static size_t quadtree_traverse_rec(Quadtree *q, AABB *box, qt_callback_fn callback, void *cb_data) {
+    if (!q) return 0;
+    size_t visited = 1;
     quadtree_data_traverse(q, box, callback, cb_data);
     // check children
     for (int i = 0; i < 4; i++) {
         if (aabb_intersect(box, &q->box[i]))
-            quadtree_traverse(q->child[i], box, callback, cb_data);
+            visited += quadtree_traverse_rec(q->child[i], box, callback, cb_data);
     }
+    return visited;
 }
 
-void quadtree_clone(Quadtree *dest, const Quadtree *src) {
-    assert(dest != NULL && src != NULL);
-    for (int i = 0; i < 4; i++)
-        dest->box[i] = src->box[i];
-    dest->max_depth = src->max_depth;
-    dest->el_size = src->el_size;
-    quadtree_data_clone(dest, src);
-    if (src->child[0] != NULL) {
+void quadtree_traverse(Quadtree *q, AABB *box, qt_callback_fn callback, void *cb_data) {
+    if (!q) return;
+    size_t visited = quadtree_traverse_rec(q, box, callback, cb_data);
+    q->pool->counters.queries++;
+    q->pool->counters.nodes_visited += visited;
+}
+
+// quadtree query iterator
+
+// counters is where the query and the nodes it visits are counted
+static void quadtree_query_start(QuadtreeQuery *it, Quadtree *q, const AABB *box, QuadtreeCounters *counters) {
+    it->box = *box;
+    it->counters = counters;
+    counters->queries++;
+    counters->nodes_visited++;
+    it->node = q;
+    it->slot = 0;
+    it->hits = 0;
+    it->stack_len = 0;
+}
+
+void quadtree_query_begin(QuadtreeQuery *it, Quadtree *q, const AABB *box) {
+    quadtree_query_start(it, q, box, &q->pool->counters);
+}
+
+// scans ahead to the next group of slots with hits.
+// returns false when there are none left.
+static bool quadtree_query_refill(QuadtreeQuery *it) {
+    for (;;) {
+        Quadtree *q = it->node;
+        if (!q)
+            return false;
+        if (it->slot < q->data_len + q->data_free) {
+            it->hits = quadtree_data_hits(q, &it->box, it->slot);
+            it->slot += QUADTREE_LANES;
+            if (it->hits)
+                return true;
+            continue;
+        }
+        // done with q, visit the children in order
+        if (q->child[0]) {
+            for (int i = 4; i-- > 0;) {
+                if (aabb_intersect(&it->box, &q->box[i])) {
+                    assert(it->stack_len < sizeof it->stack / sizeof *it->stack);
+                    it->stack[it->stack_len++] = q->child[i];
+                }
+            }
+        }
+        if (!it->stack_len) {
+            it->node = NULL;
+            return false;
+        }
+        it->node = it->stack[--it->stack_len];
+        it->slot = 0;
+        it->counters->nodes_visited++;
+    }
+}
+
+void *quadtree_query_next(QuadtreeQuery *it) {
+    if (!it->hits && !quadtree_query_refill(it))
+        return NULL;
+    size_t j = it->slot - QUADTREE_LANES + quadtree_ctz(it->hits);
+    it->hits &= it->hits - 1;
+    return quadtree_data_at(it->node, j);
+}
+
+size_t quadtree_query_collect(QuadtreeQuery *it, void **out, size_t max) {
+    size_t n = 0;
+    while (n < max && (it->hits || quadtree_query_refill(it))) {
+        const Quadtree *q = it->node;
+        const char *base = quadtree_data_at(q, it->slot - QUADTREE_LANES);
+        unsigned int hits = it->hits;
+        do {
+            out[n++] = (void *)(base + quadtree_ctz(hits) * q->el_size);
+            hits &= hits - 1;
+        } while (hits && n < max);
+        it->hits = hits;
+    }
+    return n;
+}
+
+// quadtree ray casting
+
+// a node waiting to be visited, and when the ray enters its box
+struct quadtree_ray_node_t {
+    Quadtree *node;
+    double t;
+};
+
+// sweeps against the elements of q, returning the one hit first if
+// that's before *best and updating *best and edge
+static void *quadtree_data_raycast(Quadtree *q, double x, double y, double idx, double idy,
+                                   int width, int height, double *best, AABBEdge *edge) {
+    if (!q->data_len)
+        return NULL;
+    size_t stride = quadtree_data_stride(q->data_cap);
+    const int *x1 = q->bounds, *y1 = x1 + stride, *x2 = y1 + stride, *y2 = x2 + stride;
+    void *hit = NULL;
+    AABBEdge e;
+    if (!q->data_free) {
+        // no holes, so the bounds arrays can be swept as they are
+        size_t i;
+        double t = aabb_sweep_many(x1, y1, x2, y2, q->data_len, x, y, idx, idy, width, height, &i, &e);
+        if (t >= 0.0 && t < *best) {
+            *best = t;
+            *edge = e;
+            hit = quadtree_data_at(q, i);
+        }
+        return hit;
+    }
+    size_t words = quadtree_data_words(q->data_len + q->data_free);
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = q->occupied[w]; bits; bits &= bits - 1) {
+            size_t i = w * 64 + quadtree_ctz(bits);
+            AABB box;
+            aabb_init(&box, x1[i], y1[i], x2[i], y2[i]);
+            double t = aabb_sweep(&box, x, y, idx, idy, width, height, &e);
+            if (t >= 0.0 && t < *best) {
+                *best = t;
+                *edge = e;
+                hit = quadtree_data_at(q, i);
+            }
+        }
+    }
+    return hit;
+}
+
+void *quadtree_raycast(Quadtree *q, double x, double y, double dx, double dy,
+                       int width, int height, double *t_hit, AABBEdge *edge) {
+    double idx = 1.0 / dx, idy = 1.0 / dy, best = 1.0;
+    void *hit = NULL;
+    AABBEdge hit_edge = EDGE_WEST;
+    // every node pushes at most 4 children after taking itself off
+    struct quadtree_ray_node_t stack[3 * QUADTREE_MAX_DEPTH + 4];
+    size_t len = 0;
+    // elements outside the root's box stay in the root, so it's always
+    // visited
+    stack[len].node = q;
+    stack[len++].t = 0.0;
+    size_t visited = 0;
+    while (len) {
+        struct quadtree_ray_node_t top = stack[--len];
+        // a closer hit may have been found since it was pushed
+        if (top.t >= best)
+            continue;
+        Quadtree *n = top.node;
+        visited++;
+        void *el = quadtree_data_raycast(n, x, y, idx, idy, width, height, &best, &hit_edge);
+        if (el)
+            hit = el;
+        if (!n->child[0])
+            continue;
+        // push the farthest child first, so the nearest one is tried first
+        // and the closer hit it finds can prune the others
+        struct quadtree_ray_node_t children[4];
+        int count = 0;
         for (int i = 0; i < 4; i++) {
-            dest->child[i] = malloc(sizeof(Quadtree));
-            quadtree_clone(dest->child[i], src->child[i]);
+            double enter = aabb_ray_enter(&n->box[i], x, y, idx, idy, width, height, best);
+            if (enter < 0.0)
+                continue;
+            int j = count++;
+            for (; j > 0 && children[j - 1].t < enter; j--)
+                children[j] = children[j - 1];
+            children[j].node = n->child[i];
+            children[j].t = enter;
         }
-    } else {
-        for (int i = 0; i < 4; i++)
-            dest->child[i] = NULL;
+        assert(len + count <= sizeof stack / sizeof *stack);
+        for (int i = 0; i < count; i++)
+            stack[len++] = children[i];
+    }
+    q->pool->counters.queries++;
+    q->pool->counters.nodes_visited += visited;
+    if (t_hit)
+        *t_hit = hit ? best : -1.0;
+    if (hit && edge)
+        *edge = hit_edge;
+    return hit;
+}
+
+// quadtree nearest neighbours
+
+// squared distance from (x, y) to the closest point of a box, 0 inside.
+// x2 and y2 are exclusive, as in aabb_intersect, so the box covers x1
+// to x2 - 1 and y1 to y2 - 1. an empty box covers its x1 or y1 line.
+static inline double quadtree_dist_sq(int x1, int y1, int x2, int y2, double x, double y) {
+    int xh = x2 > x1 ? x2 - 1 : x1, yh = y2 > y1 ? y2 - 1 : y1;
+    double dx = x < x1 ? x1 - x : x > xh ? x - xh : 0.0;
+    double dy = y < y1 ? y1 - y : y > yh ? y - yh : 0.0;
+    return dx * dx + dy * dy;
+}
+
+// a node or an element, with its distance
+struct quadtree_near_t {
+    double d;
+    void *p;
+};
+
+// binary heap with the largest d on top, which starts out on the C stack
+// like aabb_tree_stack_t. the node queue stores negated distances so the
+// nearest node comes out first.
+struct quadtree_heap_t {
+    struct quadtree_near_t *items;
+    size_t len;
+    size_t cap;
+    struct quadtree_near_t local[32];
+};
+
+static inline void quadtree_heap_init(struct quadtree_heap_t *h) {
+    h->items = h->local;
+    h->len = 0;
+    h->cap = sizeof h->local / sizeof h->local[0];
+}
+
+static inline void quadtree_heap_free(struct quadtree_heap_t *h) {
+    if (h->items != h->local)
+        free(h->items);
+}
+
+static void quadtree_heap_push(struct quadtree_heap_t *h, double d, void *p) {
+    if (h->len == h->cap) {
+        struct quadtree_near_t *items = malloc(2 * h->cap * sizeof *items);
+        memcpy(items, h->items, h->len * sizeof *items);
+        if (h->items != h->local)
+            free(h->items);
+        h->items = items;
+        h->cap *= 2;
+    }
+    size_t i = h->len++;
+    for (; i > 0 && h->items[(i - 1) / 2].d < d; i = (i - 1) / 2)
+        h->items[i] = h->items[(i - 1) / 2];
+    h->items[i].d = d;
+    h->items[i].p = p;
+}
+
+// replaces the top with (d, p) and moves it down to its place
+static void quadtree_heap_replace_top(struct quadtree_heap_t *h, double d, void *p) {
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= h->len)
+            break;
+        if (c + 1 < h->len && h->items[c + 1].d > h->items[c].d)
+            c++;
+        if (h->items[c].d <= d)
+            break;
+        h->items[i] = h->items[c];
+        i = c;
+    }
+    h->items[i].d = d;
+    h->items[i].p = p;
+}
+
+static struct quadtree_near_t quadtree_heap_pop(struct quadtree_heap_t *h) {
+    struct quadtree_near_t top = h->items[0], last = h->items[--h->len];
+    if (h->len)
+        quadtree_heap_replace_top(h, last.d, last.p);
+    return top;
+}
+
+// offers every element of a node to found. once it holds k, only the
+// elements overlapping the square around the k-th distance can get in,
+// which the lane test finds quickly.
+static void quadtree_nearest_scan(Quadtree *n, double x, double y, size_t k, struct quadtree_heap_t *found) {
+    size_t stride = quadtree_data_stride(n->data_cap), end = n->data_len + n->data_free;
+    size_t i = 0;
+    for (; i < end && found->len < k; i++) {
+        if (!(n->occupied[i / 64] & (uint64_t)1 << i % 64))
+            continue;
+        const int *b = n->bounds + i;
+        quadtree_heap_push(found, quadtree_dist_sq(b[0], b[stride], b[2 * stride], b[3 * stride], x, y),
+                           quadtree_data_at(n, i));
+    }
+    if (i >= end)
+        return;
+    double r = sqrt(found->items[0].d);
+    AABB box;
+    aabb_init(&box, (int)floor(x - r) - 1, (int)floor(y - r) - 1, (int)ceil(x + r) + 1, (int)ceil(y + r) + 1);
+    // the lanes before the first one left were already pushed
+    unsigned int skip = ~0u << i % QUADTREE_LANES;
+    for (i -= i % QUADTREE_LANES; i < end; i += QUADTREE_LANES, skip = ~0u) {
+        for (unsigned int mask = quadtree_data_hits(n, &box, i) & skip; mask; mask &= mask - 1) {
+            size_t j = i + quadtree_ctz(mask);
+            const int *b = n->bounds + j;
+            double d = quadtree_dist_sq(b[0], b[stride], b[2 * stride], b[3 * stride], x, y);
+            if (d < found->items[0].d)
+                quadtree_heap_replace_top(found, d, quadtree_data_at(n, j));
+        }
+    }
+}
+
+size_t quadtree_nearest(Quadtree *q, double x, double y, size_t k, void **out, double *dist_sq) {
+    if (!k)
+        return 0;
+    struct quadtree_heap_t nodes, found;
+    quadtree_heap_init(&nodes);
+    quadtree_heap_init(&found);
+    // the nodes down to the point hold the closest elements, so scan them
+    // deepest first to fill found before the big nodes near the root.
+    // elements outside the root's box stay in the root, so it's always
+    // scanned.
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    int depth = 0;
+    path[0] = q;
+    while (path[depth]->child[0]) {
+        Quadtree *n = path[depth], *next = NULL;
+        for (int i = 0; i < 4; i++) {
+            const AABB *b = &n->box[i];
+            double d = quadtree_dist_sq(b->x1, b->y1, b->x2, b->y2, x, y);
+            if (!next && d == 0.0)
+                next = n->child[i];
+            else
+                quadtree_heap_push(&nodes, -d, n->child[i]);
+        }
+        if (!next)
+            break;
+        path[++depth] = next;
+    }
+    for (int i = depth; i >= 0; i--)
+        quadtree_nearest_scan(path[i], x, y, k, &found);
+    size_t visited = depth + 1;
+    while (nodes.len) {
+        struct quadtree_near_t top = quadtree_heap_pop(&nodes);
+        // every node left is at least this far away
+        if (found.len == k && -top.d >= found.items[0].d)
+            break;
+        Quadtree *n = top.p;
+        quadtree_nearest_scan(n, x, y, k, &found);
+        visited++;
+        if (!n->child[0])
+            continue;
+        for (int i = 0; i < 4; i++) {
+            const AABB *b = &n->box[i];
+            double d = quadtree_dist_sq(b->x1, b->y1, b->x2, b->y2, x, y);
+            if (found.len < k || d < found.items[0].d)
+                quadtree_heap_push(&nodes, -d, n->child[i]);
+        }
+    }
+    // the farthest comes off the top first
+    size_t len = found.len;
+    for (size_t i = len; i-- > 0;) {
+        struct quadtree_near_t near = quadtree_heap_pop(&found);
+        out[i] = near.p;
+        if (dist_sq)
+            dist_sq[i] = near.d;
+    }
+    quadtree_heap_free(&nodes);
+    quadtree_heap_free(&found);
+    q->pool->counters.queries++;
+    q->pool->counters.nodes_visited += visited;
+    return len;
+}
+
+// box is the square around the circle, grown so that it overlaps every
+// box that touches the circle, to pick candidates quickly.
+// returns the number of nodes visited.
+static size_t quadtree_radius_rec(Quadtree *q, const AABB *box, double x, double y, double r2,
+                                qt_callback_fn callback, void *cb_data) {
+    size_t stride = quadtree_data_stride(q->data_cap), end = q->data_len + q->data_free;
+    for (size_t i = 0; i < end; i += QUADTREE_LANES) {
+        for (unsigned int mask = quadtree_data_hits(q, box, i); mask; mask &= mask - 1) {
+            size_t j = i + quadtree_ctz(mask);
+            const int *b = q->bounds + j;
+            if (quadtree_dist_sq(b[0], b[stride], b[2 * stride], b[3 * stride], x, y) <= r2)
+                callback(cb_data, quadtree_data_at(q, j));
+        }
+    }
+    size_t visited = 1;
+    if (!q->child[0])
+        return visited;
+    for (int i = 0; i < 4; i++) {
+        const AABB *b = &q->box[i];
+        if (quadtree_dist_sq(b->x1, b->y1, b->x2, b->y2, x, y) <= r2)
+            visited += quadtree_radius_rec(q->child[i], box, x, y, r2, callback, cb_data);
+    }
+    return visited;
+}
+
+void quadtree_traverse_radius(Quadtree *q, double x, double y, double radius,
+                              qt_callback_fn callback, void *cb_data) {
+    AABB box;
+    aabb_init(&box, (int)floor(x - radius) - 1, (int)floor(y - radius) - 1,
+              (int)ceil(x + radius) + 1, (int)ceil(y + radius) + 1);
+    size_t visited = quadtree_radius_rec(q, &box, x, y, radius * radius, callback, cb_data);
+    q->pool->counters.queries++;
+    q->pool->counters.nodes_visited += visited;
+}
+
+// quadtree pair finding
+
+// elements outside the current node's subtree that can still hit
+// something in it: those of its ancestors and, in a loose quadtree,
+// those below its earlier siblings. each node gets a range at the end
+// of the arrays.
+struct quadtree_pairs_t {
+    QuadtreePair *out;
+    size_t max;
+    size_t len;
+    AABB *boxes;
+    void **els;
+    size_t cands_len;
+    size_t cands_cap;
+};
+
+static inline void quadtree_pairs_emit(struct quadtree_pairs_t *st, void *a, void *b) {
+    if (st->len < st->max) {
+        st->out[st->len].a = a;
+        st->out[st->len].b = b;
+    }
+    st->len++;
+}
+
+// box is passed by value since it may point into the arrays
+static void quadtree_pairs_push(struct quadtree_pairs_t *st, AABB box, void *el) {
+    if (st->cands_len == st->cands_cap) {
+        st->cands_cap = st->cands_cap ? st->cands_cap * 2 : 64;
+        st->boxes = realloc(st->boxes, st->cands_cap * sizeof *st->boxes);
+        st->els = realloc(st->els, st->cands_cap * sizeof *st->els);
+    }
+    st->boxes[st->cands_len] = box;
+    st->els[st->cands_len++] = el;
+}
+
+// pushes the elements of q and its descendants that intersect box
+static void quadtree_pairs_collect(Quadtree *q, const AABB *box, struct quadtree_pairs_t *st) {
+    size_t end = q->data_len + q->data_free;
+    for (size_t i = 0; i < end; i += QUADTREE_LANES) {
+        for (unsigned int hits = quadtree_data_hits(q, box, i); hits; hits &= hits - 1) {
+            void *el = quadtree_data_at(q, i + quadtree_ctz(hits));
+            quadtree_pairs_push(st, *(AABB *)el, el);
+        }
+    }
+    if (!q->child[0])
+        return;
+    for (int k = 0; k < 4; k++) {
+        if (aabb_intersect(box, &q->box[k]))
+            quadtree_pairs_collect(q->child[k], box, st);
+    }
+}
+
+// reports pairs within q and between q and candidates [start, cands_len),
+// then recurses with the candidates that overlap each child
+static void quadtree_pairs_node(Quadtree *q, struct quadtree_pairs_t *st, size_t start) {
+    size_t end = q->data_len + q->data_free, words = quadtree_data_words(end),
+           cands_end = st->cands_len;
+    for (size_t c = start; c < cands_end; c++) {
+        for (size_t i = 0; i < end; i += QUADTREE_LANES) {
+            for (unsigned int hits = quadtree_data_hits(q, &st->boxes[c], i); hits; hits &= hits - 1)
+                quadtree_pairs_emit(st, st->els[c], quadtree_data_at(q, i + quadtree_ctz(hits)));
+        }
+    }
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = q->occupied[w]; bits; bits &= bits - 1) {
+            size_t i = w * 64 + quadtree_ctz(bits);
+            AABB *box = quadtree_data_at(q, i);
+            // only slots after i, starting with the rest of its group
+            size_t group = i / QUADTREE_LANES * QUADTREE_LANES;
+            unsigned int hits = quadtree_data_hits(q, box, group) & ~((2u << (i - group)) - 1);
+            for (size_t j = group; j < end;) {
+                for (; hits; hits &= hits - 1)
+                    quadtree_pairs_emit(st, box, quadtree_data_at(q, j + quadtree_ctz(hits)));
+                j += QUADTREE_LANES;
+                if (j < end)
+                    hits = quadtree_data_hits(q, box, j);
+            }
+        }
+    }
+    if (!q->child[0])
+        return;
+    for (int k = 0; k < 4; k++) {
+        const AABB *cbox = &q->box[k];
+        size_t child_start = st->cands_len;
+        for (size_t c = start; c < cands_end; c++) {
+            if (aabb_intersect(&st->boxes[c], cbox))
+                quadtree_pairs_push(st, st->boxes[c], st->els[c]);
+        }
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = q->occupied[w]; bits; bits &= bits - 1) {
+                void *el = quadtree_data_at(q, w * 64 + quadtree_ctz(bits));
+                if (aabb_intersect((AABB *)el, cbox))
+                    quadtree_pairs_push(st, *(AABB *)el, el);
+            }
+        }
+        // the children of a loose quadtree overlap, so elements below an
+        // earlier child can hit elements below this one. the pair is
+        // found from the later child only. the boxes of normal children
+        // only touch, so this never happens for them.
+        for (int i = 0; i < k; i++) {
+            if (aabb_intersect(&q->box[i], cbox))
+                quadtree_pairs_collect(q->child[i], cbox, st);
+        }
+        quadtree_pairs_node(q->child[k], st, child_start);
+        st->cands_len = child_start;
+    }
+}
+
+size_t quadtree_find_pairs(Quadtree *q, QuadtreePair *out, size_t max) {
+    struct quadtree_pairs_t st = {out, max, 0, NULL, NULL, 0, 0};
+    quadtree_pairs_node(q, &st, 0);
+    free(st.boxes);
+    free(st.els);
+    return st.len;
+}
+
+// quadtree parallel queries
+// the threads are started by the first batch that needs them and kept
+// waiting in the pool until quadtree_free, so a batch every frame only
+// wakes them. a batch that wants more threads than there are stops them
+// and starts a bigger set.
+
+#ifdef _WIN32
+typedef HANDLE quadtree_thread_t;
+typedef CRITICAL_SECTION quadtree_mutex_t;
+typedef CONDITION_VARIABLE quadtree_cond_t;
+#define QUADTREE_THREAD_FN(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define QUADTREE_THREAD_RETURN return 0
+
+static bool quadtree_thread_start(quadtree_thread_t *t, LPTHREAD_START_ROUTINE fn, void *arg) {
+    *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return *t != NULL;
+}
+
+static void quadtree_thread_join(quadtree_thread_t t) {
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static void quadtree_mutex_init(quadtree_mutex_t *m) { InitializeCriticalSection(m); }
+static void quadtree_mutex_destroy(quadtree_mutex_t *m) { DeleteCriticalSection(m); }
+static void quadtree_mutex_lock(quadtree_mutex_t *m) { EnterCriticalSection(m); }
+static void quadtree_mutex_unlock(quadtree_mutex_t *m) { LeaveCriticalSection(m); }
+static void quadtree_cond_init(quadtree_cond_t *c) { InitializeConditionVariable(c); }
+static void quadtree_cond_destroy(quadtree_cond_t *c) { (void)c; }
+static void quadtree_cond_wait(quadtree_cond_t *c, quadtree_mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void quadtree_cond_broadcast(quadtree_cond_t *c) { WakeAllConditionVariable(c); }
+#else
+typedef pthread_t quadtree_thread_t;
+typedef pthread_mutex_t quadtree_mutex_t;
+typedef pthread_cond_t quadtree_cond_t;
+#define QUADTREE_THREAD_FN(name, arg) static void *name(void *arg)
+#define QUADTREE_THREAD_RETURN return NULL
+
+static bool quadtree_thread_start(quadtree_thread_t *t, void *(*fn)(void *), void *arg) {
+    return pthread_create(t, NULL, fn, arg) == 0;
+}
+
+static void quadtree_thread_join(quadtree_thread_t t) {
+    pthread_join(t, NULL);
+}
+
+static void quadtree_mutex_init(quadtree_mutex_t *m) { pthread_mutex_init(m, NULL); }
+static void quadtree_mutex_destroy(quadtree_mutex_t *m) { pthread_mutex_destroy(m); }
+static void quadtree_mutex_lock(quadtree_mutex_t *m) { pthread_mutex_lock(m); }
+static void quadtree_mutex_unlock(quadtree_mutex_t *m) { pthread_mutex_unlock(m); }
+static void quadtree_cond_init(quadtree_cond_t *c) { pthread_cond_init(c, NULL); }
+static void quadtree_cond_destroy(quadtree_cond_t *c) { pthread_cond_destroy(c); }
+static void quadtree_cond_wait(quadtree_cond_t *c, quadtree_mutex_t *m) { pthread_cond_wait(c, m); }
+static void quadtree_cond_broadcast(quadtree_cond_t *c) { pthread_cond_broadcast(c); }
+#endif
+
+// each worker takes a contiguous range of queries and runs them twice:
+// first to count the hits of each, then, once offsets are known, to
+// write them straight into results. the only shared writes are to
+// distinct entries of offsets and distinct ranges of results, and each
+// worker counts in its own counters.
+struct quadtree_batch_worker_t {
+    Quadtree *q;
+    const AABB *boxes;
+    size_t *offsets;
+    void **results; // NULL while counting
+    size_t max;
+    size_t from;
+    size_t to;
+    QuadtreeCounters counters; // only nodes_visited is used
+};
+
+struct quadtree_workers_t;
+
+// one per thread, which runs jobs[index] of each pass
+struct quadtree_workers_thread_t {
+    struct quadtree_workers_t *workers;
+    unsigned int index;
+    size_t seen; // last pass it ran
+    quadtree_thread_t thread;
+};
+
+struct quadtree_workers_t {
+    quadtree_mutex_t lock;
+    quadtree_cond_t wake; // a pass was handed out, or quit was set
+    quadtree_cond_t done; // busy went down to 0
+    struct quadtree_workers_thread_t *threads;
+    unsigned int len; // threads running, numbered from 1
+    unsigned int busy; // threads still working on the current pass
+    size_t pass; // number of passes handed out
+    bool quit;
+    struct quadtree_batch_worker_t *jobs; // jobs of the current pass
+    unsigned int jobs_len;
+};
+
+static void quadtree_batch_run(struct quadtree_batch_worker_t *w) {
+    QuadtreeQuery it;
+    for (size_t i = w->from; i < w->to; i++) {
+        if (!w->results) {
+            // counts for now, turned into offsets afterwards
+            size_t n = 0;
+            quadtree_query_start(&it, w->q, &w->boxes[i], &w->counters);
+            while (quadtree_query_refill(&it)) {
+                for (; it.hits; it.hits &= it.hits - 1)
+                    n++;
+            }
+            w->offsets[i + 1] = n;
+            continue;
+        }
+        size_t at = w->offsets[i], len = w->offsets[i + 1] - at;
+        // offsets only go up, so the rest don't fit either
+        if (at >= w->max)
+            break;
+        if (len == 0)
+            continue;
+        if (len > w->max - at)
+            len = w->max - at;
+        quadtree_query_start(&it, w->q, &w->boxes[i], &w->counters);
+        quadtree_query_collect(&it, w->results + at, len);
+    }
+}
+
+QUADTREE_THREAD_FN(quadtree_workers_main, arg) {
+    struct quadtree_workers_thread_t *self = arg;
+    struct quadtree_workers_t *w = self->workers;
+    quadtree_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->quit && w->pass == self->seen)
+            quadtree_cond_wait(&w->wake, &w->lock);
+        if (w->quit)
+            break;
+        self->seen = w->pass;
+        struct quadtree_batch_worker_t *job = self->index < w->jobs_len ? &w->jobs[self->index] : NULL;
+        quadtree_mutex_unlock(&w->lock);
+        if (job)
+            quadtree_batch_run(job);
+        quadtree_mutex_lock(&w->lock);
+        if (--w->busy == 0)
+            quadtree_cond_broadcast(&w->done);
+    }
+    quadtree_mutex_unlock(&w->lock);
+    QUADTREE_THREAD_RETURN;
+}
+
+static void quadtree_workers_stop(struct quadtree_workers_t *w) {
+    quadtree_mutex_lock(&w->lock);
+    w->quit = true;
+    quadtree_cond_broadcast(&w->wake);
+    quadtree_mutex_unlock(&w->lock);
+    for (unsigned int t = 0; t < w->len; t++)
+        quadtree_thread_join(w->threads[t].thread);
+    free(w->threads);
+    w->threads = NULL;
+    w->len = 0;
+    w->quit = false;
+}
+
+// makes sure there are threads - 1 threads besides the calling one, if
+// they can be started
+static struct quadtree_workers_t *quadtree_workers_get(struct quadtree_pool_t *pool, unsigned int threads) {
+    struct quadtree_workers_t *w = pool->workers;
+    if (!w) {
+        w = pool->workers = malloc(sizeof *w);
+        quadtree_mutex_init(&w->lock);
+        quadtree_cond_init(&w->wake);
+        quadtree_cond_init(&w->done);
+        w->threads = NULL;
+        w->len = 0;
+        w->busy = 0;
+        w->pass = 0;
+        w->quit = false;
+        w->jobs = NULL;
+        w->jobs_len = 0;
+    }
+    if (w->len + 1 >= threads)
+        return w;
+    // the threads hold pointers into the array, so start over
+    quadtree_workers_stop(w);
+    w->threads = malloc((threads - 1) * sizeof *w->threads);
+    for (unsigned int t = 0; t < threads - 1; t++) {
+        struct quadtree_workers_thread_t *th = &w->threads[w->len];
+        th->workers = w;
+        th->index = w->len + 1;
+        // set here, as the first pass may come before the thread looks
+        th->seen = w->pass;
+        if (!quadtree_thread_start(&th->thread, quadtree_workers_main, th))
+            break;
+        w->len++;
+    }
+    return w;
+}
+
+static void quadtree_workers_delete(struct quadtree_workers_t *w) {
+    if (!w)
+        return;
+    quadtree_workers_stop(w);
+    quadtree_mutex_destroy(&w->lock);
+    quadtree_cond_destroy(&w->wake);
+    quadtree_cond_destroy(&w->done);
+    free(w);
+}
+
+// runs every job, the first on the calling thread along with any there
+// are no threads for, and waits for the rest
+static void quadtree_batch_pass(struct quadtree_workers_t *w, struct quadtree_batch_worker_t *jobs, unsigned int len) {
+    quadtree_mutex_lock(&w->lock);
+    w->jobs = jobs;
+    w->jobs_len = len;
+    w->busy = w->len;
+    w->pass++;
+    quadtree_cond_broadcast(&w->wake);
+    quadtree_mutex_unlock(&w->lock);
+    quadtree_batch_run(&jobs[0]);
+    for (unsigned int t = w->len + 1; t < len; t++)
+        quadtree_batch_run(&jobs[t]);
+    quadtree_mutex_lock(&w->lock);
+    while (w->busy)
+        quadtree_cond_wait(&w->done, &w->lock);
+    quadtree_mutex_unlock(&w->lock);
+}
+
+size_t quadtree_query_batch(Quadtree *q, const AABB *boxes, size_t count, void **results, size_t max, size_t *offsets, unsigned int threads) {
+    if (threads == 0)
+        threads = 1;
+    if (threads > count)
+        threads = count ? (unsigned int)count : 1;
+    struct quadtree_batch_worker_t *jobs = calloc(threads, sizeof *jobs);
+    for (unsigned int t = 0; t < threads; t++) {
+        struct quadtree_batch_worker_t *j = &jobs[t];
+        j->q = q;
+        j->boxes = boxes;
+        j->offsets = offsets;
+        j->max = max;
+        j->from = count * t / threads;
+        j->to = count * (t + 1) / threads;
+    }
+    struct quadtree_workers_t *w = quadtree_workers_get(q->pool, threads);
+    quadtree_batch_pass(w, jobs, threads);
+    offsets[0] = 0;
+    for (size_t i = 0; i < count; i++)
+        offsets[i + 1] += offsets[i];
+    if (results && max) {
+        for (unsigned int t = 0; t < threads; t++)
+            jobs[t].results = results;
+        quadtree_batch_pass(w, jobs, threads);
+    }
+    // the second pass visits the nodes of queries with hits again, but
+    // it's the same queries
+    q->pool->counters.queries += count;
+    for (unsigned int t = 0; t < threads; t++)
+        q->pool->counters.nodes_visited += jobs[t].counters.nodes_visited;
+    free(jobs);
+    return offsets[count];
+}
+
+// quadtree bulk loading
+
+// elements are sorted by the deepest cell that would contain them if the
+// tree were subdivided all the way down. cells are numbered by their
+// location code padded to max_depth levels, so every subtree is a
+// contiguous range, and a node's own elements come first in its range.
+struct quadtree_build_key_t {
+    uint64_t cell;
+    size_t depth;
+    size_t idx;
+};
+
+// finds the deepest cell below root_box that would contain el if the
+// tree were subdivided down to max_depth. cell is the location code
+// without the leading 1, padded to max_depth levels.
+static void quadtree_cell(const AABB *root_box, size_t max_depth, const AABB *el, uint64_t *cell_out, size_t *depth_out) {
+    int x1 = root_box->x1, y1 = root_box->y1, x2 = root_box->x2, y2 = root_box->y2;
+    uint64_t cell = 0;
+    size_t d = 0;
+    // same quadrants as quadtree_node_init. the first quadrant that
+    // contains el prefers the west half, then the north half.
+    // written without branches since the quadrant is usually random
+    for (; d < max_depth; d++) {
+        int mx = (x1 + x2) / 2, my = (y1 + y2) / 2;
+        int xl = (el->x1 >= x1) & (el->x2 <= mx), xh = (el->x1 >= mx) & (el->x2 <= x2);
+        int yl = (el->y1 >= y1) & (el->y2 <= my), yh = (el->y1 >= my) & (el->y2 <= y2);
+        if (!((xl | xh) & (yl | yh))) break;
+        int xi = !xl, yi = !yl;
+        x1 = xi ? mx : x1;
+        x2 = xi ? x2 : mx;
+        y1 = yi ? my : y1;
+        y2 = yi ? y2 : my;
+        cell = cell << 2 | (uint64_t)(yi << 1 | xi);
+    }
+    *cell_out = cell << 2 * (max_depth - d);
+    *depth_out = d;
+}
+
+// same as quadtree_cell, for a loose quadtree. follows the same steps
+// as quadtree_node_init and quadtree_child_of.
+static void quadtree_cell_loose(const AABB *root_box, size_t max_depth, double looseness, const AABB *el, uint64_t *cell_out, size_t *depth_out) {
+    int x1 = root_box->x1, y1 = root_box->y1, x2 = root_box->x2, y2 = root_box->y2;
+    int64_t ex = (int64_t)el->x1 + el->x2, ey = (int64_t)el->y1 + el->y2;
+    // the sides of the current cell on the root's sides, as in
+    // quadtree_child_of
+    bool west = true, east = true, north = true, south = true;
+    uint64_t cell = 0;
+    size_t d = 0;
+    for (; d < max_depth; d++) {
+        int mx = (x1 + x2) / 2, my = (y1 + y2) / 2;
+        int px = quadtree_loose_pad(looseness, x2 - x1), py = quadtree_loose_pad(looseness, y2 - y1);
+        int xi, yi;
+        if (px == 0 && py == 0) {
+            // the node's children aren't grown, see quadtree_child_of
+            int xl = (el->x1 >= x1) & (el->x2 <= mx), xh = (el->x1 >= mx) & (el->x2 <= x2);
+            int yl = (el->y1 >= y1) & (el->y2 <= my), yh = (el->y1 >= my) & (el->y2 <= y2);
+            if (!((xl | xh) & (yl | yh))) break;
+            xi = !xl;
+            yi = !yl;
+        } else {
+            if ((!west && ex < 2 * (int64_t)x1) || (!east && ex >= 2 * (int64_t)x2)
+             || (!north && ey < 2 * (int64_t)y1) || (!south && ey >= 2 * (int64_t)y2)) break;
+            xi = ex >= 2 * (int64_t)mx;
+            yi = ey >= 2 * (int64_t)my;
+            AABB child;
+            aabb_init(&child, (xi ? mx : x1) - px, (yi ? my : y1) - py, (xi ? x2 : mx) + px, (yi ? y2 : my) + py);
+            if (!aabb_contains(&child, el)) break;
+        }
+        x1 = xi ? mx : x1;
+        x2 = xi ? x2 : mx;
+        y1 = yi ? my : y1;
+        y2 = yi ? y2 : my;
+        west &= !xi;
+        east &= xi;
+        north &= !yi;
+        south &= yi;
+        cell = cell << 2 | (uint64_t)(yi << 1 | xi);
+    }
+    *cell_out = cell << 2 * (max_depth - d);
+    *depth_out = d;
+}
+
+// pass 0 sorts by depth, then one byte of cell per pass
+static inline size_t quadtree_build_digit(const struct quadtree_build_key_t *key, size_t pass) {
+    return pass == 0 ? key->depth : (size_t)(key->cell >> 8 * (pass - 1) & 0xff);
+}
+
+// lsd radix sort by depth, then cell. tmp is scratch space for len keys
+static void quadtree_build_sort(struct quadtree_build_key_t *keys, struct quadtree_build_key_t *tmp, size_t len, size_t max_depth) {
+    struct quadtree_build_key_t *in = keys, *out = tmp;
+    size_t passes = 1 + (2 * max_depth + 7) / 8;
+    for (size_t pass = 0; pass < passes; pass++) {
+        size_t count[257] = {0};
+        for (size_t i = 0; i < len; i++)
+            count[quadtree_build_digit(&in[i], pass) + 1]++;
+        for (size_t i = 0; i < 256; i++)
+            count[i + 1] += count[i];
+        for (size_t i = 0; i < len; i++)
+            out[count[quadtree_build_digit(&in[i], pass)]++] = in[i];
+        struct quadtree_build_key_t *t = in;
+        in = out;
+        out = t;
+    }
+    if (in != keys)
+        memcpy(keys, in, len * sizeof *keys);
+}
+
+// builds q at depth d from sorted keys
+static void quadtree_build_node(Quadtree *q, const char *els, const struct quadtree_build_key_t *keys, size_t len, size_t d, size_t root_depth) {
+    size_t el_size = q->el_size;
+    size_t own = len;
+    if (len >= q->pool->config.split_threshold && q->max_depth > 0) {
+        own = 0;
+        while (own < len && keys[own].depth == d)
+            own++;
+    }
+    quadtree_data_resize(q, quadtree_data_fit_cap(own));
+    for (size_t k = 0; k < own; k++)
+        quadtree_data_put(q, k, els + keys[k].idx * el_size, keys[k].idx);
+    q->data_len = own;
+    if (own == len)
+        return;
+    Quadtree *children = quadtree_pool_alloc(q->pool);
+    // cells of child i all have this digit
+    unsigned int shift = 2 * (unsigned int)(root_depth - d - 1);
+    size_t start = own;
+    for (int i = 0; i < 4; i++) {
+        q->child[i] = &children[i];
+        AABB box;
+        quadtree_child_box(q, i, &box);
+        quadtree_node_init(q->child[i], &box, q->max_depth - 1, el_size, q->pool, q->loc << 2 | i);
+        size_t end = start;
+        while (end < len && (int)(keys[end].cell >> shift & 3) == i)
+            end++;
+        quadtree_build_node(q->child[i], els, keys + start, end - start, d + 1, root_depth);
+        start = end;
+    }
+    assert(start == len);
+}
+
+// the structure only depends on which elements are in the tree, so
+// it can be computed directly instead of splitting nodes as they fill
+void quadtree_build(Quadtree *q, const AABB *box, size_t depth, size_t el_size, const void *els, size_t len, QuadtreeHandle *handles) {
+    quadtree_init(q, box, depth, el_size);
+    struct quadtree_pool_t *pool = q->pool;
+    // element i gets handle i
+    quadtree_handle_reserve(pool, len);
+    pool->handles_len = len;
+    pool->handles_used = len;
+    struct quadtree_build_key_t *keys = malloc(2 * len * sizeof *keys);
+    for (size_t i = 0; i < len; i++) {
+        quadtree_cell(box, depth, (const AABB *)((const char *)els + i * el_size), &keys[i].cell, &keys[i].depth);
+        keys[i].idx = i;
+    }
+    quadtree_build_sort(keys, keys + len, len, depth);
+    quadtree_build_node(q, els, keys, len, 0, depth);
+    free(keys);
+    if (handles) {
+        for (size_t i = 0; i < len; i++)
+            handles[i] = i;
+    }
+}
+
+// quadtree batch operations
+
+// brings the dirty part of the subtree of q back into the shape that
+// moving elements one at a time would have given it
+static void quadtree_normalize(Quadtree *q) {
+    if (!q->dirty)
+        return;
+    q->dirty = false;
+    if (q->child[0]) {
+        for (int i = 0; i < 4; i++)
+            quadtree_normalize(q->child[i]);
+        if (quadtree_should_unsubdivide(q))
+            quadtree_unsubdivide(q);
+    } else if (quadtree_should_subdivide(q)) {
+        quadtree_subdivide(q);
+    }
+    quadtree_data_remove_free(q);
+    size_t cap = quadtree_data_fit_cap(q->data_len);
+    if (cap != q->data_cap)
+        quadtree_data_resize(q, cap);
+}
+
+// elements that leave their node are taken out first, then sorted by
+// the node they go to and inserted in tree order. moves is how many
+// moves to count towards min_lifetime.
+static void quadtree_move_batch(Quadtree *q, const QuadtreeHandle *handles, const AABB *new_bounds, size_t len, size_t moves) {
+    // the root has to be final before the cells are worked out, and
+    // growing once for all of them only walks the tree once
+    if (len && q->pool->config.auto_resize) {
+        AABB all = new_bounds[0];
+        for (size_t i = 1; i < len; i++) {
+            const AABB *b = &new_bounds[i];
+            aabb_init(&all, b->x1 < all.x1 ? b->x1 : all.x1, b->y1 < all.y1 ? b->y1 : all.y1,
+                      b->x2 > all.x2 ? b->x2 : all.x2, b->y2 > all.y2 ? b->y2 : all.y2);
+        }
+        quadtree_fit(q, &all);
+    }
+    Quadtree *path[QUADTREE_MAX_DEPTH + 1];
+    size_t el_size = q->el_size, max_depth = q->max_depth, moved = 0;
+    q->pool->time += moves;
+    struct quadtree_build_key_t *keys = malloc(2 * len * sizeof *keys), *tmp = keys + len;
+    // elements leaving their node are copied out before anything is
+    // inserted, since inserting may compact the nodes they came from
+    char *els = malloc(len * el_size);
+    QuadtreeHandle *els_handles = malloc(len * sizeof(QuadtreeHandle));
+    for (size_t i = 0; i < len; i++) {
+        quadtree_pending_drop(q->pool, handles[i]);
+        size_t depth, slot = quadtree_handle_find(q, handles[i], path, &depth);
+        quadtree_own_path(path, depth);
+        Quadtree *node = path[depth];
+        quadtree_data_own(node);
+        assert(!quadtree_data_is_free(node, slot) && "handle was moved twice");
+        if (quadtree_stays(path, depth, &new_bounds[i])) {
+            memcpy(quadtree_data_at(node, slot), &new_bounds[i], sizeof(AABB));
+            quadtree_data_set_bounds(node, slot, &new_bounds[i]);
+            continue;
+        }
+        char *el = els + moved * el_size;
+        memcpy(el, quadtree_data_at(node, slot), el_size);
+        memcpy(el, &new_bounds[i], sizeof(AABB));
+        els_handles[moved++] = handles[i];
+        // leave a hole, the node is cleaned up by quadtree_normalize
+        quadtree_data_unmark(node, slot);
+        node->data_len--;
+        node->data_free++;
+        for (size_t d = 0; d <= depth; d++)
+            path[d]->dirty = true;
+    }
+    AABB root_box;
+    quadtree_node_box(q, &root_box);
+    double looseness = q->pool->looseness;
+    for (size_t k = 0; k < moved; k++) {
+        const AABB *el = (AABB *)(els + k * el_size);
+        if (looseness > 1.0)
+            quadtree_cell_loose(&root_box, max_depth, looseness, el, &keys[k].cell, &keys[k].depth);
+        else
+            quadtree_cell(&root_box, max_depth, el, &keys[k].cell, &keys[k].depth);
+        keys[k].idx = k;
+    }
+    quadtree_build_sort(keys, tmp, moved, max_depth);
+    for (size_t k = 0; k < moved; k++) {
+        // same node as quadtree_insert_node picks, without splitting
+        Quadtree *node = q;
+        node->dirty = true;
+        for (size_t d = 0; d < keys[k].depth && node->child[0]; d++) {
+            quadtree_own_children(node);
+            node = node->child[keys[k].cell >> 2 * (max_depth - d - 1) & 3];
+            node->dirty = true;
+        }
+        quadtree_data_insert(node, els + keys[k].idx * el_size, els_handles[keys[k].idx]);
+    }
+    quadtree_normalize(q);
+    quadtree_trim(q);
+    free(keys);
+    free(els);
+    free(els_handles);
+}
+
+void quadtree_move_many(Quadtree *q, const QuadtreeHandle *handles, const AABB *new_bounds, size_t len) {
+    quadtree_move_batch(q, handles, new_bounds, len, len);
+}
+
+void quadtree_flush(Quadtree *q) {
+    struct quadtree_pool_t *pool = q->pool;
+    size_t len = pool->pending_len;
+    if (!len)
+        return;
+    // the list is taken over first so quadtree_move_batch has nothing to
+    // drop from it
+    for (size_t i = 0; i < len; i++)
+        pool->pending_at[pool->pending_handles[i]] = 0;
+    pool->pending_len = 0;
+    // the moves were counted when they were made
+    quadtree_move_batch(q, pool->pending_handles, pool->pending_bounds, len, 0);
+}
+
+static void quadtree_clone_nodes(Quadtree *dest, const Quadtree *src, struct quadtree_pool_t *pool) {
+    for (int i = 0; i < 4; i++)
+        dest->box[i] = src->box[i];
+    dest->pool = pool;
+    dest->loc = src->loc;
+    dest->edges = src->edges;
+    dest->max_depth = src->max_depth;
+    dest->el_size = src->el_size;
+    dest->dirty = false;
+    dest->split_time = src->split_time;
+    quadtree_data_clone(dest, src);
+    if (src->child[0] != NULL) {
+        Quadtree *children = quadtree_pool_alloc(pool);
+        for (int i = 0; i < 4; i++) {
+            dest->child[i] = &children[i];
+            quadtree_clone_nodes(dest->child[i], src->child[i], pool);
+        }
+    } else {
+        for (int i = 0; i < 4; i++)
+            dest->child[i] = NULL;
+    }
+}
+
+void quadtree_clone(Quadtree *dest, const Quadtree *src) {
+    assert(dest != NULL && src != NULL);
+    struct quadtree_pool_t *pool = quadtree_pool_new(src->el_size, NULL);
+    // same handles refer to the same elements in both trees
+    const struct quadtree_pool_t *src_pool = src->pool;
+    quadtree_handle_copy(pool, src_pool);
+    pool->looseness = src_pool->looseness;
+    pool->config = src_pool->config;
+    pool->time = src_pool->time;
+    quadtree_clone_nodes(dest, src, pool);
+}
+
+void quadtree_snapshot(Quadtree *dest, Quadtree *src) {
+    assert(dest != NULL && src != NULL);
+    struct quadtree_pool_t *src_pool = src->pool,
+                           *pool = quadtree_pool_new(src->el_size, src_pool->alloc);
+    quadtree_handle_share(pool, src_pool);
+    pool->looseness = src_pool->looseness;
+    pool->config = src_pool->config;
+    pool->time = src_pool->time;
+    // only the root node itself is copied
+    *dest = *src;
+    dest->pool = pool;
+    if (dest->data)
+        (*quadtree_data_refs(dest))++;
+    if (dest->child[0])
+        quadtree_block_of(dest->child[0])->refs++;
+}
+
+void quadtree_default_config(QuadtreeConfig *config) {
+    config->split_threshold = QUADTREE_THRESHOLD;
+    config->merge_threshold = QUADTREE_THRESHOLD;
+    config->min_lifetime = 0;
+    config->auto_resize = false;
+    config->defer_moves = false;
+    config->defer_union = false;
+}
+
+void quadtree_set_config(Quadtree *q, const QuadtreeConfig *config) {
+    assert(config->merge_threshold <= config->split_threshold);
+    q->pool->config = *config;
+}
+
+void quadtree_get_config(const Quadtree *q, QuadtreeConfig *config) {
+    *config = q->pool->config;
+}
+
+void quadtree_get_counters(const Quadtree *q, QuadtreeCounters *counters) {
+    *counters = q->pool->counters;
+}
+
+void quadtree_get_box(const Quadtree *q, AABB *box) {
+    quadtree_node_box(q, box);
+}
+
+void quadtree_reset_counters(Quadtree *q) {
+    q->pool->counters.splits = 0;
+    q->pool->counters.merges = 0;
+    q->pool->counters.grows = 0;
+    q->pool->counters.shrinks = 0;
+    q->pool->counters.reallocs = 0;
+    q->pool->counters.queries = 0;
+    q->pool->counters.nodes_visited = 0;
+}
+
+static void quadtree_stats_rec(const Quadtree *q, size_t depth, QuadtreeStats *stats) {
+    stats->nodes++;
+    stats->nodes_per_level[depth]++;
+    stats->elements_per_level[depth] += q->data_len;
+    stats->elements += q->data_len;
+    stats->capacity += q->data_cap;
+    stats->holes += q->data_free;
+    stats->slack += q->data_cap - q->data_len - q->data_free;
+    if (q->data) {
+        size_t off[6];
+        stats->data_bytes += sizeof(union quadtree_data_header_t) + quadtree_data_layout(q->data_cap, q->el_size, off);
+    }
+    if (depth > stats->depth)
+        stats->depth = depth;
+    if (!q->child[0]) {
+        stats->leaves++;
+        return;
+    }
+    // children are allocated together, in one block
+    stats->node_bytes += sizeof(struct quadtree_block_t);
+    for (int i = 0; i < 4; i++)
+        quadtree_stats_rec(q->child[i], depth + 1, stats);
+}
+
+void quadtree_stats(const Quadtree *q, QuadtreeStats *stats) {
+    memset(stats, 0, sizeof *stats);
+    quadtree_stats_rec(q, 0, stats);
+    stats->pending = q->pool->pending_len;
+}
+
+// collision solver impl
+
+void aabb_solve(AABBMover *movers, size_t len, unsigned int iterations, aabb_hit_fn first_hit, void *geometry) {
+    for (size_t i = 0; i < len; i++) {
+        AABBMover *m = &movers[i];
+        double pos[2] = {m->x, m->y}, delta[2] = {m->dx, m->dy};
+        const int size[2] = {m->width, m->height};
+        m->contacts = 0;
+        for (unsigned int k = 0; k < iterations; k++) {
+            // a box that doesn't move can't hit anything
+            if (delta[0] == 0 && delta[1] == 0)
+                break;
+            AABB hit;
+            AABBEdge edge;
+            double t = first_hit(geometry, pos[0], pos[1], delta[0], delta[1], size[0], size[1], &hit, &edge);
+            if (!(t >= 0 && t < 1.0)) {
+                for (int j = 0; j < 2; j++) {
+                    pos[j] += delta[j];
+                    delta[j] = 0;
+                }
+                break;
+            }
+            // same order as AABB: x1, y1, x2, y2
+            const int coords[4] = {hit.x1, hit.y1, hit.x2, hit.y2};
+            int axis = edge & 1;
+            pos[!axis] += delta[!axis] * t;
+            pos[axis] = coords[edge] - !(edge >> 1) * size[axis];
+            delta[axis] = 0;
+            delta[!axis] *= 1.0 - t;
+            m->contacts |= 1u << edge;
+        }
+        m->x = pos[0];
+        m->y = pos[1];
+        m->dx = delta[0];
+        m->dy = delta[1];
+    }
+}
+
+// boxes near the mover are copied out of the tree into x1, y1, x2, y2
+// arrays, which are kept between movers
+struct aabb_solve_quadtree_t {
+    Quadtree *q;
+    int *x1, *y1, *x2, *y2;
+    size_t cap;
+};
+
+static double aabb_solve_quadtree_hit(void *geometry, double x, double y, double dx, double dy,
+                                      int width, int height, AABB *hit, AABBEdge *edge) {
+    struct aabb_solve_quadtree_t *g = geometry;
+    AABB area;
+    aabb_init_bounding(&area, x, y, dx, dy, width, height);
+    // boxes only touching the swept area can still be hit at a t that
+    // rounds down to just below 1
+    aabb_init(&area, area.x1 - 1, area.y1 - 1, area.x2 + 1, area.y2 + 1);
+    QuadtreeQuery it;
+    quadtree_query_begin(&it, g->q, &area);
+    void *els[64];
+    size_t len = 0, n;
+    do {
+        n = quadtree_query_collect(&it, els, sizeof els / sizeof *els);
+        if (len + n > g->cap) {
+            g->cap = g->cap ? g->cap * 2 : 64;
+            g->x1 = realloc(g->x1, g->cap * sizeof *g->x1);
+            g->y1 = realloc(g->y1, g->cap * sizeof *g->y1);
+            g->x2 = realloc(g->x2, g->cap * sizeof *g->x2);
+            g->y2 = realloc(g->y2, g->cap * sizeof *g->y2);
+        }
+        for (size_t j = 0; j < n; j++, len++) {
+            const AABB *box = els[j];
+            g->x1[len] = box->x1;
+            g->y1[len] = box->y1;
+            g->x2[len] = box->x2;
+            g->y2[len] = box->y2;
+        }
+    } while (n == sizeof els / sizeof *els);
+    size_t i;
+    double t = aabb_sweep_many(g->x1, g->y1, g->x2, g->y2, len, x, y, 1.0 / dx, 1.0 / dy, width, height, &i, edge);
+    if (t >= 0)
+        aabb_init(hit, g->x1[i], g->y1[i], g->x2[i], g->y2[i]);
+    return t;
+}
+
+void aabb_solve_quadtree(Quadtree *q, AABBMover *movers, size_t len, unsigned int iterations) {
+    struct aabb_solve_quadtree_t g = {q, NULL, NULL, NULL, NULL, 0};
+    aabb_solve(movers, len, iterations, aabb_solve_quadtree_hit, &g);
+    free(g.x1);
+    free(g.y1);
+    free(g.x2);
+    free(g.y2);
+}
+
+// tilemap impl
+
+void tilemap_init(Tilemap *m, int x, int y, int width, int height, int tile_width, int tile_height) {
+    assert(width >= 0 && height >= 0 && tile_width > 0 && tile_height > 0);
+    m->x = x;
+    m->y = y;
+    m->tile_width = tile_width;
+    m->tile_height = tile_height;
+    m->width = width;
+    m->height = height;
+    m->chunks_x = (width + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE;
+    m->chunks_y = (height + TILEMAP_CHUNK_SIZE - 1) / TILEMAP_CHUNK_SIZE;
+    m->chunks = calloc((size_t)m->chunks_x * m->chunks_y, sizeof *m->chunks);
+}
+
+void tilemap_free(Tilemap *m) {
+    for (size_t i = 0; i < (size_t)m->chunks_x * m->chunks_y; i++)
+        free(m->chunks[i]);
+    free(m->chunks);
+}
+
+// chunk holding (tx, ty), which must be inside the map
+static inline uint64_t **tilemap_chunk(const Tilemap *m, int tx, int ty) {
+    return &m->chunks[(size_t)(ty / TILEMAP_CHUNK_SIZE) * m->chunks_x + tx / TILEMAP_CHUNK_SIZE];
+}
+
+void tilemap_set(Tilemap *m, int tx, int ty, bool solid) {
+    assert(tx >= 0 && ty >= 0 && tx < m->width && ty < m->height);
+    uint64_t **chunk = tilemap_chunk(m, tx, ty);
+    uint64_t bit = (uint64_t)1 << tx % TILEMAP_CHUNK_SIZE;
+    if (solid) {
+        if (!*chunk)
+            *chunk = calloc(TILEMAP_CHUNK_SIZE, sizeof **chunk);
+        (*chunk)[ty % TILEMAP_CHUNK_SIZE] |= bit;
+    } else if (*chunk) {
+        (*chunk)[ty % TILEMAP_CHUNK_SIZE] &= ~bit;
+    }
+}
+
+bool tilemap_get(const Tilemap *m, int tx, int ty) {
+    if (tx < 0 || ty < 0 || tx >= m->width || ty >= m->height)
+        return false;
+    const uint64_t *chunk = *tilemap_chunk(m, tx, ty);
+    return chunk && chunk[ty % TILEMAP_CHUNK_SIZE] >> tx % TILEMAP_CHUNK_SIZE & 1;
+}
+
+// a sweep through the map, indexed by axis
+struct tilemap_sweep_t {
+    double pos[2], delta[2], inv[2];
+    int size[2];
+    // tiles under the box so far, inclusive, counting ones it only touches
+    int first[2], last[2];
+    // when the front of the box reaches the next line of tiles
+    double next[2];
+    // best hit so far, 2.0 if none
+    double t;
+    int tx, ty;
+    AABBEdge edge;
+};
+
+// first and last tile along an axis that the span from v1 to v2 touches.
+// clamped to a little past the map so they fit in an int
+static int tilemap_first(double v1, int origin, int tile, int len) {
+    double i = ceil((v1 - origin) / tile) - 1;
+    return i < -2 ? -2 : i > len + 1 ? len + 1 : (int)i;
+}
+
+static int tilemap_last(double v2, int origin, int tile, int len) {
+    double i = floor((v2 - origin) / tile);
+    return i < -2 ? -2 : i > len + 1 ? len + 1 : (int)i;
+}
+
+// when the front of the box along axis a reaches the next line of tiles,
+// or infinity if there are no more that way. the front skips ahead to
+// the map first, since there's nothing before it.
+// uses the same math as aabb_sweep, so no tile in that line can be hit
+// any earlier.
+static double tilemap_next(const Tilemap *m, struct tilemap_sweep_t *s, int a) {
+    int origin = a ? m->y : m->x, tile = a ? m->tile_height : m->tile_width, len = a ? m->height : m->width;
+    if (s->delta[a] > 0) {
+        if (s->last[a] >= len - 1)
+            return INFINITY;
+        if (s->last[a] < -1)
+            s->last[a] = -1;
+        return (origin + (s->last[a] + 1) * tile - s->pos[a] - s->size[a]) * s->inv[a];
+    } else if (s->delta[a] < 0) {
+        if (s->first[a] <= 0)
+            return INFINITY;
+        if (s->first[a] > len)
+            s->first[a] = len;
+        return (origin + s->first[a] * tile - s->pos[a]) * s->inv[a];
+    }
+    return INFINITY;
+}
+
+// sweeps against the solid tiles in columns x1 to x2 of rows y1 to y2,
+// inclusive, keeping the best hit. a row of a chunk is one word, so
+// empty stretches are skipped a word at a time.
+static void tilemap_sweep_tiles(const Tilemap *m, struct tilemap_sweep_t *s, int x1, int y1, int x2, int y2) {
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 >= m->width) x2 = m->width - 1;
+    if (y2 >= m->height) y2 = m->height - 1;
+    // all of it is off the map. x2 / TILEMAP_CHUNK_SIZE would round a
+    // negative x2 up to chunk 0, so this can't be left to the loops.
+    if (x1 > x2 || y1 > y2)
+        return;
+    for (int ty = y1; ty <= y2; ty++) {
+        for (int cx = x1 / TILEMAP_CHUNK_SIZE; cx <= x2 / TILEMAP_CHUNK_SIZE; cx++) {
+            const uint64_t *chunk = *tilemap_chunk(m, cx * TILEMAP_CHUNK_SIZE, ty);
+            if (!chunk)
+                continue;
+            int base = cx * TILEMAP_CHUNK_SIZE;
+            uint64_t bits = chunk[ty % TILEMAP_CHUNK_SIZE];
+            if (x1 > base)
+                bits &= ~(uint64_t)0 << (x1 - base);
+            if (x2 < base + TILEMAP_CHUNK_SIZE - 1)
+                bits &= ~(uint64_t)0 >> (base + TILEMAP_CHUNK_SIZE - 1 - x2);
+            for (; bits; bits &= bits - 1) {
+                int tx = base + (int)quadtree_ctz(bits);
+                AABB box;
+                aabb_init(&box, m->x + tx * m->tile_width, m->y + ty * m->tile_height,
+                          m->x + (tx + 1) * m->tile_width, m->y + (ty + 1) * m->tile_height);
+                AABBEdge e;
+                double t = aabb_sweep(&box, s->pos[0], s->pos[1], s->inv[0], s->inv[1], s->size[0], s->size[1], &e);
+                if (t < 0 || t > s->t)
+                    continue;
+                if (t == s->t && (ty > s->ty || (ty == s->ty && tx > s->tx)))
+                    continue;
+                s->t = t;
+                s->tx = tx;
+                s->ty = ty;
+                s->edge = e;
+            }
+        }
+    }
+}
+
+double tilemap_sweep(const Tilemap *m, double x, double y, double dx, double dy,
+                     int width, int height, AABB *hit, AABBEdge *edge) {
+    struct tilemap_sweep_t s = {
+        {x, y}, {dx, dy}, {1.0 / dx, 1.0 / dy}, {width, height},
+        {tilemap_first(x, m->x, m->tile_width, m->width), tilemap_first(y, m->y, m->tile_height, m->height)},
+        {tilemap_last(x + width, m->x, m->tile_width, m->width), tilemap_last(y + height, m->y, m->tile_height, m->height)},
+        {0, 0}, 2.0, 0, 0, EDGE_WEST,
+    };
+    tilemap_sweep_tiles(m, &s, s.first[0], s.first[1], s.last[0], s.last[1]);
+    s.next[0] = tilemap_next(m, &s, 0);
+    s.next[1] = tilemap_next(m, &s, 1);
+    for (;;) {
+        // x first on ties, so the y line that follows covers the corner
+        int a = s.next[1] < s.next[0], b = !a;
+        double t = s.next[a];
+        if (!(t < 1.0) || t > s.t)
+            break;
+        // the back of the box along the other axis moves on too
+        int origin = b ? m->y : m->x, tile = b ? m->tile_height : m->tile_width, len = b ? m->height : m->width;
+        if (s.delta[b] > 0) {
+            int first = tilemap_first(s.pos[b] + s.delta[b] * t, origin, tile, len);
+            if (first > s.first[b])
+                s.first[b] = first;
+        } else if (s.delta[b] < 0) {
+            int last = tilemap_last(s.pos[b] + s.size[b] + s.delta[b] * t, origin, tile, len);
+            if (last < s.last[b])
+                s.last[b] = last;
+        }
+        int line = s.delta[a] > 0 ? ++s.last[a] : --s.first[a];
+        s.next[a] = tilemap_next(m, &s, a);
+        if (a)
+            tilemap_sweep_tiles(m, &s, s.first[0], line, s.last[0], line);
+        else
+            tilemap_sweep_tiles(m, &s, line, s.first[1], line, s.last[1]);
+    }
+    if (s.t > 1.0)
+        return -1.0;
+    if (hit)
+        aabb_init(hit, m->x + s.tx * m->tile_width, m->y + s.ty * m->tile_height,
+                  m->x + (s.tx + 1) * m->tile_width, m->y + (s.ty + 1) * m->tile_height);
+    if (edge)
+        *edge = s.edge;
+    return s.t;
+}
+
+static double tilemap_hit(void *geometry, double x, double y, double dx, double dy,
+                          int width, int height, AABB *hit, AABBEdge *edge) {
+    return tilemap_sweep(geometry, x, y, dx, dy, width, height, hit, edge);
+}
+
+void aabb_solve_tilemap(Tilemap *m, AABBMover *movers, size_t len, unsigned int iterations) {
+    aabb_solve(movers, len, iterations, tilemap_hit, m);
+}
+
+// linear quadtree impl
+
+// keys are the padded cell from quadtree_cell, then 5 bits of depth.
+// sorting by key puts every subtree in a contiguous range, with a
+// cell's own elements before those of its descendants.
+#define LINEAR_QUADTREE_DEPTH_BITS 5
+// never a real key since depth is at most LINEAR_QUADTREE_MAX_DEPTH
+#define LINEAR_QUADTREE_DEAD UINT64_MAX
+
+// every ancestor of a non-empty cell has a node too, possibly with no
+// elements, so a node's subtree is the nodes after it up to end
+struct linear_quadtree_node_t {
+    uint64_t key;
+    size_t start;
+    size_t len;
+    size_t end;
+    AABB box; // the cell
+};
+
+struct linear_quadtree_pending_t {
+    uint64_t key;
+    size_t idx;
+};
+
+static inline void *linear_quadtree_at(const LinearQuadtree *q, void *data, size_t i) {
+    return (char *)data + i * q->el_size;
+}
+
+static inline uint64_t linear_quadtree_key(const LinearQuadtree *q, const AABB *el) {
+    uint64_t cell;
+    size_t depth;
+    quadtree_cell(&q->box, q->max_depth, el, &cell, &depth);
+    return cell << LINEAR_QUADTREE_DEPTH_BITS | depth;
+}
+
+void linear_quadtree_init(LinearQuadtree *q, const AABB *box, size_t depth, size_t el_size) {
+    assert(depth <= LINEAR_QUADTREE_MAX_DEPTH);
+    q->box = *box;
+    q->max_depth = depth;
+    q->el_size = el_size;
+    q->data = NULL;
+    q->keys = NULL;
+    q->data_len = 0;
+    q->data_sorted = 0;
+    q->data_cap = 0;
+    q->data_free = 0;
+    q->nodes = NULL;
+    q->nodes_len = 0;
+    q->nodes_cap = 0;
+    q->spare_data = NULL;
+    q->spare_keys = NULL;
+    q->scratch = malloc(el_size);
+    q->bounds = NULL;
+    q->bounds_stride = 0;
+}
+
+void linear_quadtree_free(LinearQuadtree *q) {
+    if (q == NULL) return;
+    free(q->data);
+    free(q->keys);
+    free(q->nodes);
+    free(q->spare_data);
+    free(q->spare_keys);
+    free(q->scratch);
+    free(q->bounds);
+}
+
+void linear_quadtree_insert(LinearQuadtree *q, void *el) {
+    if (q->data_len == q->data_cap) {
+        q->data_cap = q->data_cap ? q->data_cap * 2 : 16;
+        q->data = realloc(q->data, q->data_cap * q->el_size);
+        q->keys = realloc(q->keys, q->data_cap * sizeof *q->keys);
+        q->spare_data = realloc(q->spare_data, q->data_cap * q->el_size);
+        q->spare_keys = realloc(q->spare_keys, q->data_cap * sizeof *q->spare_keys);
+    }
+    memcpy(linear_quadtree_at(q, q->data, q->data_len), el, q->el_size);
+    q->keys[q->data_len] = linear_quadtree_key(q, (AABB *)el);
+    q->data_len++;
+}
+
+// first node in [lo, hi) with key >= key
+static size_t linear_quadtree_lower_bound(const LinearQuadtree *q, size_t lo, size_t hi, uint64_t key) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (q->nodes[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// returns index of el, or data_len if not found
+static size_t linear_quadtree_find(const LinearQuadtree *q, void *el, qt_equal_fn equal) {
+    uint64_t key = linear_quadtree_key(q, (AABB *)el);
+    // sorted part, where removed elements keep their place until update
+    size_t n = linear_quadtree_lower_bound(q, 0, q->nodes_len, key);
+    if (n < q->nodes_len && q->nodes[n].key == key) {
+        size_t end = q->nodes[n].start + q->nodes[n].len;
+        for (size_t i = q->nodes[n].start; i < end; i++) {
+            if (q->keys[i] == key && equal(el, linear_quadtree_at(q, q->data, i)))
+                return i;
+        }
+    }
+    // inserted since last update
+    for (size_t i = q->data_sorted; i < q->data_len; i++) {
+        if (q->keys[i] == key && equal(el, linear_quadtree_at(q, q->data, i)))
+            return i;
+    }
+    assert(!"element was not found in linear quadtree");
+    return q->data_len;
+}
+
+static void linear_quadtree_remove_at(LinearQuadtree *q, size_t i, void *buf) {
+    if (buf)
+        memcpy(buf, linear_quadtree_at(q, q->data, i), q->el_size);
+    if (i < q->data_sorted) {
+        q->keys[i] = LINEAR_QUADTREE_DEAD;
+        q->data_free++;
+    } else {
+        // unsorted anyway, so fill the hole with the last element
+        q->data_len--;
+        if (i != q->data_len) {
+            memcpy(linear_quadtree_at(q, q->data, i), linear_quadtree_at(q, q->data, q->data_len), q->el_size);
+            q->keys[i] = q->keys[q->data_len];
+        }
+    }
+}
+
+void linear_quadtree_remove(LinearQuadtree *q, void *el, qt_equal_fn equal, void *buf) {
+    size_t i = linear_quadtree_find(q, el, equal);
+    if (i == q->data_len) return;
+    linear_quadtree_remove_at(q, i, buf);
+}
+
+void linear_quadtree_move(LinearQuadtree *q, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf) {
+    size_t i = linear_quadtree_find(q, el, equal);
+    if (i == q->data_len) return;
+    if (!buf)
+        buf = q->scratch;
+    linear_quadtree_remove_at(q, i, buf);
+    memcpy(buf, new_bounds, sizeof(AABB));
+    linear_quadtree_insert(q, buf);
+}
+
+// copies the bounds of the sorted elements into x1, y1, x2, y2 arrays,
+// padded so scans can read whole groups past any element
+static void linear_quadtree_build_bounds(LinearQuadtree *q) {
+    size_t stride = quadtree_data_stride(q->data_sorted);
+    q->bounds = realloc(q->bounds, (4 * stride + QUADTREE_LANES) * sizeof(int));
+    q->bounds_stride = stride;
+    int *x1 = q->bounds, *y1 = x1 + stride, *x2 = y1 + stride, *y2 = x2 + stride;
+    for (size_t i = 0; i < q->data_sorted; i++) {
+        const AABB *b = linear_quadtree_at(q, q->data, i);
+        x1[i] = b->x1;
+        y1[i] = b->y1;
+        x2[i] = b->x2;
+        y2[i] = b->y2;
+    }
+    // the padding is masked off, but keep it initialized
+    for (int k = 0; k < 4; k++) {
+        size_t pad = stride - q->data_sorted + (k == 3 ? QUADTREE_LANES : 0);
+        memset(q->bounds + k * stride + q->data_sorted, 0, pad * sizeof(int));
+    }
+}
+
+static struct linear_quadtree_node_t *linear_quadtree_push_node(LinearQuadtree *q, uint64_t key, size_t start) {
+    if (q->nodes_len == q->nodes_cap) {
+        q->nodes_cap = q->nodes_cap ? q->nodes_cap * 2 : 16;
+        q->nodes = realloc(q->nodes, q->nodes_cap * sizeof *q->nodes);
+    }
+    struct linear_quadtree_node_t *n = &q->nodes[q->nodes_len++];
+    n->key = key;
+    n->start = start;
+    n->len = 0;
+    return n;
+}
+
+// one node per distinct key, plus empty ones for the missing ancestors.
+// path holds the nodes containing the current one, and each gets its
+// end once a key outside it comes along.
+static void linear_quadtree_build_nodes(LinearQuadtree *q) {
+    size_t path[LINEAR_QUADTREE_MAX_DEPTH + 1], depth = 0;
+    q->nodes_len = 0;
+    for (size_t k = 0; k < q->data_sorted;) {
+        uint64_t key = q->keys[k], cell = key >> LINEAR_QUADTREE_DEPTH_BITS;
+        size_t d = key & (((uint64_t)1 << LINEAR_QUADTREE_DEPTH_BITS) - 1), start = k;
+        while (k < q->data_sorted && q->keys[k] == key)
+            k++;
+        // leave the nodes that don't contain cell
+        while (depth > 0) {
+            const struct linear_quadtree_node_t *top = &q->nodes[path[depth - 1]];
+            size_t top_d = (size_t)(top->key & (((uint64_t)1 << LINEAR_QUADTREE_DEPTH_BITS) - 1));
+            unsigned int shift = 2 * (unsigned int)(q->max_depth - top_d);
+            uint64_t top_cell = top->key >> LINEAR_QUADTREE_DEPTH_BITS;
+            if (top_d < d && cell >> shift == top_cell >> shift)
+                break;
+            q->nodes[path[--depth]].end = q->nodes_len;
+        }
+        // then go down to it, adding the nodes on the way
+        while (depth <= d) {
+            unsigned int shift = 2 * (unsigned int)(q->max_depth - depth);
+            uint64_t code = cell >> shift << shift;
+            struct linear_quadtree_node_t *n = linear_quadtree_push_node(q, code << LINEAR_QUADTREE_DEPTH_BITS | depth, start);
+            if (depth == 0) {
+                n->box = q->box;
+            } else {
+                // same quadrants as quadtree_cell
+                const AABB *p = &q->nodes[path[depth - 1]].box;
+                int mx = (p->x1 + p->x2) / 2, my = (p->y1 + p->y2) / 2;
+                unsigned int i = (unsigned int)(cell >> shift) & 3;
+                aabb_init(&n->box, i & 1 ? mx : p->x1, i & 2 ? my : p->y1, i & 1 ? p->x2 : mx, i & 2 ? p->y2 : my);
+            }
+            path[depth++] = q->nodes_len - 1;
+        }
+        q->nodes[q->nodes_len - 1].len = k - start;
+    }
+    while (depth > 0)
+        q->nodes[path[--depth]].end = q->nodes_len;
+}
+
+static int linear_quadtree_pending_cmp(const void *a, const void *b) {
+    uint64_t ka = ((const struct linear_quadtree_pending_t *)a)->key,
+             kb = ((const struct linear_quadtree_pending_t *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+void linear_quadtree_update(LinearQuadtree *q) {
+    size_t sorted = q->data_sorted, pending = q->data_len - sorted;
+    if (pending == 0 && q->data_free == 0)
+        return;
+    struct linear_quadtree_pending_t *order = malloc(pending * sizeof *order);
+    for (size_t j = 0; j < pending; j++) {
+        order[j].key = q->keys[sorted + j];
+        order[j].idx = sorted + j;
+    }
+    qsort(order, pending, sizeof *order, linear_quadtree_pending_cmp);
+    // merge sorted runs and pending elements into the spare buffers
+    size_t i = 0, j = 0, out = 0;
+    while (i < sorted || j < pending) {
+        uint64_t limit = j < pending ? order[j].key : LINEAR_QUADTREE_DEAD;
+        size_t run = i;
+        while (run < sorted && q->keys[run] <= limit && q->keys[run] != LINEAR_QUADTREE_DEAD)
+            run++;
+        memcpy(linear_quadtree_at(q, q->spare_data, out), linear_quadtree_at(q, q->data, i), (run - i) * q->el_size);
+        memcpy(&q->spare_keys[out], &q->keys[i], (run - i) * sizeof *q->keys);
+        out += run - i;
+        i = run;
+        if (i < sorted && q->keys[i] == LINEAR_QUADTREE_DEAD) {
+            i++;
+        } else if (j < pending) {
+            memcpy(linear_quadtree_at(q, q->spare_data, out), linear_quadtree_at(q, q->data, order[j].idx), q->el_size);
+            q->spare_keys[out] = order[j].key;
+            out++;
+            j++;
+        }
+    }
+    free(order);
+    void *t = q->data;
+    q->data = q->spare_data;
+    q->spare_data = t;
+    uint64_t *tk = q->keys;
+    q->keys = q->spare_keys;
+    q->spare_keys = tk;
+    q->data_len = q->data_sorted = out;
+    q->data_free = 0;
+    linear_quadtree_build_bounds(q);
+    linear_quadtree_build_nodes(q);
+}
+
+// calls callback for the elements in [from, to) that intersect box
+static void linear_quadtree_scan(LinearQuadtree *q, const AABB *box, size_t from, size_t to,
+                                 qt_callback_fn callback, void *cb_data) {
+    size_t stride = q->bounds_stride;
+    const int *x1 = q->bounds, *y1 = x1 + stride, *x2 = y1 + stride, *y2 = x2 + stride;
+    for (size_t i = from; i < to; i += QUADTREE_LANES) {
+        unsigned int mask = quadtree_bounds_hits(box, x1 + i, y1 + i, x2 + i, y2 + i);
+        if (to - i < QUADTREE_LANES)
+            mask &= (1u << (to - i)) - 1;
+        while (mask) {
+            size_t j = i + quadtree_ctz(mask);
+            mask &= mask - 1;
+            callback(cb_data, linear_quadtree_at(q, q->data, j));
+        }
+    }
+}
+
+void linear_quadtree_traverse(LinearQuadtree *q, AABB *box, qt_callback_fn callback, void *cb_data) {
+    linear_quadtree_update(q);
+    // nodes are visited in order, skipping the subtrees of cells that
+    // miss box. the elements of consecutive nodes are next to each other,
+    // so they're scanned together.
+    size_t from = 0, to = 0;
+    for (size_t i = 0; i < q->nodes_len;) {
+        const struct linear_quadtree_node_t *n = &q->nodes[i];
+        // elements outside the box stay in the root, so it's always scanned
+        if (i && !aabb_intersect(box, &n->box)) {
+            i = n->end;
+            continue;
+        }
+        if (n->start != to) {
+            linear_quadtree_scan(q, box, from, to, callback, cb_data);
+            from = n->start;
+        }
+        to = n->start + n->len;
+        i++;
+    }
+    linear_quadtree_scan(q, box, from, to, callback, cb_data);
+}
+
+// spatial hash impl
+
+// each cell lists the elements touching it, with a copy of their AABB
+// so queries don't have to look at the elements themselves
+struct spatial_hash_entry_t {
+    AABB box;
+    SpatialHashHandle handle;
+};
+
+struct spatial_hash_cell_t {
+    int x, y;
+    struct spatial_hash_entry_t *entries; // NULL if this slot is unused
+    size_t len;
+    size_t cap;
+};
+
+struct spatial_hash_slot_t {
+    size_t slot; // index into data, or next unused handle
+    bool used;
+};
+
+// cells covered by a box, inclusive
+struct spatial_hash_range_t {
+    int x1, y1, x2, y2;
+};
+
+static inline int spatial_hash_floor_div(int a, int b) {
+    return a / b - (a % b != 0 && a < 0);
+}
+
+static inline struct spatial_hash_range_t spatial_hash_range(const SpatialHash *g, const AABB *box) {
+    struct spatial_hash_range_t r;
+    r.x1 = spatial_hash_floor_div(box->x1, g->cell_size);
+    r.y1 = spatial_hash_floor_div(box->y1, g->cell_size);
+    // x2 and y2 aren't included, and empty boxes still go somewhere
+    r.x2 = box->x2 > box->x1 ? spatial_hash_floor_div(box->x2 - 1, g->cell_size) : r.x1;
+    r.y2 = box->y2 > box->y1 ? spatial_hash_floor_div(box->y2 - 1, g->cell_size) : r.y1;
+    return r;
+}
+
+static inline bool spatial_hash_range_has(const struct spatial_hash_range_t *r, int x, int y) {
+    return x >= r->x1 && x <= r->x2 && y >= r->y1 && y <= r->y2;
+}
+
+static inline void *spatial_hash_at(const SpatialHash *g, size_t i) {
+    return (char *)g->data + i * g->el_size;
+}
+
+static inline size_t spatial_hash_home(const SpatialHash *g, int x, int y) {
+    uint64_t key = (uint64_t)(uint32_t)x << 32 | (uint32_t)y;
+    // fibonacci hashing
+    return (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (g->cells_cap - 1);
+}
+
+static struct spatial_hash_cell_t *spatial_hash_cell_find(const SpatialHash *g, int x, int y) {
+    if (!g->cells_len)
+        return NULL;
+    for (size_t i = spatial_hash_home(g, x, y);; i = (i + 1) & (g->cells_cap - 1)) {
+        struct spatial_hash_cell_t *c = &g->cells[i];
+        if (!c->entries)
+            return NULL;
+        if (c->x == x && c->y == y)
+            return c;
+    }
+}
+
+static struct spatial_hash_cell_t *spatial_hash_cell_get(SpatialHash *g, int x, int y) {
+    struct spatial_hash_cell_t *c = spatial_hash_cell_find(g, x, y);
+    if (c)
+        return c;
+    // keep it at most half full
+    if (2 * (g->cells_len + 1) > g->cells_cap) {
+        struct spatial_hash_cell_t *old = g->cells;
+        size_t old_cap = g->cells_cap;
+        g->cells_cap = old_cap ? old_cap * 2 : 64;
+        g->cells = calloc(g->cells_cap, sizeof *g->cells);
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old[i].entries) continue;
+            size_t j = spatial_hash_home(g, old[i].x, old[i].y);
+            while (g->cells[j].entries)
+                j = (j + 1) & (g->cells_cap - 1);
+            g->cells[j] = old[i];
+        }
+        free(old);
+    }
+    size_t i = spatial_hash_home(g, x, y);
+    while (g->cells[i].entries)
+        i = (i + 1) & (g->cells_cap - 1);
+    c = &g->cells[i];
+    c->x = x;
+    c->y = y;
+    c->cap = 4;
+    c->len = 0;
+    c->entries = malloc(c->cap * sizeof *c->entries);
+    g->cells_len++;
+    return c;
+}
+
+// frees an empty cell, shifting back cells that were pushed past it
+static void spatial_hash_cell_delete(SpatialHash *g, struct spatial_hash_cell_t *c) {
+    size_t mask = g->cells_cap - 1, i = (size_t)(c - g->cells);
+    free(c->entries);
+    for (size_t j = (i + 1) & mask; g->cells[j].entries; j = (j + 1) & mask) {
+        size_t home = spatial_hash_home(g, g->cells[j].x, g->cells[j].y);
+        // move it unless its home is in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            g->cells[i] = g->cells[j];
+            i = j;
+        }
+    }
+    g->cells[i].entries = NULL;
+    g->cells_len--;
+}
+
+static void spatial_hash_cell_add(SpatialHash *g, int x, int y, SpatialHashHandle h, const AABB *box) {
+    struct spatial_hash_cell_t *c = spatial_hash_cell_get(g, x, y);
+    if (c->len == c->cap) {
+        c->cap *= 2;
+        c->entries = realloc(c->entries, c->cap * sizeof *c->entries);
+    }
+    c->entries[c->len].box = *box;
+    c->entries[c->len].handle = h;
+    c->len++;
+}
+
+static struct spatial_hash_entry_t *spatial_hash_cell_entry(struct spatial_hash_cell_t *c, SpatialHashHandle h) {
+    for (size_t i = 0; i < c->len; i++) {
+        if (c->entries[i].handle == h)
+            return &c->entries[i];
+    }
+    assert(!"element is missing from its cell");
+    return NULL;
+}
+
+static void spatial_hash_cell_drop(SpatialHash *g, int x, int y, SpatialHashHandle h) {
+    struct spatial_hash_cell_t *c = spatial_hash_cell_find(g, x, y);
+    assert(c);
+    struct spatial_hash_entry_t *e = spatial_hash_cell_entry(c, h);
+    *e = c->entries[--c->len];
+    if (!c->len)
+        spatial_hash_cell_delete(g, c);
+}
+
+void spatial_hash_init(SpatialHash *g, int cell_size, size_t el_size) {
+    assert(cell_size > 0 && el_size >= sizeof(AABB));
+    g->cell_size = cell_size;
+    g->el_size = el_size;
+    g->data = NULL;
+    g->data_handles = NULL;
+    g->data_len = 0;
+    g->data_cap = 0;
+    g->handles = NULL;
+    g->handles_len = 0;
+    g->handles_cap = 0;
+    g->handles_free = SPATIAL_HASH_NO_HANDLE;
+    g->cells = NULL;
+    g->cells_len = 0;
+    g->cells_cap = 0;
+    g->scratch = malloc(el_size);
+}
+
+void spatial_hash_free(SpatialHash *g) {
+    for (size_t i = 0; i < g->cells_cap; i++)
+        free(g->cells[i].entries);
+    free(g->cells);
+    free(g->data);
+    free(g->data_handles);
+    free(g->handles);
+    free(g->scratch);
+}
+
+SpatialHashHandle spatial_hash_insert(SpatialHash *g, void *el) {
+    SpatialHashHandle h = g->handles_free;
+    if (h != SPATIAL_HASH_NO_HANDLE) {
+        g->handles_free = g->handles[h].slot;
+    } else {
+        if (g->handles_len == g->handles_cap) {
+            g->handles_cap = g->handles_cap ? g->handles_cap * 2 : 16;
+            g->handles = realloc(g->handles, g->handles_cap * sizeof *g->handles);
+        }
+        h = g->handles_len++;
+    }
+    if (g->data_len == g->data_cap) {
+        g->data_cap = g->data_cap ? g->data_cap * 2 : 16;
+        g->data = realloc(g->data, g->data_cap * g->el_size);
+        g->data_handles = realloc(g->data_handles, g->data_cap * sizeof *g->data_handles);
+    }
+    memcpy(spatial_hash_at(g, g->data_len), el, g->el_size);
+    g->data_handles[g->data_len] = h;
+    g->handles[h].slot = g->data_len++;
+    g->handles[h].used = true;
+    const AABB *box = (const AABB *)el;
+    struct spatial_hash_range_t r = spatial_hash_range(g, box);
+    for (int y = r.y1; y <= r.y2; y++)
+        for (int x = r.x1; x <= r.x2; x++)
+            spatial_hash_cell_add(g, x, y, h, box);
+    return h;
+}
+
+void *spatial_hash_get(SpatialHash *g, SpatialHashHandle h) {
+    assert(h < g->handles_len && g->handles[h].used);
+    return spatial_hash_at(g, g->handles[h].slot);
+}
+
+void spatial_hash_move_handle(SpatialHash *g, SpatialHashHandle h, const AABB *new_bounds, void *buf) {
+    void *el = spatial_hash_get(g, h);
+    struct spatial_hash_range_t from = spatial_hash_range(g, (AABB *)el),
+                                to = spatial_hash_range(g, new_bounds);
+    for (int y = from.y1; y <= from.y2; y++) {
+        for (int x = from.x1; x <= from.x2; x++) {
+            if (spatial_hash_range_has(&to, x, y))
+                spatial_hash_cell_entry(spatial_hash_cell_find(g, x, y), h)->box = *new_bounds;
+            else
+                spatial_hash_cell_drop(g, x, y, h);
+        }
+    }
+    for (int y = to.y1; y <= to.y2; y++) {
+        for (int x = to.x1; x <= to.x2; x++) {
+            if (!spatial_hash_range_has(&from, x, y))
+                spatial_hash_cell_add(g, x, y, h, new_bounds);
+        }
+    }
+    memcpy(el, new_bounds, sizeof(AABB));
+    if (buf)
+        memcpy(buf, el, g->el_size);
+}
+
+void spatial_hash_remove_handle(SpatialHash *g, SpatialHashHandle h, void *buf) {
+    void *el = spatial_hash_get(g, h);
+    struct spatial_hash_range_t r = spatial_hash_range(g, (AABB *)el);
+    for (int y = r.y1; y <= r.y2; y++)
+        for (int x = r.x1; x <= r.x2; x++)
+            spatial_hash_cell_drop(g, x, y, h);
+    if (buf)
+        memcpy(buf, el, g->el_size);
+    // fill the hole with the last element
+    size_t slot = g->handles[h].slot, last = --g->data_len;
+    if (slot != last) {
+        memcpy(el, spatial_hash_at(g, last), g->el_size);
+        g->data_handles[slot] = g->data_handles[last];
+        g->handles[g->data_handles[slot]].slot = slot;
+    }
+    g->handles[h].used = false;
+    g->handles[h].slot = g->handles_free;
+    g->handles_free = h;
+}
+
+// returns the handle of el, or SPATIAL_HASH_NO_HANDLE if it isn't there
+static SpatialHashHandle spatial_hash_find(SpatialHash *g, void *el, qt_equal_fn equal) {
+    struct spatial_hash_range_t r = spatial_hash_range(g, (AABB *)el);
+    struct spatial_hash_cell_t *c = spatial_hash_cell_find(g, r.x1, r.y1);
+    for (size_t i = 0; c && i < c->len; i++) {
+        SpatialHashHandle h = c->entries[i].handle;
+        if (equal(el, spatial_hash_at(g, g->handles[h].slot)))
+            return h;
+    }
+    assert(!"element was not found in spatial hash");
+    return SPATIAL_HASH_NO_HANDLE;
+}
+
+void spatial_hash_move(SpatialHash *g, void *el, qt_equal_fn equal, AABB *new_bounds, void *buf) {
+    SpatialHashHandle h = spatial_hash_find(g, el, equal);
+    if (h == SPATIAL_HASH_NO_HANDLE) return;
+    spatial_hash_move_handle(g, h, new_bounds, buf);
+}
+
+void spatial_hash_remove(SpatialHash *g, void *el, qt_equal_fn equal, void *buf) {
+    SpatialHashHandle h = spatial_hash_find(g, el, equal);
+    if (h == SPATIAL_HASH_NO_HANDLE) return;
+    spatial_hash_remove_handle(g, h, buf);
+}
+
+void spatial_hash_traverse(SpatialHash *g, AABB *box, qt_callback_fn callback, void *cb_data) {
+    struct spatial_hash_range_t r = spatial_hash_range(g, box);
+    for (int y = r.y1; y <= r.y2; y++) {
+        for (int x = r.x1; x <= r.x2; x++) {
+            const struct spatial_hash_cell_t *c = spatial_hash_cell_find(g, x, y);
+            for (size_t i = 0; c && i < c->len; i++) {
+                const struct spatial_hash_entry_t *e = &c->entries[i];
+                if (!aabb_intersect(box, &e->box))
+                    continue;
+                // an element in several cells is only reported from the
+                // first cell it shares with the query
+                struct spatial_hash_range_t er = spatial_hash_range(g, &e->box);
+                if ((er.x1 > r.x1 ? er.x1 : r.x1) != x || (er.y1 > r.y1 ? er.y1 : r.y1) != y)
+                    continue;
+                callback(cb_data, spatial_hash_at(g, g->handles[e->handle].slot));
+            }
+        }
+    }
+}
+
+// aabb tree impl
+
+#define AABB_TREE_NULL AABB_TREE_NO_HANDLE
+
+struct aabb_tree_node_t {
+    AABB box; // grown by the margin for leaves
+    size_t parent; // or next unused node
+    size_t child[2]; // AABB_TREE_NULL for leaves
+    size_t slot; // index into data, for leaves
+    int height; // 0 for leaves
+};
+
+static inline bool aabb_tree_is_leaf(const struct aabb_tree_node_t *n) {
+    return n->child[0] == AABB_TREE_NULL;
+}
+
+static inline void aabb_tree_union(AABB *out, const AABB *a, const AABB *b) {
+    out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+    out->x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+    out->y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+}
+
+// the 2D equivalent of surface area
+static inline int64_t aabb_tree_perimeter(const AABB *a) {
+    return 2 * ((int64_t)a->x2 - a->x1 + (int64_t)a->y2 - a->y1);
+}
+
+static inline void *aabb_tree_at(const AABBTree *t, size_t i) {
+    return (char *)t->data + i * t->el_size;
+}
+
+static size_t aabb_tree_node_new(AABBTree *t) {
+    size_t i = t->nodes_free;
+    if (i != AABB_TREE_NULL) {
+        t->nodes_free = t->nodes[i].parent;
+    } else {
+        if (t->nodes_len == t->nodes_cap) {
+            t->nodes_cap = t->nodes_cap ? t->nodes_cap * 2 : 16;
+            t->nodes = realloc(t->nodes, t->nodes_cap * sizeof *t->nodes);
+        }
+        i = t->nodes_len++;
+    }
+    struct aabb_tree_node_t *n = &t->nodes[i];
+    n->parent = AABB_TREE_NULL;
+    n->child[0] = AABB_TREE_NULL;
+    n->child[1] = AABB_TREE_NULL;
+    n->height = 0;
+    return i;
+}
+
+static void aabb_tree_node_delete(AABBTree *t, size_t i) {
+    t->nodes[i].height = -1;
+    t->nodes[i].parent = t->nodes_free;
+    t->nodes_free = i;
+}
+
+// recomputes the box and height of internal node i from its children
+static inline void aabb_tree_refit(AABBTree *t, size_t i) {
+    struct aabb_tree_node_t *n = &t->nodes[i];
+    const struct aabb_tree_node_t *a = &t->nodes[n->child[0]], *b = &t->nodes[n->child[1]];
+    aabb_tree_union(&n->box, &a->box, &b->box);
+    n->height = 1 + (a->height > b->height ? a->height : b->height);
+}
+
+// swaps a child of a with the grandchild under a's other child that
+// shrinks that child the most, if any does. this is what keeps the tree
+// good when leaves are inserted in an unhelpful order.
+static void aabb_tree_rotate(AABBTree *t, size_t ia) {
+    struct aabb_tree_node_t *a = &t->nodes[ia];
+    if (a->height < 2)
+        return;
+    int64_t best_gain = 0;
+    int best_k = -1, best_j = -1;
+    for (int k = 0; k < 2; k++) {
+        const struct aabb_tree_node_t *x = &t->nodes[a->child[k]], *p = &t->nodes[a->child[!k]];
+        if (aabb_tree_is_leaf(p))
+            continue;
+        int64_t base = aabb_tree_perimeter(&p->box);
+        for (int j = 0; j < 2; j++) {
+            // p's box after x takes the place of its child j
+            AABB box;
+            aabb_tree_union(&box, &x->box, &t->nodes[p->child[!j]].box);
+            int64_t gain = base - aabb_tree_perimeter(&box);
+            if (gain > best_gain) {
+                best_gain = gain;
+                best_k = k;
+                best_j = j;
+            }
+        }
+    }
+    if (best_k < 0)
+        return;
+    size_t ix = a->child[best_k], ip = a->child[!best_k];
+    struct aabb_tree_node_t *p = &t->nodes[ip];
+    size_t iy = p->child[best_j];
+    a->child[best_k] = iy;
+    t->nodes[iy].parent = ia;
+    p->child[best_j] = ix;
+    t->nodes[ix].parent = ip;
+    aabb_tree_refit(t, ip);
+    aabb_tree_refit(t, ia);
+}
+
+// refits and rotates from i up to the root
+static void aabb_tree_fix_up(AABBTree *t, size_t i) {
+    while (i != AABB_TREE_NULL) {
+        aabb_tree_refit(t, i);
+        aabb_tree_rotate(t, i);
+        i = t->nodes[i].parent;
+    }
+}
+
+// returns the node that gives the smallest total perimeter when the leaf
+// is paired with it, searching branch and bound
+static size_t aabb_tree_best_sibling(AABBTree *t, const AABB *box) {
+    int64_t leaf_cost = aabb_tree_perimeter(box);
+    size_t i = t->root;
+    AABB combined;
+    aabb_tree_union(&combined, &t->nodes[i].box, box);
+    // direct is the perimeter of the new parent if paired with node i.
+    // inherited is how much the nodes above i grow.
+    int64_t base = aabb_tree_perimeter(&t->nodes[i].box),
+            direct = aabb_tree_perimeter(&combined), inherited = 0,
+            best_cost = direct;
+    size_t best = i;
+    while (!aabb_tree_is_leaf(&t->nodes[i])) {
+        const struct aabb_tree_node_t *n = &t->nodes[i];
+        int64_t cost = direct + inherited;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = i;
+        }
+        inherited += direct - base;
+        int64_t child_direct[2], child_base[2], lower[2];
+        bool leaf[2];
+        for (int k = 0; k < 2; k++) {
+            const struct aabb_tree_node_t *c = &t->nodes[n->child[k]];
+            aabb_tree_union(&combined, &c->box, box);
+            child_direct[k] = aabb_tree_perimeter(&combined);
+            child_base[k] = aabb_tree_perimeter(&c->box);
+            leaf[k] = aabb_tree_is_leaf(c);
+            if (leaf[k]) {
+                cost = child_direct[k] + inherited;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = n->child[k];
+                }
+                lower[k] = INT64_MAX;
+            } else {
+                // nothing under c can cost less than this
+                int64_t shrink = leaf_cost - child_base[k];
+                lower[k] = inherited + child_direct[k] + (shrink < 0 ? shrink : 0);
+            }
+        }
+        if (leaf[0] && leaf[1])
+            break;
+        if (best_cost <= lower[0] && best_cost <= lower[1])
+            break;
+        int k = lower[1] < lower[0];
+        if (lower[0] == lower[1]) {
+            // go towards the closer center on a tie
+            int64_t d[2];
+            for (int m = 0; m < 2; m++) {
+                const AABB *cb = &t->nodes[n->child[m]].box;
+                int64_t dx = ((int64_t)cb->x1 + cb->x2) - ((int64_t)box->x1 + box->x2),
+                        dy = ((int64_t)cb->y1 + cb->y2) - ((int64_t)box->y1 + box->y2);
+                d[m] = dx * dx + dy * dy;
+            }
+            k = d[1] < d[0];
+        }
+        i = n->child[k];
+        base = child_base[k];
+        direct = child_direct[k];
+    }
+    return best;
+}
+
+static void aabb_tree_insert_leaf(AABBTree *t, size_t leaf) {
+    if (t->root == AABB_TREE_NULL) {
+        t->root = leaf;
+        t->nodes[leaf].parent = AABB_TREE_NULL;
+        return;
+    }
+    size_t sibling = aabb_tree_best_sibling(t, &t->nodes[leaf].box),
+           old_parent = t->nodes[sibling].parent,
+           parent = aabb_tree_node_new(t);
+    struct aabb_tree_node_t *p = &t->nodes[parent];
+    p->parent = old_parent;
+    p->child[0] = sibling;
+    p->child[1] = leaf;
+    t->nodes[sibling].parent = parent;
+    t->nodes[leaf].parent = parent;
+    if (old_parent == AABB_TREE_NULL) {
+        t->root = parent;
+    } else {
+        struct aabb_tree_node_t *op = &t->nodes[old_parent];
+        op->child[op->child[0] == sibling ? 0 : 1] = parent;
+    }
+    aabb_tree_fix_up(t, parent);
+}
+
+static void aabb_tree_remove_leaf(AABBTree *t, size_t leaf) {
+    if (leaf == t->root) {
+        t->root = AABB_TREE_NULL;
+        return;
+    }
+    size_t parent = t->nodes[leaf].parent, grandparent = t->nodes[parent].parent;
+    struct aabb_tree_node_t *p = &t->nodes[parent];
+    size_t sibling = p->child[p->child[0] == leaf ? 1 : 0];
+    // the sibling takes the place of the parent
+    t->nodes[sibling].parent = grandparent;
+    aabb_tree_node_delete(t, parent);
+    if (grandparent == AABB_TREE_NULL) {
+        t->root = sibling;
+        return;
+    }
+    struct aabb_tree_node_t *g = &t->nodes[grandparent];
+    g->child[g->child[0] == parent ? 0 : 1] = sibling;
+    aabb_tree_fix_up(t, grandparent);
+}
+
+static inline void aabb_tree_fatten(const AABBTree *t, AABB *out, const AABB *box) {
+    aabb_init(out, box->x1 - t->margin, box->y1 - t->margin, box->x2 + t->margin, box->y2 + t->margin);
+}
+
+void aabb_tree_init(AABBTree *t, int margin, size_t el_size) {
+    assert(margin >= 0 && el_size >= sizeof(AABB));
+    t->nodes = NULL;
+    t->nodes_len = 0;
+    t->nodes_cap = 0;
+    t->nodes_free = AABB_TREE_NULL;
+    t->root = AABB_TREE_NULL;
+    t->margin = margin;
+    t->el_size = el_size;
+    t->data = NULL;
+    t->data_handles = NULL;
+    t->data_len = 0;
+    t->data_cap = 0;
+}
+
+void aabb_tree_free(AABBTree *t) {
+    free(t->nodes);
+    free(t->data);
+    free(t->data_handles);
+}
+
+AABBTreeHandle aabb_tree_insert(AABBTree *t, void *el) {
+    size_t leaf = aabb_tree_node_new(t);
+    if (t->data_len == t->data_cap) {
+        t->data_cap = t->data_cap ? t->data_cap * 2 : 16;
+        t->data = realloc(t->data, t->data_cap * t->el_size);
+        t->data_handles = realloc(t->data_handles, t->data_cap * sizeof *t->data_handles);
+    }
+    memcpy(aabb_tree_at(t, t->data_len), el, t->el_size);
+    t->data_handles[t->data_len] = leaf;
+    t->nodes[leaf].slot = t->data_len++;
+    aabb_tree_fatten(t, &t->nodes[leaf].box, (AABB *)el);
+    aabb_tree_insert_leaf(t, leaf);
+    return leaf;
+}
+
+void *aabb_tree_get(AABBTree *t, AABBTreeHandle h) {
+    assert(h < t->nodes_len && t->nodes[h].height == 0);
+    return aabb_tree_at(t, t->nodes[h].slot);
+}
+
+void aabb_tree_move_handle(AABBTree *t, AABBTreeHandle h, const AABB *new_bounds, void *buf) {
+    void *el = aabb_tree_get(t, h);
+    memcpy(el, new_bounds, sizeof(AABB));
+    if (!aabb_contains(&t->nodes[h].box, new_bounds)) {
+        aabb_tree_remove_leaf(t, h);
+        aabb_tree_fatten(t, &t->nodes[h].box, new_bounds);
+        aabb_tree_insert_leaf(t, h);
+    }
+    if (buf)
+        memcpy(buf, el, t->el_size);
+}
+
+void aabb_tree_remove_handle(AABBTree *t, AABBTreeHandle h, void *buf) {
+    void *el = aabb_tree_get(t, h);
+    if (buf)
+        memcpy(buf, el, t->el_size);
+    aabb_tree_remove_leaf(t, h);
+    // fill the hole with the last element
+    size_t slot = t->nodes[h].slot, last = --t->data_len;
+    if (slot != last) {
+        memcpy(el, aabb_tree_at(t, last), t->el_size);
+        t->data_handles[slot] = t->data_handles[last];
+        t->nodes[t->data_handles[slot]].slot = slot;
+    }
+    aabb_tree_node_delete(t, h);
+}
+
+// a stack that starts out on the C stack and moves to the heap if the
+// tree is unusually deep
+struct aabb_tree_stack_t {
+    size_t *items;
+    size_t len;
+    size_t cap;
+    size_t local[64];
+};
+
+static inline void aabb_tree_stack_init(struct aabb_tree_stack_t *s) {
+    s->items = s->local;
+    s->len = 0;
+    s->cap = sizeof s->local / sizeof s->local[0];
+}
+
+static inline void aabb_tree_stack_push(struct aabb_tree_stack_t *s, size_t i) {
+    if (s->len == s->cap) {
+        size_t *items = malloc(2 * s->cap * sizeof *items);
+        memcpy(items, s->items, s->len * sizeof *items);
+        if (s->items != s->local)
+            free(s->items);
+        s->items = items;
+        s->cap *= 2;
+    }
+    s->items[s->len++] = i;
+}
+
+static inline void aabb_tree_stack_free(struct aabb_tree_stack_t *s) {
+    if (s->items != s->local)
+        free(s->items);
+}
+
+// returns the handle of el, or AABB_TREE_NO_HANDLE if it isn't there
+static AABBTreeHandle aabb_tree_find(AABBTree *t, void *el, qt_equal_fn equal) {
+    const AABB *box = (const AABB *)el;
+    AABBTreeHandle found = AABB_TREE_NO_HANDLE;
+    struct aabb_tree_stack_t stack;
+    aabb_tree_stack_init(&stack);
+    if (t->root != AABB_TREE_NULL)
+        aabb_tree_stack_push(&stack, t->root);
+    while (stack.len && found == AABB_TREE_NO_HANDLE) {
+        const struct aabb_tree_node_t *n = &t->nodes[stack.items[--stack.len]];
+        // every node above a leaf contains its element
+        if (!aabb_contains(&n->box, box))
+            continue;
+        if (aabb_tree_is_leaf(n)) {
+            if (equal(el, aabb_tree_at(t, n->slot)))
+                found = (AABBTreeHandle)(n - t->nodes);
+        } else {
+            aabb_tree_stack_push(&stack, n->child[0]);
+            aabb_tree_stack_push(&stack, n->child[1]);
+        }
+    }
+    aabb_tree_stack_free(&stack);
+    return found;
+}
+
+void aabb_tree_move(AABBTree *t, void *el, qt_equal_fn equal, const AABB *new_bounds, void *buf) {
+    AABBTreeHandle h = aabb_tree_find(t, el, equal);
+    if (h == AABB_TREE_NO_HANDLE) return;
+    aabb_tree_move_handle(t, h, new_bounds, buf);
+}
+
+void aabb_tree_remove(AABBTree *t, void *el, qt_equal_fn equal, void *buf) {
+    AABBTreeHandle h = aabb_tree_find(t, el, equal);
+    if (h == AABB_TREE_NO_HANDLE) return;
+    aabb_tree_remove_handle(t, h, buf);
+}
+
+void aabb_tree_traverse(AABBTree *t, AABB *box, qt_callback_fn callback, void *cb_data) {
+    struct aabb_tree_stack_t stack;
+    aabb_tree_stack_init(&stack);
+    if (t->root != AABB_TREE_NULL)
+        aabb_tree_stack_push(&stack, t->root);
+    while (stack.len) {
+        const struct aabb_tree_node_t *n = &t->nodes[stack.items[--stack.len]];
+        if (!aabb_intersect(&n->box, box))
+            continue;
+        if (aabb_tree_is_leaf(n)) {
+            // the leaf's box is bigger than the element's
+            void *el = aabb_tree_at(t, n->slot);
+            if (aabb_intersect((AABB *)el, box))
+                callback(cb_data, el);
+        } else {
+            aabb_tree_stack_push(&stack, n->child[1]);
+            aabb_tree_stack_push(&stack, n->child[0]);
+        }
+    }
+    aabb_tree_stack_free(&stack);
+}
+
+void *aabb_tree_raycast(AABBTree *t, double x, double y, double dx, double dy,
+                        int width, int height, double *t_hit, AABBEdge *edge) {
+    double idx = 1.0 / dx, idy = 1.0 / dy, best = 1.0;
+    void *hit = NULL;
+    struct aabb_tree_stack_t stack;
+    aabb_tree_stack_init(&stack);
+    if (t->root != AABB_TREE_NULL && aabb_ray_enter(&t->nodes[t->root].box, x, y, idx, idy, width, height, best) >= 0.0)
+        aabb_tree_stack_push(&stack, t->root);
+    while (stack.len) {
+        const struct aabb_tree_node_t *n = &t->nodes[stack.items[--stack.len]];
+        if (aabb_tree_is_leaf(n)) {
+            void *el = aabb_tree_at(t, n->slot);
+            AABBEdge e;
+            double th = aabb_sweep((AABB *)el, x, y, idx, idy, width, height, &e);
+            if (th >= 0.0 && th < best) {
+                best = th;
+                hit = el;
+                if (edge)
+                    *edge = e;
+            }
+            continue;
+        }
+        // push the farther child first so the nearer one is tried first
+        // and the closer hit it finds can prune the other
+        double enter[2];
+        for (int k = 0; k < 2; k++)
+            enter[k] = aabb_ray_enter(&t->nodes[n->child[k]].box, x, y, idx, idy, width, height, best);
+        int near = enter[1] >= 0.0 && (enter[0] < 0.0 || enter[1] < enter[0]);
+        if (enter[!near] >= 0.0)
+            aabb_tree_stack_push(&stack, n->child[!near]);
+        if (enter[near] >= 0.0)
+            aabb_tree_stack_push(&stack, n->child[near]);
+    }
+    aabb_tree_stack_free(&stack);
+    if (t_hit)
+        *t_hit = hit ? best : -1.0;
+    return hit;
+}
+
+// sweep and prune impl
+
+// an end is the coordinate with its sign bit flipped, so ends sort as
+// unsigned integers, then a bit that's set for minimums, then the
+// handle. maximums come before minimums at the same coordinate, since
+// boxes that only touch don't overlap.
+#define SWEEP_PRUNE_MIN_BIT ((uint64_t)1 << 31)
+
+struct sweep_prune_object_t {
+    AABB box;
+    uint32_t pos[2][2]; // where the min and max ends are along x and y
+    size_t next; // next unused handle, or place in the active list
+    bool used;
+    bool pending; // inserted since the last update
+    bool dead; // removed since the last update
+};
+
+static inline uint64_t sweep_prune_end(int value, bool is_min, SweepPruneHandle h) {
+    return (uint64_t)((uint32_t)value ^ 0x80000000u) << 32 | (is_min ? SWEEP_PRUNE_MIN_BIT : 0) | h;
+}
+
+static inline SweepPruneHandle sweep_prune_end_handle(uint64_t end) {
+    return (SweepPruneHandle)(end & (SWEEP_PRUNE_MIN_BIT - 1));
+}
+
+static inline bool sweep_prune_end_is_min(uint64_t end) {
+    return end & SWEEP_PRUNE_MIN_BIT;
+}
+
+// min and max ends along x, then along y
+static inline void sweep_prune_ends_of(const AABB *box, SweepPruneHandle h, uint64_t out[2][2]) {
+    out[0][0] = sweep_prune_end(box->x1, true, h);
+    out[0][1] = sweep_prune_end(box->x2, false, h);
+    out[1][0] = sweep_prune_end(box->y1, true, h);
+    out[1][1] = sweep_prune_end(box->y2, false, h);
+}
+
+static inline void sweep_prune_place(SweepPrune *sp, int axis, size_t i, uint64_t end) {
+    sp->ends[axis][i] = end;
+    sp->objects[sweep_prune_end_handle(end)].pos[axis][!sweep_prune_end_is_min(end)] = (uint32_t)i;
+}
+
+// pair set
+// keys are the smaller handle in the top half and the larger one in the
+// bottom half, so they're never 0, which marks an empty slot.
+// linear probing with backward shift deletion, at most half full.
+
+static inline uint64_t sweep_prune_pair_key(SweepPruneHandle a, SweepPruneHandle b) {
+    return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+}
+
+static inline size_t sweep_prune_pair_slot(const SweepPrune *sp, uint64_t key) {
+    // fibonacci hashing
+    return (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (sp->pairs_cap - 1);
+}
+
+// returns false if it was already there
+static bool sweep_prune_pair_insert(SweepPrune *sp, uint64_t key) {
+    if (2 * (sp->pairs_len + 1) > sp->pairs_cap) {
+        uint64_t *old = sp->pairs;
+        size_t old_cap = sp->pairs_cap;
+        sp->pairs_cap = old_cap ? old_cap * 2 : 64;
+        sp->pairs = calloc(sp->pairs_cap, sizeof(uint64_t));
+        sp->pairs_len = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i])
+                sweep_prune_pair_insert(sp, old[i]);
+        }
+        free(old);
+    }
+    size_t i = sweep_prune_pair_slot(sp, key);
+    for (; sp->pairs[i]; i = (i + 1) & (sp->pairs_cap - 1)) {
+        if (sp->pairs[i] == key)
+            return false;
+    }
+    sp->pairs[i] = key;
+    sp->pairs_len++;
+    return true;
+}
+
+static void sweep_prune_pair_add(SweepPrune *sp, SweepPruneHandle a, SweepPruneHandle b) {
+    uint64_t key = sweep_prune_pair_key(a, b);
+    if (sweep_prune_pair_insert(sp, key) && sp->added)
+        sp->added(sp->cb_data, (SweepPruneHandle)(key >> 32), (SweepPruneHandle)(key & 0xFFFFFFFFu));
+}
+
+static void sweep_prune_pair_remove(SweepPrune *sp, SweepPruneHandle a, SweepPruneHandle b) {
+    if (!sp->pairs_len)
+        return;
+    uint64_t key = sweep_prune_pair_key(a, b);
+    size_t mask = sp->pairs_cap - 1, i = sweep_prune_pair_slot(sp, key);
+    while (sp->pairs[i] != key) {
+        if (!sp->pairs[i])
+            return;
+        i = (i + 1) & mask;
+    }
+    // shift back entries that were pushed past the removed one
+    for (size_t j = (i + 1) & mask; sp->pairs[j]; j = (j + 1) & mask) {
+        size_t home = sweep_prune_pair_slot(sp, sp->pairs[j]);
+        // move it unless its home is in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            sp->pairs[i] = sp->pairs[j];
+            i = j;
+        }
+    }
+    sp->pairs[i] = 0;
+    sp->pairs_len--;
+    if (sp->removed)
+        sp->removed(sp->cb_data, (SweepPruneHandle)(key >> 32), (SweepPruneHandle)(key & 0xFFFFFFFFu));
+}
+
+void sweep_prune_init(SweepPrune *sp, sweep_prune_pair_fn added, sweep_prune_pair_fn removed, void *cb_data) {
+    sp->ends[0] = NULL;
+    sp->ends[1] = NULL;
+    sp->ends_len = 0;
+    sp->ends_cap = 0;
+    sp->objects = NULL;
+    sp->objects_len = 0;
+    sp->objects_cap = 0;
+    sp->objects_free = SIZE_MAX;
+    sp->pending = NULL;
+    sp->pending_len = 0;
+    sp->pending_cap = 0;
+    sp->dead_len = 0;
+    sp->pairs = NULL;
+    sp->pairs_len = 0;
+    sp->pairs_cap = 0;
+    sp->added = added;
+    sp->removed = removed;
+    sp->cb_data = cb_data;
+}
+
+void sweep_prune_free(SweepPrune *sp) {
+    free(sp->ends[0]);
+    free(sp->ends[1]);
+    free(sp->objects);
+    free(sp->pending);
+    free(sp->pairs);
+}
+
+SweepPruneHandle sweep_prune_insert(SweepPrune *sp, const AABB *box) {
+    SweepPruneHandle h = sp->objects_free;
+    if (h != SIZE_MAX) {
+        sp->objects_free = sp->objects[h].next;
+    } else {
+        assert(sp->objects_len < SWEEP_PRUNE_MAX_OBJECTS);
+        if (sp->objects_len == sp->objects_cap) {
+            sp->objects_cap = sp->objects_cap ? sp->objects_cap * 2 : 16;
+            sp->objects = realloc(sp->objects, sp->objects_cap * sizeof *sp->objects);
+        }
+        h = sp->objects_len++;
+    }
+    struct sweep_prune_object_t *o = &sp->objects[h];
+    o->box = *box;
+    o->used = true;
+    o->pending = true;
+    o->dead = false;
+    if (sp->pending_len == sp->pending_cap) {
+        sp->pending_cap = sp->pending_cap ? sp->pending_cap * 2 : 16;
+        sp->pending = realloc(sp->pending, sp->pending_cap * sizeof *sp->pending);
+    }
+    sp->pending[sp->pending_len++] = h;
+    return h;
+}
+
+const AABB *sweep_prune_get(SweepPrune *sp, SweepPruneHandle h) {
+    assert(h < sp->objects_len && sp->objects[h].used && !sp->objects[h].dead);
+    return &sp->objects[h].box;
+}
+
+static int sweep_prune_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// takes out removed objects, their ends and their pairs
+static void sweep_prune_sweep_dead(SweepPrune *sp) {
+    uint64_t *keep = malloc(sp->pairs_len * sizeof(uint64_t) + 1);
+    size_t kept = 0;
+    for (size_t i = 0; i < sp->pairs_cap; i++) {
+        uint64_t key = sp->pairs[i];
+        if (!key) continue;
+        SweepPruneHandle a = (SweepPruneHandle)(key >> 32), b = (SweepPruneHandle)(key & 0xFFFFFFFFu);
+        if (!sp->objects[a].dead && !sp->objects[b].dead)
+            keep[kept++] = key;
+        else if (sp->removed)
+            sp->removed(sp->cb_data, a, b);
+        sp->pairs[i] = 0;
+    }
+    sp->pairs_len = 0;
+    for (size_t i = 0; i < kept; i++)
+        sweep_prune_pair_insert(sp, keep[i]);
+    free(keep);
+    for (int axis = 0; axis < 2; axis++) {
+        uint64_t *ends = sp->ends[axis];
+        size_t out = 0;
+        for (size_t i = 0; i < sp->ends_len; i++) {
+            if (!sp->objects[sweep_prune_end_handle(ends[i])].dead)
+                sweep_prune_place(sp, axis, out++, ends[i]);
+        }
+        assert(out == sp->ends_len - 2 * sp->dead_len);
+    }
+    sp->ends_len -= 2 * sp->dead_len;
+    for (SweepPruneHandle h = 0; h < sp->objects_len; h++) {
+        struct sweep_prune_object_t *o = &sp->objects[h];
+        if (!o->dead) continue;
+        o->dead = false;
+        o->used = false;
+        o->next = sp->objects_free;
+        sp->objects_free = h;
+    }
+    sp->dead_len = 0;
+}
+
+// removes h from the active list it's in
+static inline void sweep_prune_deactivate(SweepPrune *sp, SweepPruneHandle *active, size_t *len, SweepPruneHandle h) {
+    SweepPruneHandle last = active[--*len];
+    active[sp->objects[h].next] = last;
+    sp->objects[last].next = sp->objects[h].next;
+}
+
+// merges the ends of pending objects in and finds their pairs
+static void sweep_prune_add_pending(SweepPrune *sp) {
+    size_t n = sp->ends_len, p = sp->pending_len;
+    if (n + 2 * p > sp->ends_cap) {
+        while (n + 2 * p > sp->ends_cap)
+            sp->ends_cap = sp->ends_cap ? sp->ends_cap * 2 : 32;
+        for (int axis = 0; axis < 2; axis++)
+            sp->ends[axis] = realloc(sp->ends[axis], sp->ends_cap * sizeof(uint64_t));
+    }
+    uint64_t *added = malloc(2 * p * sizeof(uint64_t));
+    for (int axis = 0; axis < 2; axis++) {
+        for (size_t k = 0; k < p; k++) {
+            uint64_t ends[2][2];
+            sweep_prune_ends_of(&sp->objects[sp->pending[k]].box, sp->pending[k], ends);
+            added[2 * k] = ends[axis][0];
+            added[2 * k + 1] = ends[axis][1];
+        }
+        qsort(added, 2 * p, sizeof(uint64_t), sweep_prune_compare);
+        // merge from the back so nothing is overwritten before it's moved
+        uint64_t *ends = sp->ends[axis];
+        size_t i = n, j = 2 * p, k = n + 2 * p;
+        while (j) {
+            if (i && ends[i - 1] > added[j - 1])
+                sweep_prune_place(sp, axis, --k, ends[--i]);
+            else
+                sweep_prune_place(sp, axis, --k, added[--j]);
+        }
+    }
+    free(added);
+    sp->ends_len = n + 2 * p;
+    // sweep along x, keeping the objects whose min has been passed but
+    // not their max. new objects are checked against everything that's
+    // active, and old ones only against new ones.
+    size_t objects = sp->ends_len / 2;
+    SweepPruneHandle *active = malloc(2 * objects * sizeof(SweepPruneHandle)),
+                     *active_new = active + objects;
+    size_t active_len = 0, active_new_len = 0;
+    for (size_t i = 0; i < sp->ends_len; i++) {
+        uint64_t end = sp->ends[0][i];
+        SweepPruneHandle h = sweep_prune_end_handle(end);
+        struct sweep_prune_object_t *o = &sp->objects[h];
+        if (!sweep_prune_end_is_min(end)) {
+            if (o->pending)
+                sweep_prune_deactivate(sp, active_new, &active_new_len, h);
+            else
+                sweep_prune_deactivate(sp, active, &active_len, h);
+            continue;
+        }
+        for (size_t k = 0; k < active_new_len; k++) {
+            if (aabb_intersect(&o->box, &sp->objects[active_new[k]].box))
+                sweep_prune_pair_add(sp, h, active_new[k]);
+        }
+        if (o->pending) {
+            for (size_t k = 0; k < active_len; k++) {
+                if (aabb_intersect(&o->box, &sp->objects[active[k]].box))
+                    sweep_prune_pair_add(sp, h, active[k]);
+            }
+            o->next = active_new_len;
+            active_new[active_new_len++] = h;
+        } else {
+            o->next = active_len;
+            active[active_len++] = h;
+        }
+    }
+    assert(active_len == 0 && active_new_len == 0);
+    free(active);
+    for (size_t k = 0; k < p; k++)
+        sp->objects[sp->pending[k]].pending = false;
+    sp->pending_len = 0;
+}
+
+void sweep_prune_update(SweepPrune *sp) {
+    if (sp->dead_len)
+        sweep_prune_sweep_dead(sp);
+    if (sp->pending_len)
+        sweep_prune_add_pending(sp);
+}
+
+// moves the end at i to where it belongs along axis, reporting the
+// pairs it starts or stops overlapping on the way.
+// a min passing a max starts an overlap along this axis, and it's a
+// pair if the boxes overlap along the other one too. a max passing a
+// min ends one.
+static void sweep_prune_sift(SweepPrune *sp, int axis, size_t i) {
+    uint64_t *ends = sp->ends[axis], end = ends[i];
+    SweepPruneHandle h = sweep_prune_end_handle(end);
+    const AABB *box = &sp->objects[h].box;
+    bool is_min = sweep_prune_end_is_min(end);
+    for (; i > 0 && ends[i - 1] > end; i--) {
+        uint64_t other = ends[i - 1];
+        SweepPruneHandle o = sweep_prune_end_handle(other);
+        if (is_min != sweep_prune_end_is_min(other) && o != h) {
+            if (is_min) {
+                if (aabb_intersect(box, &sp->objects[o].box))
+                    sweep_prune_pair_add(sp, h, o);
+            } else {
+                sweep_prune_pair_remove(sp, h, o);
+            }
+        }
+        sweep_prune_place(sp, axis, i, other);
+    }
+    for (; i + 1 < sp->ends_len && ends[i + 1] < end; i++) {
+        uint64_t other = ends[i + 1];
+        SweepPruneHandle o = sweep_prune_end_handle(other);
+        if (is_min != sweep_prune_end_is_min(other) && o != h) {
+            if (!is_min) {
+                if (aabb_intersect(box, &sp->objects[o].box))
+                    sweep_prune_pair_add(sp, h, o);
+            } else {
+                sweep_prune_pair_remove(sp, h, o);
+            }
+        }
+        sweep_prune_place(sp, axis, i, other);
+    }
+    sweep_prune_place(sp, axis, i, end);
+}
+
+void sweep_prune_move(SweepPrune *sp, SweepPruneHandle h, const AABB *box) {
+    sweep_prune_update(sp);
+    assert(h < sp->objects_len && sp->objects[h].used);
+    struct sweep_prune_object_t *o = &sp->objects[h];
+    uint64_t from[2][2], to[2][2];
+    sweep_prune_ends_of(&o->box, h, from);
+    sweep_prune_ends_of(box, h, to);
+    o->box = *box;
+    for (int axis = 0; axis < 2; axis++) {
+        // moving the min first when going down and the max first when
+        // going up keeps the min before the max
+        int first = to[axis][0] < from[axis][0] ? 0 : 1;
+        for (int k = first, n = 0; n < 2; k ^= 1, n++) {
+            if (to[axis][k] == from[axis][k]) continue;
+            size_t i = o->pos[axis][k];
+            sp->ends[axis][i] = to[axis][k];
+            sweep_prune_sift(sp, axis, i);
+        }
+    }
+}
+
+void sweep_prune_remove(SweepPrune *sp, SweepPruneHandle h) {
+    assert(h < sp->objects_len && sp->objects[h].used && !sp->objects[h].dead);
+    // removals are batched like inserts, but pending objects are
+    // sorted in first so they don't need handling everywhere
+    if (sp->objects[h].pending)
+        sweep_prune_add_pending(sp);
+    sp->objects[h].dead = true;
+    sp->dead_len++;
+}
+
+size_t sweep_prune_pairs(SweepPrune *sp, SweepPrunePair *out, size_t max) {
+    sweep_prune_update(sp);
+    size_t n = 0;
+    for (size_t i = 0; i < sp->pairs_cap && n < max; i++) {
+        if (!sp->pairs[i]) continue;
+        out[n].a = (SweepPruneHandle)(sp->pairs[i] >> 32);
+        out[n].b = (SweepPruneHandle)(sp->pairs[i] & 0xFFFFFFFFu);
+        n++;
     }
+    return sp->pairs_len;
 }
@@ -1,6 +1,5 @@
 #include "graphics.h"
 #include "collision.h"
-#include <assert.h>
 #include <math.h>
 
 const unsigned int WIDTH = 800, HEIGHT = 800;
@@ -80,6 +79,12 @@ int main(void) {
         graphics_terminate();
         return EXIT_FAILURE;
     }
+    // solid tiles for collision
+    Tilemap tilemap;
+    tilemap_init(&tilemap, map_x, map_y, map_width, map_height, tile_width, tile_height);
+    for (int y = 0; y < map_height; y++)
+        for (int x = 0; x < map_width; x++)
+            tilemap_set(&tilemap, x, y, map[y][x] != 8);
     // main loop
     while (!graphics_window_closed(window)) {
         graphics_poll_events();
@@ -116,59 +121,27 @@ int main(void) {
         // update position and velocity in y
         player_delta[1] += 0.5 * player_acc[1] * timestep * timestep + player_vel[1] * timestep;
         player_vel[1] += player_acc[1] * timestep;
-        // set to true if we collide with north edge
-        player_onground = false;
-        for (int i = 0; i < 2; i++) {
-            // collide up to two times
-            AABB bounds;
-            aabb_init_bounding(&bounds, player_pos[0], player_pos[1], player_delta[0], player_delta[1], player_width, player_height);
-            int start_x = bounds.x1 > map_x ? (bounds.x1 - map_x) / (int)tile_width : 0,
-                start_y = bounds.y1 > map_y ? (bounds.y1 - map_y) / (int)tile_height : 0,
-                end_x = bounds.x2 / (int)tile_width < map_width + map_x ? (bounds.x2 - map_x) / (int)tile_width : (map_width - 1),
-                end_y = bounds.y2 / (int)tile_height < map_height + map_y ? (bounds.y2 - map_y) / (int)tile_height : (map_height - 1);
-            double t = 2.0;
-            int edge;
-            int new_pos;
-            for (int y = start_y; y <= end_y; y++) {
-                for (int x = start_x; x <= end_x; x++) {
-                    if (map[y][x] == 8) continue;
-                    double cur_t;
-                    AABBEdge cur_edge;
-                    AABB rect;
-                    aabb_init(&rect, x * tile_width + map_x, y * tile_height + map_y,
-                                     (x + 1) * tile_width + map_x, (y + 1) * tile_height + map_y);
-                    cur_t = aabb_sweep(&rect, player_pos[0], player_pos[1], 1.0 / player_delta[0], 1.0 / player_delta[1], player_width, player_height, &cur_edge);
-                    if (cur_t >= 0 && cur_t < t) {
-                        t = cur_t;
-                        edge = cur_edge;
-                        union aabb_hack_t {
-                            AABB aabb;
-                            int coords[4];
-                        } *aabb_hack = (void *)&rect;
-                        assert(sizeof *aabb_hack == sizeof rect);
-                        new_pos = aabb_hack->coords[edge] - !(edge >> 1) * (edge & 1 ? player_height : player_width);
-                    }
-                }
-            }
-            if (t >= 0 && t < 1.0) {
-                player_pos[!(edge & 1)] += player_delta[!(edge & 1)] * t;
-                player_pos[edge & 1] = new_pos;
-                player_delta[edge & 1] = 0;
-                player_vel[edge & 1] = 0;
-                player_delta[!(edge & 1)] *= 1.0 - t;
-                if (edge == EDGE_NORTH) player_onground = true;
-            } else {
-                for (int i = 0; i < 2; i++)
-                    player_pos[i] += player_delta[i];
-                break;
-            }
-        }
+        // collide up to two times
+        AABBMover player = {
+            player_pos[0], player_pos[1], player_delta[0], player_delta[1],
+            player_width, player_height, 0,
+        };
+        aabb_solve_tilemap(&tilemap, &player, 1, 2);
+        player_pos[0] = player.x;
+        player_pos[1] = player.y;
+        if (player.contacts & (1u << EDGE_WEST | 1u << EDGE_EAST))
+            player_vel[0] = 0;
+        if (player.contacts & (1u << EDGE_NORTH | 1u << EDGE_SOUTH))
+            player_vel[1] = 0;
+        // true if we collided with a north edge
+        player_onground = player.contacts & (1u << EDGE_NORTH);
         for (int i = 0; i < 2; i++)
             player_data[i] = (int)player_pos[i];
         graphics_draw(window, player_data, 1, player_width, player_height, 0, 0, 1.0f / tex_cols, 1.0f / tex_rows);
         graphics_end_draw(window);
     }
     // cleanup
+    tilemap_free(&tilemap);
     graphics_destroy_window(window);
     graphics_terminate();
     return EXIT_SUCCESS;
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include "test_common.h"
+
+#define TILE_SIZE 16
+#ifndef NUM_BOXES
+#define NUM_BOXES 64
+#endif
+#ifndef NUM_SWEEPS
+#define NUM_SWEEPS 4194304
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+
+// positions and displacements in sixteenths of a pixel, which both
+// doubles and fixed point hold exactly
+struct sweep_t {
+    int x, y, dx, dy;
+    int width, height;
+};
+
+typedef struct sweep_t Sweep;
+
+static void randomize_boxes(AABB *boxes) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        int x1 = (rand() % 64 - 32) * TILE_SIZE, y1 = (rand() % 64 - 32) * TILE_SIZE;
+        aabb_init(&boxes[i], x1, y1, x1 + TILE_SIZE * (1 + rand() % 2), y1 + TILE_SIZE);
+    }
+}
+
+// includes moves along one axis and starting positions on tile edges
+static void randomize_sweep(Sweep *s) {
+    if (rand() % 4 == 0) {
+        s->x = (rand() % 64 - 32) * TILE_SIZE * 16;
+        s->y = (rand() % 64 - 32) * TILE_SIZE * 16;
+    } else {
+        s->x = rand() % (1024 * 16) - 512 * 16;
+        s->y = rand() % (1024 * 16) - 512 * 16;
+    }
+    s->dx = rand() % 4 ? rand() % (1024 * 16 + 1) - 512 * 16 : 0;
+    s->dy = rand() % 4 ? rand() % (1024 * 16 + 1) - 512 * 16 : 0;
+    s->width = rand() % 3 ? 1 + rand() % 24 : 0;
+    s->height = s->width ? 1 + rand() % 24 : 0;
+}
+
+// times are n / d; the numbers are small enough to cross multiply
+struct frac_t {
+    long long n, d;
+};
+
+static bool time_less(struct frac_t a, struct frac_t b) {
+    return a.n * b.d < b.n * a.d;
+}
+
+// a long way past any time that can come up, for moves along one axis
+#define FOREVER (1LL << 40)
+
+static bool axis_exact(int lo, int hi, int v, int dv, int size, struct frac_t *enter, struct frac_t *leave) {
+    long long n1 = (long long)(lo - size) * 16 - v, n2 = (long long)hi * 16 - v;
+    if (dv == 0) {
+        if (!(n1 < 0 && n2 > 0))
+            return false;
+        enter->n = -FOREVER;
+        leave->n = FOREVER;
+        enter->d = leave->d = 1;
+    } else if (dv > 0) {
+        enter->n = n1;
+        leave->n = n2;
+        enter->d = leave->d = dv;
+    } else {
+        enter->n = -n2;
+        leave->n = -n1;
+        enter->d = leave->d = -dv;
+    }
+    return true;
+}
+
+// the exact answer, worked out in sixteenths of a pixel
+static AABBFixed sweep_exact(const AABB *box, const Sweep *s, AABBEdge *edge) {
+    struct frac_t xin, xout, yin, yout;
+    if (!axis_exact(box->x1, box->x2, s->x, s->dx, s->width, &xin, &xout)
+     || !axis_exact(box->y1, box->y2, s->y, s->dy, s->height, &yin, &yout))
+        return -1;
+    bool isy = !time_less(yin, xin);
+    struct frac_t tmin = isy ? yin : xin, tmax = time_less(xout, yout) ? xout : yout;
+    if (!time_less(tmin, tmax) || tmin.n < 0 || tmin.n >= tmin.d)
+        return -1;
+    *edge = isy ? s->dy > 0 ? EDGE_NORTH : EDGE_SOUTH
+                : s->dx > 0 ? EDGE_WEST  : EDGE_EAST;
+    return (AABBFixed)(tmin.n * AABB_FIXED_ONE / tmin.d);
+}
+
+static AABBFixed to_fixed(int sixteenths) {
+    return sixteenths * (AABB_FIXED_ONE / 16);
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB *boxes = malloc(sizeof(AABB) * NUM_BOXES);
+    Sweep *sweeps = malloc(sizeof(Sweep) * NUM_SWEEPS);
+    randomize_boxes(boxes);
+    for (int i = 0; i < NUM_SWEEPS; i++)
+        randomize_sweep(&sweeps[i]);
+    size_t hits = 0, differ = 0;
+    for (int i = 0; i < NUM_SWEEPS; i++) {
+        const Sweep *s = &sweeps[i];
+        const AABB *box = &boxes[i % NUM_BOXES];
+        AABBEdge edge = EDGE_WEST, exact_edge = EDGE_WEST, double_edge = EDGE_WEST;
+        AABBFixed t = aabb_sweep_fixed(box, to_fixed(s->x), to_fixed(s->y), to_fixed(s->dx), to_fixed(s->dy),
+                                       s->width, s->height, &edge);
+        AABBFixed exact = sweep_exact(box, s, &exact_edge);
+        TEST_ASSERT(t == exact && edge == exact_edge);
+        // doubles agree, apart from rounding on the boundaries
+        double d = aabb_sweep(box, s->x / 16.0, s->y / 16.0, 16.0 / s->dx, 16.0 / s->dy,
+                              s->width, s->height, &double_edge);
+        if ((t >= 0) != (d >= 0)) {
+            differ++;
+            continue;
+        }
+        if (t >= 0) {
+            TEST_ASSERT(fabs(d * AABB_FIXED_ONE - t) <= 1.0 + 1e-6);
+            differ += edge != double_edge;
+            hits++;
+        }
+        // the bounds agree too
+        AABB bounds, fixed_bounds;
+        aabb_init_bounding(&bounds, s->x / 16.0, s->y / 16.0, s->dx / 16.0, s->dy / 16.0, s->width, s->height);
+        aabb_init_bounding_fixed(&fixed_bounds, to_fixed(s->x), to_fixed(s->y), to_fixed(s->dx), to_fixed(s->dy),
+                                 s->width, s->height);
+        TEST_ASSERT(memcmp(&bounds, &fixed_bounds, sizeof(AABB)) == 0);
+    }
+    fprintf(stderr, "%zu of %d sweeps hit, %zu differ from doubles.\n", hits, NUM_SWEEPS, differ);
+    clock_t start, end;
+    size_t double_hits = 0, fixed_hits = 0;
+    // begin time sweep
+    start = clock();
+    for (int i = 0; i < NUM_SWEEPS; i++) {
+        const Sweep *s = &sweeps[i];
+        double x = s->x / 16.0, y = s->y / 16.0, dx = s->dx / 16.0, dy = s->dy / 16.0;
+        double_hits += aabb_sweep(&boxes[i % NUM_BOXES], x, y, 1.0 / dx, 1.0 / dy, s->width, s->height, NULL) >= 0;
+    }
+    end = clock();
+    fprintf(stderr, "sweeping %d times with doubles took %.3f ms.\n",
+            NUM_SWEEPS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time sweep
+    // begin time fixed sweep
+    start = clock();
+    for (int i = 0; i < NUM_SWEEPS; i++) {
+        const Sweep *s = &sweeps[i];
+        fixed_hits += aabb_sweep_fixed(&boxes[i % NUM_BOXES], to_fixed(s->x), to_fixed(s->y), to_fixed(s->dx), to_fixed(s->dy),
+                                       s->width, s->height, NULL) >= 0;
+    }
+    end = clock();
+    fprintf(stderr, "sweeping %d times with fixed point took %.3f ms.\n",
+            NUM_SWEEPS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time fixed sweep
+    TEST_ASSERT(fixed_hits <= double_hits + differ && double_hits <= fixed_hits + differ);
+    free(boxes);
+    free(sweeps);
+    return 0;
+}
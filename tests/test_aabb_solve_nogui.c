@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define TILE_SIZE 16
+#define MAP_TILES 64
+#define WIDTH (MAP_TILES * TILE_SIZE)
+#define HEIGHT (MAP_TILES * TILE_SIZE)
+#ifndef NUM_MOVERS
+#define NUM_MOVERS 1024
+#endif
+#ifndef NUM_FRAMES
+#define NUM_FRAMES 600
+#endif
+#ifndef CHECK_FRAMES
+#define CHECK_FRAMES 60
+#endif
+#ifndef ITERATIONS
+#define ITERATIONS 2
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef DEPTH
+#define DEPTH 6
+#endif
+
+struct tile_t {
+    AABB aabb;
+};
+
+typedef struct tile_t Tile;
+
+struct npc_t {
+    double vx, vy;
+};
+
+typedef struct npc_t Npc;
+
+// a border around the map, plus random tiles inside it
+static size_t randomize_tiles(Tile *tiles) {
+    size_t len = 0;
+    for (int y = 0; y < MAP_TILES; y++) {
+        for (int x = 0; x < MAP_TILES; x++) {
+            bool border = x == 0 || y == 0 || x == MAP_TILES - 1 || y == MAP_TILES - 1;
+            if (!border && rand() % 8)
+                continue;
+            aabb_init(&tiles[len++].aabb, x * TILE_SIZE, y * TILE_SIZE, (x + 1) * TILE_SIZE, (y + 1) * TILE_SIZE);
+        }
+    }
+    return len;
+}
+
+static void randomize_npcs(AABBMover *movers, Npc *npcs) {
+    for (int i = 0; i < NUM_MOVERS; i++) {
+        memset(&movers[i], 0, sizeof movers[i]);
+        movers[i].x = TILE_SIZE + rand() % (WIDTH - 4 * TILE_SIZE);
+        movers[i].y = TILE_SIZE + rand() % (HEIGHT - 4 * TILE_SIZE);
+        movers[i].width = 4 + rand() % 24;
+        movers[i].height = 4 + rand() % 24;
+        npcs[i].vx = (rand() % 257 - 128) / 8.0;
+        npcs[i].vy = (rand() % 257 - 128) / 8.0;
+    }
+}
+
+// gravity, plus a random jump or turn now and then
+static void step_npcs(AABBMover *movers, Npc *npcs) {
+    for (int i = 0; i < NUM_MOVERS; i++) {
+        if (rand() % 64 == 0)
+            npcs[i].vx = (rand() % 257 - 128) / 8.0;
+        if (movers[i].contacts & (1u << EDGE_NORTH) && rand() % 16 == 0)
+            npcs[i].vy = -(rand() % 128) / 8.0;
+        npcs[i].vy += 0.25;
+        movers[i].dx = npcs[i].vx;
+        movers[i].dy = npcs[i].vy;
+    }
+}
+
+// stop where something was hit
+static void bump_npcs(const AABBMover *movers, Npc *npcs) {
+    for (int i = 0; i < NUM_MOVERS; i++) {
+        if (movers[i].contacts & (1u << EDGE_WEST | 1u << EDGE_EAST))
+            npcs[i].vx = 0;
+        if (movers[i].contacts & (1u << EDGE_NORTH | 1u << EDGE_SOUTH))
+            npcs[i].vy = 0;
+    }
+}
+
+// the main.c loop, sweeping against every tile one at a time
+static void solve_each(const Tile *tiles, size_t len, AABBMover *movers) {
+    for (int i = 0; i < NUM_MOVERS; i++) {
+        AABBMover *m = &movers[i];
+        double pos[2] = {m->x, m->y}, delta[2] = {m->dx, m->dy};
+        const int size[2] = {m->width, m->height};
+        m->contacts = 0;
+        for (int k = 0; k < ITERATIONS; k++) {
+            double t = 2.0;
+            size_t hit = len;
+            AABBEdge edge = EDGE_WEST;
+            for (size_t j = 0; j < len; j++) {
+                AABBEdge e;
+                double cur = aabb_sweep(&tiles[j].aabb, pos[0], pos[1], 1.0 / delta[0], 1.0 / delta[1], size[0], size[1], &e);
+                if (cur >= 0 && cur < t) {
+                    t = cur;
+                    hit = j;
+                    edge = e;
+                }
+            }
+            if (hit == len) {
+                for (int j = 0; j < 2; j++) {
+                    pos[j] += delta[j];
+                    delta[j] = 0;
+                }
+                break;
+            }
+            const AABB *box = &tiles[hit].aabb;
+            const int coords[4] = {box->x1, box->y1, box->x2, box->y2};
+            pos[!(edge & 1)] += delta[!(edge & 1)] * t;
+            pos[edge & 1] = coords[edge] - !(edge >> 1) * size[edge & 1];
+            delta[edge & 1] = 0;
+            delta[!(edge & 1)] *= 1.0 - t;
+            m->contacts |= 1u << edge;
+        }
+        m->x = pos[0];
+        m->y = pos[1];
+        m->dx = delta[0];
+        m->dy = delta[1];
+    }
+}
+
+static void collect_tile(void *tiles_, void *tile) {
+    Tile **tiles = tiles_;
+    *(*tiles)++ = *(Tile *)tile;
+}
+
+// a box falling onto a floor and one sliding down a wall
+static void check_simple(void) {
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Tile));
+    Tile floor, wall;
+    aabb_init(&floor.aabb, 0, 64, 64, 80);
+    aabb_init(&wall.aabb, 64, 0, 80, 80);
+    quadtree_insert(&q, &floor);
+    quadtree_insert(&q, &wall);
+    AABBMover m[2] = {
+        {16.0, 40.0, 8.0, 16.0, 16, 16, 0},
+        {40.0, 8.0, 32.0, 16.0, 16, 16, 0},
+    };
+    aabb_solve_quadtree(&q, m, 2, ITERATIONS);
+    TEST_ASSERT(m[0].x == 24.0 && m[0].y == 48.0 && m[0].contacts == 1u << EDGE_NORTH);
+    TEST_ASSERT(m[0].dx == 0 && m[0].dy == 0);
+    TEST_ASSERT(m[1].x == 48.0 && m[1].y == 24.0 && m[1].contacts == 1u << EDGE_WEST);
+    TEST_ASSERT(m[1].dx == 0 && m[1].dy == 0);
+    // one iteration leaves the slide for later
+    m[1].x = 40.0;
+    m[1].y = 8.0;
+    m[1].dx = 32.0;
+    m[1].dy = 16.0;
+    aabb_solve_quadtree(&q, &m[1], 1, 1);
+    TEST_ASSERT(m[1].x == 48.0 && m[1].y == 12.0 && m[1].dx == 0 && m[1].dy == 12.0);
+    quadtree_free(&q);
+}
+
+int main() {
+    srand(RAND_SEED);
+    check_simple();
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Tile));
+    Tile *tiles = malloc(sizeof(Tile) * MAP_TILES * MAP_TILES),
+         *ordered = malloc(sizeof(Tile) * MAP_TILES * MAP_TILES);
+    size_t tiles_len = randomize_tiles(tiles);
+    for (size_t i = 0; i < tiles_len; i++)
+        quadtree_insert(&q, &tiles[i]);
+    // the reference breaks ties in the same order as the tree
+    Tile *end = ordered;
+    quadtree_traverse(&q, &bounds, collect_tile, &end);
+    TEST_ASSERT((size_t)(end - ordered) == tiles_len);
+    AABBMover *movers = malloc(sizeof(AABBMover) * NUM_MOVERS),
+              *each = malloc(sizeof(AABBMover) * NUM_MOVERS);
+    Npc *npcs = malloc(sizeof(Npc) * NUM_MOVERS);
+    randomize_npcs(movers, npcs);
+    size_t contacts = 0;
+    for (int f = 0; f < CHECK_FRAMES; f++) {
+        step_npcs(movers, npcs);
+        memcpy(each, movers, sizeof(AABBMover) * NUM_MOVERS);
+        aabb_solve_quadtree(&q, movers, NUM_MOVERS, ITERATIONS);
+        solve_each(ordered, tiles_len, each);
+        for (int i = 0; i < NUM_MOVERS; i++) {
+            TEST_ASSERT(memcmp(&movers[i], &each[i], sizeof(AABBMover)) == 0);
+            contacts += movers[i].contacts != 0;
+        }
+        bump_npcs(movers, npcs);
+    }
+    fprintf(stderr, "%zu contacts in %d frames.\n", contacts, CHECK_FRAMES);
+    clock_t start, end_time;
+    // begin time solve each
+    start = clock();
+    for (int f = 0; f < CHECK_FRAMES; f++) {
+        step_npcs(each, npcs);
+        solve_each(ordered, tiles_len, each);
+        bump_npcs(each, npcs);
+    }
+    end_time = clock();
+    fprintf(stderr, "moving %d movers against every tile for %d frames took %.3f ms.\n",
+            NUM_MOVERS, CHECK_FRAMES, (end_time - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time solve each
+    // begin time solve quadtree
+    start = clock();
+    for (int f = 0; f < NUM_FRAMES; f++) {
+        step_npcs(movers, npcs);
+        aabb_solve_quadtree(&q, movers, NUM_MOVERS, ITERATIONS);
+        bump_npcs(movers, npcs);
+    }
+    end_time = clock();
+    fprintf(stderr, "moving %d movers with aabb_solve_quadtree for %d frames took %.3f ms.\n",
+            NUM_MOVERS, NUM_FRAMES, (end_time - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time solve quadtree
+    // nobody got through the border
+    for (int i = 0; i < NUM_MOVERS; i++) {
+        TEST_ASSERT(movers[i].x >= TILE_SIZE && movers[i].x + movers[i].width <= WIDTH - TILE_SIZE);
+        TEST_ASSERT(movers[i].y >= TILE_SIZE && movers[i].y + movers[i].height <= HEIGHT - TILE_SIZE);
+    }
+    quadtree_free(&q);
+    free(tiles);
+    free(ordered);
+    free(movers);
+    free(each);
+    free(npcs);
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define TILE_SIZE 16
+#ifndef NUM_BOXES
+#define NUM_BOXES 64
+#endif
+#ifndef NUM_SWEEPS
+#define NUM_SWEEPS 262144
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+
+struct sweep_t {
+    double x, y, dx, dy;
+    int width, height;
+};
+
+typedef struct sweep_t Sweep;
+
+// tiles around the origin, some of them the same tile twice
+static void randomize_boxes(int *x1, int *y1, int *x2, int *y2, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (i && rand() % 8 == 0) {
+            size_t j = rand() % i;
+            x1[i] = x1[j];
+            y1[i] = y1[j];
+            x2[i] = x2[j];
+            y2[i] = y2[j];
+            continue;
+        }
+        x1[i] = (rand() % 16 - 8) * TILE_SIZE;
+        y1[i] = (rand() % 16 - 8) * TILE_SIZE;
+        x2[i] = x1[i] + TILE_SIZE;
+        y2[i] = y1[i] + TILE_SIZE;
+    }
+}
+
+// includes moves along one axis (infinite inverse) and starting
+// positions on tile edges
+static void randomize_sweep(Sweep *s) {
+    switch (rand() % 4) {
+    case 0:
+        s->x = (rand() % 16 - 8) * TILE_SIZE;
+        s->y = (rand() % 16 - 8) * TILE_SIZE;
+        break;
+    default:
+        s->x = (rand() % 4096 - 2048) / 16.0;
+        s->y = (rand() % 4096 - 2048) / 16.0;
+        break;
+    }
+    s->dx = rand() % 4 ? (rand() % 2048 - 1024) / 8.0 : 0.0;
+    s->dy = rand() % 4 ? (rand() % 2048 - 1024) / 8.0 : 0.0;
+    s->width = rand() % 3 ? 1 + rand() % 24 : 0;
+    s->height = s->width ? 1 + rand() % 24 : 0;
+}
+
+static double sweep_each(const int *x1, const int *y1, const int *x2, const int *y2, size_t len,
+                         const Sweep *s, size_t *index, AABBEdge *edge) {
+    double t = 2.0;
+    for (size_t i = 0; i < len; i++) {
+        AABB box;
+        AABBEdge e;
+        aabb_init(&box, x1[i], y1[i], x2[i], y2[i]);
+        double cur = aabb_sweep(&box, s->x, s->y, 1.0 / s->dx, 1.0 / s->dy, s->width, s->height, &e);
+        if (cur >= 0 && cur < t) {
+            t = cur;
+            *index = i;
+            *edge = e;
+        }
+    }
+    return t <= 1.0 ? t : -1.0;
+}
+
+int main() {
+    srand(RAND_SEED);
+    int *x1 = malloc(sizeof(int) * NUM_BOXES), *y1 = malloc(sizeof(int) * NUM_BOXES),
+        *x2 = malloc(sizeof(int) * NUM_BOXES), *y2 = malloc(sizeof(int) * NUM_BOXES);
+    Sweep *sweeps = malloc(sizeof(Sweep) * NUM_SWEEPS);
+    randomize_boxes(x1, y1, x2, y2, NUM_BOXES);
+    for (int i = 0; i < NUM_SWEEPS; i++)
+        randomize_sweep(&sweeps[i]);
+    // every length, so each tail is tested
+    size_t hits = 0;
+    for (int i = 0; i < NUM_SWEEPS; i++) {
+        const Sweep *s = &sweeps[i];
+        size_t len = i % (NUM_BOXES + 1), index = 0, many_index = NUM_BOXES;
+        AABBEdge edge = EDGE_WEST, many_edge = EDGE_WEST;
+        double t = sweep_each(x1, y1, x2, y2, len, s, &index, &edge);
+        double many = aabb_sweep_many(x1, y1, x2, y2, len, s->x, s->y, 1.0 / s->dx, 1.0 / s->dy,
+                                      s->width, s->height, &many_index, &many_edge);
+        TEST_ASSERT(memcmp(&t, &many, sizeof(double)) == 0);
+        if (t >= 0) {
+            TEST_ASSERT(index == many_index && edge == many_edge);
+            hits++;
+        } else {
+            TEST_ASSERT(many_index == NUM_BOXES);
+        }
+    }
+    fprintf(stderr, "%zu of %d sweeps hit.\n", hits, NUM_SWEEPS);
+    clock_t start, end;
+    double sum = 0;
+    size_t index;
+    AABBEdge edge;
+    // begin time sweep each
+    start = clock();
+    for (int i = 0; i < NUM_SWEEPS; i++)
+        sum += sweep_each(x1, y1, x2, y2, NUM_BOXES, &sweeps[i], &index, &edge);
+    end = clock();
+    fprintf(stderr, "sweeping %d times against %d boxes one at a time took %.3f ms.\n",
+            NUM_SWEEPS, NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time sweep each
+    // begin time sweep many
+    double many_sum = 0;
+    start = clock();
+    for (int i = 0; i < NUM_SWEEPS; i++) {
+        const Sweep *s = &sweeps[i];
+        many_sum += aabb_sweep_many(x1, y1, x2, y2, NUM_BOXES, s->x, s->y, 1.0 / s->dx, 1.0 / s->dy,
+                                    s->width, s->height, &index, &edge);
+    }
+    end = clock();
+    fprintf(stderr, "sweeping %d times against %d boxes with aabb_sweep_many took %.3f ms.\n",
+            NUM_SWEEPS, NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time sweep many
+    TEST_ASSERT(sum == many_sum);
+    free(x1);
+    free(y1);
+    free(x2);
+    free(y2);
+    free(sweeps);
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 65536
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 65536
+#endif
+#ifndef QUERY_SIZE
+#define QUERY_SIZE 64
+#endif
+#ifndef NUM_RAYS
+#define NUM_RAYS 1024
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+#ifndef MARGIN
+#define MARGIN 4
+#endif
+
+// small sprites, plus some that straddle the lines between quadtree
+// nodes, which stay high up in the quadtree
+static void randomize(Box *boxes) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        int x1, y1, size = rand() % 4 ? 8 + rand() % 16 : 32 + rand() % 96;
+        if (i % 4 == 0) {
+            // centered on the lines splitting the top two levels
+            x1 = (rand() % 4) * (WIDTH / 4) - size / 2;
+            y1 = rand() % HEIGHT;
+            if (rand() % 2) {
+                int tmp = x1;
+                x1 = y1;
+                y1 = tmp;
+            }
+        } else {
+            x1 = rand() % WIDTH;
+            y1 = rand() % HEIGHT;
+        }
+        aabb_init(&boxes[i].aabb, x1, y1, x1 + size, y1 + size);
+    }
+}
+
+// most moves stay inside the margin, some don't
+static void shift_random(Box *boxes) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        int amount = rand() % 8 ? 2 : 64;
+        int sx = rand() % (amount * 2 + 1) - amount,
+            sy = rand() % (amount * 2 + 1) - amount;
+        boxes[i].aabb.x1 += sx;
+        boxes[i].aabb.x2 += sx;
+        boxes[i].aabb.y1 += sy;
+        boxes[i].aabb.y2 += sy;
+    }
+}
+
+struct hits_t {
+    size_t count;
+    unsigned long sum;
+};
+
+static void count_hit(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    hits->count++;
+    hits->sum += box->idx;
+}
+
+// runs every query on both and checks that they find the same boxes
+static void query_both(Quadtree *q, AABBTree *t, AABB *queries) {
+    static struct hits_t hits[NUM_QUERIES], tree_hits[NUM_QUERIES];
+    clock_t start, end;
+    memset(hits, 0, sizeof hits);
+    memset(tree_hits, 0, sizeof tree_hits);
+    // begin time query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse(q, &queries[i], count_hit, &hits[i]);
+    end = clock();
+    fprintf(stderr, "querying %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time query
+    // begin time tree query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        aabb_tree_traverse(t, &queries[i], count_hit, &tree_hits[i]);
+    end = clock();
+    fprintf(stderr, "querying aabb tree %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time tree query
+    size_t total = 0;
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        TEST_ASSERT(hits[i].count == tree_hits[i].count);
+        TEST_ASSERT(hits[i].sum == tree_hits[i].sum);
+        total += hits[i].count;
+    }
+    fprintf(stderr, "found %zu intersections.\n", total);
+}
+
+// checks the first hit against sweeping against every box
+static void check_rays(AABBTree *t, const Box *boxes) {
+    size_t found = 0;
+    for (int i = 0; i < NUM_RAYS; i++) {
+        double x = rand() % WIDTH, y = rand() % HEIGHT,
+               dx = rand() % 1025 - 512, dy = rand() % 1025 - 512;
+        int width = i % 2 ? 0 : 1 + rand() % 16, height = i % 2 ? 0 : 1 + rand() % 16;
+        double best = 2.0;
+        for (int j = 0; j < NUM_BOXES; j++) {
+            double th = aabb_sweep(&boxes[j].aabb, x, y, 1.0 / dx, 1.0 / dy, width, height, NULL);
+            if (th >= 0.0 && th < best)
+                best = th;
+        }
+        double th;
+        AABBEdge edge;
+        Box *hit = aabb_tree_raycast(t, x, y, dx, dy, width, height, &th, &edge);
+        if (best > 1.0) {
+            TEST_ASSERT(hit == NULL && th == -1.0);
+            continue;
+        }
+        TEST_ASSERT(hit != NULL && th == best);
+        // ties can pick either box, but the one picked has to be hit there
+        AABBEdge expected;
+        TEST_ASSERT(aabb_sweep(&hit->aabb, x, y, 1.0 / dx, 1.0 / dy, width, height, &expected) == th);
+        TEST_ASSERT(edge == expected);
+        found++;
+    }
+    fprintf(stderr, "%zu of %d rays hit.\n", found, NUM_RAYS);
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    AABBTree t;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    aabb_tree_init(&t, MARGIN, sizeof(Box));
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES),
+        *new_pos = malloc(sizeof(Box) * NUM_BOXES);
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    AABBTreeHandle *tree_handles = malloc(sizeof(AABBTreeHandle) * NUM_BOXES);
+    AABB *queries = malloc(sizeof(AABB) * NUM_QUERIES);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        boxes[i].idx = i;
+    }
+    randomize(boxes);
+    memcpy(new_pos, boxes, NUM_BOXES * sizeof(Box));
+    shift_random(new_pos);
+    random_queries(queries, NUM_QUERIES, WIDTH, HEIGHT, QUERY_SIZE);
+    clock_t start, end;
+    // begin time insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        handles[i] = quadtree_insert(&q, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time insert
+    // begin time tree insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        tree_handles[i] = aabb_tree_insert(&t, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements into aabb tree took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time tree insert
+    query_both(&q, &t, queries);
+    check_rays(&t, boxes);
+    // begin time move by handle
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_move_handle(&q, handles[i], &new_pos[i].aabb, NULL);
+    end = clock();
+    fprintf(stderr, "moving %d elements by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time move by handle
+    // begin time tree move by handle
+    Box buf;
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        aabb_tree_move_handle(&t, tree_handles[i], &new_pos[i].aabb, &buf);
+    end = clock();
+    fprintf(stderr, "moving %d elements in aabb tree by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time tree move by handle
+    TEST_ASSERT(buf.idx == boxes[NUM_BOXES - 1].idx);
+    query_both(&q, &t, queries);
+    check_rays(&t, new_pos);
+    // move back by searching for them
+    for (int i = 0; i < NUM_BOXES; i++) {
+        aabb_tree_move(&t, &new_pos[i], box_equal, &boxes[i].aabb, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx && memcmp(&buf.aabb, &boxes[i].aabb, sizeof(AABB)) == 0);
+        quadtree_move_handle(&q, handles[i], &boxes[i].aabb, NULL);
+    }
+    query_both(&q, &t, queries);
+    for (int i = 0; i < NUM_BOXES; i++)
+        TEST_ASSERT(((Box *)aabb_tree_get(&t, tree_handles[i]))->idx == boxes[i].idx);
+    // remove half by handle and half by searching
+    for (int i = 0; i < NUM_BOXES; i++) {
+        if (i % 2)
+            aabb_tree_remove_handle(&t, tree_handles[i], &buf);
+        else
+            aabb_tree_remove(&t, &boxes[i], box_equal, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx);
+        // it's gone, so looking for it again does nothing
+        if (i == 0) {
+            aabb_tree_move(&t, &boxes[0], box_equal, &boxes[1].aabb, NULL);
+            aabb_tree_remove(&t, &boxes[0], box_equal, NULL);
+            TEST_ASSERT(t.data_len == NUM_BOXES - 1);
+        }
+    }
+    TEST_ASSERT(t.data_len == 0 && t.root == AABB_TREE_NO_HANDLE);
+    // nodes are reused
+    size_t nodes_len = t.nodes_len;
+    for (int i = 0; i < NUM_BOXES; i++)
+        aabb_tree_insert(&t, &boxes[i]);
+    TEST_ASSERT(t.nodes_len == nodes_len);
+    quadtree_free(&q);
+    aabb_tree_free(&t);
+    free(boxes);
+    free(new_pos);
+    free(handles);
+    free(tree_handles);
+    free(queries);
+    return 0;
+}
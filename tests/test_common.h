@@ -0,0 +1,59 @@
+#ifndef INCLUDED_GRAPHICS_TEST_COMMON_H
+#define INCLUDED_GRAPHICS_TEST_COMMON_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "collision.h"
+
+// helpers shared by the collision tests
+
+// still checked in release builds, which are the ones that get timed
+#ifdef NDEBUG
+#define TEST_ASSERT(x) do { if (!(x)) { fprintf(stderr, "Assertion failed: (%s:%d) %s\n", __FILE__, __LINE__, #x); abort(); } } while (false)
+#else
+#define TEST_ASSERT assert
+#endif
+
+struct box_t {
+    AABB aabb;
+    unsigned int idx;
+};
+
+typedef struct box_t Box;
+
+// places len boxes at random in width x height, each side min_size plus
+// less than size_range, numbered in order
+static inline void random_boxes(Box *boxes, int len, int width, int height, int min_size, int size_range) {
+    for (int i = 0; i < len; i++) {
+        int x1 = rand() % width, y1 = rand() % height;
+        aabb_init(&boxes[i].aabb, x1, y1, x1 + min_size + rand() % size_range, y1 + min_size + rand() % size_range);
+        boxes[i].idx = i;
+    }
+}
+
+// moves each box by up to amount along each axis
+static inline void shift_boxes(Box *boxes, int len, int amount) {
+    for (int i = 0; i < len; i++) {
+        int sx = rand() % (amount * 2 + 1) - amount,
+            sy = rand() % (amount * 2 + 1) - amount;
+        boxes[i].aabb.x1 += sx;
+        boxes[i].aabb.x2 += sx;
+        boxes[i].aabb.y1 += sy;
+        boxes[i].aabb.y2 += sy;
+    }
+}
+
+static inline bool box_equal(void *a, void *b) {
+    return ((Box *)a)->idx == ((Box *)b)->idx;
+}
+
+// places len size x size query boxes at random in width x height
+static inline void random_queries(AABB *queries, int len, int width, int height, int size) {
+    for (int i = 0; i < len; i++) {
+        int x1 = rand() % width, y1 = rand() % height;
+        aabb_init(&queries[i], x1, y1, x1 + size, y1 + size);
+    }
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 131072
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 65536
+#endif
+#ifndef QUERY_SIZE
+#define QUERY_SIZE 64
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef SHIFT_AMOUNT
+#define SHIFT_AMOUNT 64
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+
+struct hits_t {
+    size_t count;
+    unsigned long sum;
+};
+
+static void count_hit(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    hits->count++;
+    hits->sum += box->idx;
+}
+
+// runs every query on both trees and checks that they find the same boxes
+static void query_both(Quadtree *q, LinearQuadtree *lq, AABB *queries) {
+    static struct hits_t hits[NUM_QUERIES], linear_hits[NUM_QUERIES];
+    clock_t start, end;
+    memset(hits, 0, sizeof hits);
+    memset(linear_hits, 0, sizeof linear_hits);
+    // begin time query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse(q, &queries[i], count_hit, &hits[i]);
+    end = clock();
+    fprintf(stderr, "querying %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time query
+    // begin time linear query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        linear_quadtree_traverse(lq, &queries[i], count_hit, &linear_hits[i]);
+    end = clock();
+    fprintf(stderr, "querying linear quadtree %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time linear query
+    size_t total = 0;
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        TEST_ASSERT(hits[i].count == linear_hits[i].count);
+        TEST_ASSERT(hits[i].sum == linear_hits[i].sum);
+        total += hits[i].count;
+    }
+    fprintf(stderr, "found %zu intersections.\n", total);
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    LinearQuadtree lq;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    linear_quadtree_init(&lq, &bounds, DEPTH, sizeof(Box));
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES),
+        *new_pos = malloc(sizeof(Box) * NUM_BOXES);
+    AABB *queries = malloc(sizeof(AABB) * NUM_QUERIES);
+    // sprite-sized boxes
+    random_boxes(boxes, NUM_BOXES, WIDTH, HEIGHT, 4, 29);
+    memcpy(new_pos, boxes, NUM_BOXES * sizeof(Box));
+    shift_boxes(new_pos, NUM_BOXES, SHIFT_AMOUNT);
+    random_queries(queries, NUM_QUERIES, WIDTH, HEIGHT, QUERY_SIZE);
+    clock_t start, end;
+    // begin time insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_insert(&q, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time insert
+    // begin time linear insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        linear_quadtree_insert(&lq, &boxes[i]);
+    linear_quadtree_update(&lq);
+    end = clock();
+    fprintf(stderr, "inserting %d elements into linear quadtree took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time linear insert
+    query_both(&q, &lq, queries);
+    // begin time linear move
+    Box buf;
+    start = clock();
+    // buf is optional
+    for (int i = 0; i < NUM_BOXES; i++)
+        linear_quadtree_move(&lq, &boxes[i], box_equal, &new_pos[i].aabb, i % 2 ? &buf : NULL);
+    linear_quadtree_update(&lq);
+    end = clock();
+    fprintf(stderr, "moving %d elements in linear quadtree took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time linear move
+    quadtree_free(&q);
+    for (int i = 0; i < NUM_BOXES; i++)
+        boxes[i].aabb = new_pos[i].aabb;
+    quadtree_build(&q, &bounds, DEPTH, sizeof(Box), boxes, NUM_BOXES, NULL);
+    query_both(&q, &lq, queries);
+    // remove everything again
+    for (int i = 0; i < NUM_BOXES; i++) {
+        linear_quadtree_remove(&lq, &boxes[i], box_equal, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx);
+    }
+    linear_quadtree_update(&lq);
+    TEST_ASSERT(lq.data_len == 0 && lq.nodes_len == 0);
+    quadtree_free(&q);
+    linear_quadtree_free(&lq);
+    free(boxes);
+    free(new_pos);
+    free(queries);
+    return 0;
+}
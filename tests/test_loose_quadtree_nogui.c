@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 65536
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 65536
+#endif
+#ifndef QUERY_SIZE
+#define QUERY_SIZE 64
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef SHIFT_AMOUNT
+#define SHIFT_AMOUNT 64
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+#ifndef LOOSENESS
+#define LOOSENESS 2.0
+#endif
+
+struct hits_t {
+    size_t count;
+    unsigned long sum;
+};
+
+static void count_hit(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    hits->count++;
+    hits->sum += box->idx;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// the pairs as sorted numbers that don't depend on the tree
+static uint64_t *pair_keys(QuadtreePair *pairs, size_t len) {
+    uint64_t *keys = malloc(sizeof(uint64_t) * len);
+    for (size_t i = 0; i < len; i++) {
+        unsigned int a = ((Box *)pairs[i].a)->idx, b = ((Box *)pairs[i].b)->idx;
+        keys[i] = a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+    }
+    qsort(keys, len, sizeof(uint64_t), compare_u64);
+    return keys;
+}
+
+static void print_levels(const char *name, const Quadtree *q) {
+    QuadtreeStats stats;
+    quadtree_stats(q, &stats);
+    fprintf(stderr, "%s elements per level:", name);
+    for (int d = 0; d <= DEPTH; d++)
+        fprintf(stderr, " %zu", stats.elements_per_level[d]);
+    fprintf(stderr, "\n");
+}
+
+// runs every query on both and checks that they find the same boxes
+static void query_both(Quadtree *q, Quadtree *lq, AABB *queries) {
+    static struct hits_t hits[NUM_QUERIES], loose_hits[NUM_QUERIES];
+    clock_t start, end;
+    memset(hits, 0, sizeof hits);
+    memset(loose_hits, 0, sizeof loose_hits);
+    // begin time query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse(q, &queries[i], count_hit, &hits[i]);
+    end = clock();
+    fprintf(stderr, "querying %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time query
+    // begin time loose query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse(lq, &queries[i], count_hit, &loose_hits[i]);
+    end = clock();
+    fprintf(stderr, "querying loose quadtree %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time loose query
+    size_t total = 0;
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        TEST_ASSERT(hits[i].count == loose_hits[i].count);
+        TEST_ASSERT(hits[i].sum == loose_hits[i].sum);
+        total += hits[i].count;
+    }
+    fprintf(stderr, "found %zu intersections.\n", total);
+    print_levels("quadtree", q);
+    print_levels("loose quadtree", lq);
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q, lq;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    quadtree_init_loose(&lq, &bounds, DEPTH, sizeof(Box), LOOSENESS);
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES),
+        *new_pos = malloc(sizeof(Box) * NUM_BOXES);
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES),
+                   *loose_handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    AABB *queries = malloc(sizeof(AABB) * NUM_QUERIES),
+         *new_bounds = malloc(sizeof(AABB) * NUM_BOXES);
+    random_boxes(boxes, NUM_BOXES, WIDTH, HEIGHT, 4, 64);
+    memcpy(new_pos, boxes, NUM_BOXES * sizeof(Box));
+    shift_boxes(new_pos, NUM_BOXES, SHIFT_AMOUNT);
+    random_queries(queries, NUM_QUERIES, WIDTH, HEIGHT, QUERY_SIZE);
+    clock_t start, end;
+    // begin time insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        handles[i] = quadtree_insert(&q, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time insert
+    // begin time loose insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        loose_handles[i] = quadtree_insert(&lq, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements into loose quadtree took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time loose insert
+    query_both(&q, &lq, queries);
+    // the straddlers are what stay at the root
+    TEST_ASSERT(lq.data_len < q.data_len);
+    // begin time move by handle
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_move_handle(&q, handles[i], &new_pos[i].aabb, NULL);
+    end = clock();
+    fprintf(stderr, "moving %d elements by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time move by handle
+    // begin time loose move by handle
+    Box buf;
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_move_handle(&lq, loose_handles[i], &new_pos[i].aabb, &buf);
+    end = clock();
+    fprintf(stderr, "moving %d elements in loose quadtree by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time loose move by handle
+    TEST_ASSERT(buf.idx == boxes[NUM_BOXES - 1].idx);
+    query_both(&q, &lq, queries);
+    // pairs are found across overlapping children too, each one once
+    size_t num_pairs = quadtree_find_pairs(&q, NULL, 0);
+    QuadtreePair *pairs = malloc(sizeof(QuadtreePair) * num_pairs),
+                 *loose_pairs = malloc(sizeof(QuadtreePair) * num_pairs);
+    // begin time find pairs
+    start = clock();
+    TEST_ASSERT(quadtree_find_pairs(&q, pairs, num_pairs) == num_pairs);
+    end = clock();
+    fprintf(stderr, "finding %zu pairs took %.3f ms.\n", num_pairs, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time find pairs
+    // begin time loose find pairs
+    start = clock();
+    TEST_ASSERT(quadtree_find_pairs(&lq, loose_pairs, num_pairs) == num_pairs);
+    end = clock();
+    fprintf(stderr, "finding %zu pairs in loose quadtree took %.3f ms.\n", num_pairs, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time loose find pairs
+    uint64_t *keys = pair_keys(pairs, num_pairs), *loose_keys = pair_keys(loose_pairs, num_pairs);
+    TEST_ASSERT(memcmp(keys, loose_keys, sizeof(uint64_t) * num_pairs) == 0);
+    for (size_t i = 1; i < num_pairs; i++)
+        TEST_ASSERT(keys[i - 1] != keys[i]);
+    free(keys);
+    free(loose_keys);
+    free(pairs);
+    free(loose_pairs);
+    // a snapshot moved back in one batch matches the tree moved back
+    // one at a time
+    Quadtree snap;
+    quadtree_snapshot(&snap, &lq);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        new_bounds[i] = boxes[i].aabb;
+        quadtree_move(&lq, &new_pos[i], box_equal, &boxes[i].aabb, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx && memcmp(&buf.aabb, &boxes[i].aabb, sizeof(AABB)) == 0);
+        quadtree_move_handle(&q, handles[i], &boxes[i].aabb, NULL);
+    }
+    quadtree_move_many(&snap, loose_handles, new_bounds, NUM_BOXES);
+    query_both(&q, &lq, queries);
+    query_both(&q, &snap, queries);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        TEST_ASSERT(((Box *)quadtree_get(&lq, loose_handles[i]))->idx == boxes[i].idx);
+        TEST_ASSERT(((Box *)quadtree_get(&snap, loose_handles[i]))->idx == boxes[i].idx);
+    }
+    quadtree_free(&snap);
+    // remove half by handle and half by searching
+    for (int i = 0; i < NUM_BOXES; i++) {
+        if (i % 2)
+            quadtree_remove_handle(&lq, loose_handles[i], &buf);
+        else
+            quadtree_remove(&lq, &boxes[i], box_equal, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx);
+    }
+    TEST_ASSERT(lq.data_len == 0 && lq.child[0] == NULL);
+    quadtree_free(&q);
+    quadtree_free(&lq);
+    free(boxes);
+    free(new_pos);
+    free(handles);
+    free(loose_handles);
+    free(queries);
+    free(new_bounds);
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 16384
+#endif
+#ifndef NUM_FRAMES
+#define NUM_FRAMES 60
+#endif
+#ifndef SUBSTEPS
+#define SUBSTEPS 4
+#endif
+// frames that are checked against every box, every this many
+#ifndef CHECK_EVERY
+#define CHECK_EVERY 15
+#endif
+#ifndef NUM_CHECKS
+#define NUM_CHECKS 64
+#endif
+#ifndef QUERY_SIZE
+#define QUERY_SIZE 128
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+#ifndef MIN_LIFETIME
+#define MIN_LIFETIME 64
+#endif
+// moves between flushes in the min_lifetime check
+#ifndef FLUSH_EVERY
+#define FLUSH_EVERY 8
+#endif
+
+struct velocity_t {
+    int dx, dy;
+};
+
+typedef struct velocity_t Velocity;
+
+enum mode_t {
+    MOVE_NOW,
+    DEFER,
+    DEFER_UNION,
+};
+
+static void randomize(Box *boxes, Velocity *vels) {
+    random_boxes(boxes, NUM_BOXES, WIDTH, HEIGHT, 4, 16);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        vels[i].dx = rand() % 9 - 4;
+        vels[i].dy = rand() % 9 - 4;
+    }
+}
+
+// physics substep: everything moves and bounces off the sides
+static void step(Box *boxes, Velocity *vels) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        AABB *b = &boxes[i].aabb;
+        Velocity *v = &vels[i];
+        if (b->x1 + v->dx < 0 || b->x2 + v->dx > WIDTH)
+            v->dx = -v->dx;
+        if (b->y1 + v->dy < 0 || b->y2 + v->dy > HEIGHT)
+            v->dy = -v->dy;
+        aabb_init(b, b->x1 + v->dx, b->y1 + v->dy, b->x2 + v->dx, b->y2 + v->dy);
+    }
+}
+
+struct seen_t {
+    unsigned int *stamp;
+    unsigned int now;
+    size_t count;
+};
+
+static void mark_seen(void *seen_, void *box_) {
+    struct seen_t *seen = seen_;
+    Box *box = box_;
+    // nothing is reported twice
+    TEST_ASSERT(seen->stamp[box->idx] != seen->now);
+    seen->stamp[box->idx] = seen->now;
+    seen->count++;
+}
+
+// every box in any of the lists that intersects a query has to be found.
+// with exact set, nothing else can be.
+static void check_queries(Quadtree *q, struct seen_t *seen, const Box **lists, int num_lists, bool exact) {
+    for (int i = 0; i < NUM_CHECKS; i++) {
+        int x1 = rand() % WIDTH, y1 = rand() % HEIGHT;
+        AABB query;
+        aabb_init(&query, x1, y1, x1 + QUERY_SIZE, y1 + QUERY_SIZE);
+        seen->now++;
+        seen->count = 0;
+        quadtree_traverse(q, &query, mark_seen, seen);
+        size_t expected = 0;
+        for (int j = 0; j < NUM_BOXES; j++) {
+            bool hit = false;
+            for (int k = 0; k < num_lists; k++)
+                hit = hit || aabb_intersect(&query, &lists[k][j].aabb);
+            if (hit) {
+                TEST_ASSERT(seen->stamp[j] == seen->now);
+                expected++;
+            }
+        }
+        if (exact)
+            TEST_ASSERT(seen->count == expected);
+    }
+}
+
+static void check_handles(Quadtree *q, const Box *boxes, const QuadtreeHandle *handles) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        Box *box = quadtree_get(q, handles[i]);
+        TEST_ASSERT(box->idx == (unsigned int)i && memcmp(&box->aabb, &boxes[i].aabb, sizeof(AABB)) == 0);
+    }
+}
+
+static void set_mode(Quadtree *q, QuadtreeConfig *config, int mode) {
+    config->defer_moves = mode != MOVE_NOW;
+    config->defer_union = mode == DEFER_UNION;
+    quadtree_set_config(q, config);
+}
+
+// moves an element back and forth moves times without leaving its node,
+// flushing now and then, then removes another one. whether the root
+// merges depends only on how many moves were made since it split, so
+// deferring mustn't change it.
+static bool lifetime_merges(int mode, bool by_value, int moves, Box *boxes, QuadtreeCounters *counters, QuadtreeStats *stats) {
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    QuadtreeConfig config;
+    quadtree_default_config(&config);
+    config.min_lifetime = MIN_LIFETIME;
+    set_mode(&q, &config, mode);
+    // just enough to split the root, spread over the quadrants so it
+    // splits once and its children stay leaves
+    int len = (int)config.split_threshold;
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * len);
+    for (int i = 0; i < len; i++) {
+        int x1 = (i % 4 % 2) * WIDTH / 2 + i * 8, y1 = (i % 4 / 2) * HEIGHT / 2 + i * 8;
+        aabb_init(&boxes[i].aabb, x1, y1, x1 + 4, y1 + 4);
+        boxes[i].idx = i;
+        handles[i] = quadtree_insert(&q, &boxes[i]);
+    }
+    TEST_ASSERT(q.child[0]);
+    AABB there, back = boxes[0].aabb;
+    aabb_init(&there, back.x1 + 1, back.y1 + 1, back.x2 + 1, back.y2 + 1);
+    for (int i = 0; i < moves; i++) {
+        boxes[0].aabb = i % 2 ? back : there;
+        if (by_value)
+            quadtree_move(&q, &boxes[0], box_equal, &boxes[0].aabb, NULL);
+        else
+            quadtree_move_handle(&q, handles[0], &boxes[0].aabb, NULL);
+        if (i % FLUSH_EVERY == FLUSH_EVERY - 1)
+            quadtree_flush(&q);
+    }
+    quadtree_flush(&q);
+    TEST_ASSERT(q.child[0]);
+    quadtree_remove_handle(&q, handles[len - 1], NULL);
+    bool merged = !q.child[0];
+    quadtree_get_counters(&q, counters);
+    quadtree_stats(&q, stats);
+    quadtree_free(&q);
+    free(handles);
+    return merged;
+}
+
+static void check_lifetime(Box *boxes) {
+    for (int by_value = 0; by_value < 2; by_value++) {
+        // the root was split by the last insert, so with one move short
+        // of min_lifetime the removal is just old enough to merge it
+        for (int moves = MIN_LIFETIME - 2; moves <= MIN_LIFETIME - 1; moves++) {
+            QuadtreeCounters now, deferred;
+            QuadtreeStats now_stats, deferred_stats;
+            bool merged = lifetime_merges(MOVE_NOW, by_value, moves, boxes, &now, &now_stats);
+            TEST_ASSERT(merged == (moves == MIN_LIFETIME - 1));
+            for (int mode = DEFER; mode <= DEFER_UNION; mode++) {
+                TEST_ASSERT(lifetime_merges(mode, by_value, moves, boxes, &deferred, &deferred_stats) == merged);
+                TEST_ASSERT(deferred.splits == now.splits && deferred.merges == now.merges);
+                TEST_ASSERT(deferred_stats.nodes == now_stats.nodes && deferred_stats.elements == now_stats.elements);
+                for (size_t i = 0; i <= now_stats.depth; i++)
+                    TEST_ASSERT(deferred_stats.elements_per_level[i] == now_stats.elements_per_level[i]);
+            }
+        }
+    }
+}
+
+static const char *mode_names[] = {"moving right away", "deferring", "deferring with union bounds"};
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Box *start_boxes = malloc(sizeof(Box) * NUM_BOXES), *boxes = malloc(sizeof(Box) * NUM_BOXES),
+        *frame_boxes = malloc(sizeof(Box) * NUM_BOXES);
+    Velocity *start_vels = malloc(sizeof(Velocity) * NUM_BOXES), *vels = malloc(sizeof(Velocity) * NUM_BOXES);
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    struct seen_t seen = {calloc(NUM_BOXES, sizeof(unsigned int)), 0, 0};
+    randomize(start_boxes, start_vels);
+    QuadtreeConfig config;
+    double times[3];
+    for (int mode = MOVE_NOW; mode <= DEFER_UNION; mode++) {
+        memcpy(boxes, start_boxes, sizeof(Box) * NUM_BOXES);
+        memcpy(vels, start_vels, sizeof(Velocity) * NUM_BOXES);
+        Quadtree q;
+        quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+        quadtree_default_config(&config);
+        set_mode(&q, &config, mode);
+        for (int i = 0; i < NUM_BOXES; i++)
+            handles[i] = quadtree_insert(&q, &boxes[i]);
+        clock_t elapsed = 0;
+        for (int frame = 0; frame < NUM_FRAMES; frame++) {
+            bool check = frame % CHECK_EVERY == 0;
+            memcpy(frame_boxes, boxes, sizeof(Box) * NUM_BOXES);
+            for (int s = 0; s < SUBSTEPS; s++) {
+                step(boxes, vels);
+                clock_t start = clock();
+                for (int i = 0; i < NUM_BOXES; i++)
+                    quadtree_move_handle(&q, handles[i], &boxes[i].aabb, NULL);
+                elapsed += clock() - start;
+                if (!check || s != SUBSTEPS / 2)
+                    continue;
+                // halfway through the frame, queries see where things
+                // were at the start of it, or with union bounds
+                // everywhere they've been since
+                const Box *lists[] = {boxes, frame_boxes};
+                if (mode == MOVE_NOW)
+                    check_queries(&q, &seen, lists, 1, true);
+                else if (mode == DEFER)
+                    check_queries(&q, &seen, lists + 1, 1, true);
+                else
+                    check_queries(&q, &seen, lists, 2, false);
+            }
+            clock_t start = clock();
+            quadtree_flush(&q);
+            elapsed += clock() - start;
+            if (check) {
+                const Box *lists[] = {boxes};
+                check_queries(&q, &seen, lists, 1, true);
+                check_handles(&q, boxes, handles);
+            }
+        }
+        times[mode] = elapsed * 1000.0 / CLOCKS_PER_SEC;
+        fprintf(stderr, "%s, %d moves in %d frames of %d substeps took %.3f ms.\n",
+                mode_names[mode], NUM_BOXES, NUM_FRAMES, SUBSTEPS, times[mode]);
+        if (mode == MOVE_NOW) {
+            quadtree_free(&q);
+            continue;
+        }
+        // removing an element drops its pending move, even if its handle
+        // is given to a new element before the flush
+        quadtree_move_handle(&q, handles[0], &boxes[1].aabb, NULL);
+        quadtree_remove_handle(&q, handles[0], NULL);
+        handles[0] = quadtree_insert(&q, &boxes[0]);
+        // moving one right away drops it too
+        AABB away;
+        aabb_init(&away, 0, 0, 1, 1);
+        quadtree_move_handle(&q, handles[1], &away, NULL);
+        quadtree_move_many(&q, &handles[1], &boxes[1].aabb, 1);
+        // and so does moving it back and forth by value
+        if (mode == DEFER) {
+            quadtree_move(&q, &boxes[2], box_equal, &away, NULL);
+            quadtree_move(&q, &boxes[2], box_equal, &boxes[2].aabb, NULL);
+        }
+        quadtree_flush(&q);
+        const Box *lists[] = {boxes};
+        check_queries(&q, &seen, lists, 1, true);
+        check_handles(&q, boxes, handles);
+        quadtree_free(&q);
+    }
+    check_lifetime(boxes);
+    free(start_boxes);
+    free(boxes);
+    free(frame_boxes);
+    free(start_vels);
+    free(vels);
+    free(handles);
+    free(seen.stamp);
+    return 0;
+}
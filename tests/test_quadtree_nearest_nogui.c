@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 65536
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 16384
+#endif
+#ifndef K
+#define K 8
+#endif
+#ifndef RADIUS
+#define RADIUS 64.0
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+
+struct point_t {
+    double x, y;
+};
+
+typedef struct point_t Point;
+
+// some of them outside the world
+static void randomize_points(Point *points) {
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        points[i].x = rand() % (WIDTH + 256) - 128 + 0.25;
+        points[i].y = rand() % (HEIGHT + 256) - 128 + 0.5;
+    }
+}
+
+// the boxes cover x1 to x2 - 1 and y1 to y2 - 1, and none are empty
+static double dist_sq(const AABB *b, double x, double y) {
+    double dx = x < b->x1 ? b->x1 - x : x > b->x2 - 1 ? x - (b->x2 - 1) : 0.0;
+    double dy = y < b->y1 ? b->y1 - y : y > b->y2 - 1 ? y - (b->y2 - 1) : 0.0;
+    return dx * dx + dy * dy;
+}
+
+// the old way: traverse growing boxes until k boxes are close enough
+// that nothing outside the box can be closer
+struct candidate_t {
+    double d;
+    Box *box;
+};
+
+struct candidates_t {
+    double x, y;
+    struct candidate_t *items;
+    size_t len;
+};
+
+static void add_candidate(void *c_, void *box_) {
+    struct candidates_t *c = c_;
+    Box *box = box_;
+    c->items[c->len].d = dist_sq(&box->aabb, c->x, c->y);
+    c->items[c->len++].box = box;
+}
+
+static int candidate_cmp(const void *a_, const void *b_) {
+    const struct candidate_t *a = a_, *b = b_;
+    return (a->d > b->d) - (a->d < b->d);
+}
+
+static size_t expanding_nearest(Quadtree *q, struct candidates_t *c, double x, double y, size_t k, double *d) {
+    c->x = x;
+    c->y = y;
+    for (double half = 16.0;; half *= 2) {
+        AABB box;
+        aabb_init(&box, (int)floor(x - half) - 1, (int)floor(y - half) - 1,
+                  (int)ceil(x + half) + 1, (int)ceil(y + half) + 1);
+        c->len = 0;
+        quadtree_traverse(q, &box, add_candidate, c);
+        size_t close = 0;
+        for (size_t i = 0; i < c->len; i++)
+            close += c->items[i].d <= half * half;
+        if (close >= k || half > 2 * (WIDTH + HEIGHT)) {
+            qsort(c->items, c->len, sizeof *c->items, candidate_cmp);
+            size_t len = c->len < k ? c->len : k;
+            for (size_t i = 0; i < len; i++)
+                d[i] = c->items[i].d;
+            return len;
+        }
+    }
+}
+
+struct hits_t {
+    double x, y;
+    size_t count;
+    unsigned long sum;
+};
+
+static void count_hit(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    hits->count++;
+    hits->sum += box->idx;
+}
+
+static void count_close(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    if (dist_sq(&box->aabb, hits->x, hits->y) <= RADIUS * RADIUS)
+        count_hit(hits, box);
+}
+
+// checks both queries against the old ways of doing them
+static void check_queries(Quadtree *q, struct candidates_t *c, const Point *points) {
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        double x = points[i].x, y = points[i].y;
+        void *out[K];
+        double d[K], expected[K];
+        size_t len = quadtree_nearest(q, x, y, K, out, d);
+        TEST_ASSERT(expanding_nearest(q, c, x, y, K, expected) == len);
+        for (size_t j = 0; j < len; j++) {
+            // ties can pick either, but the distances are the same
+            TEST_ASSERT(d[j] == expected[j]);
+            TEST_ASSERT(dist_sq(&((Box *)out[j])->aabb, x, y) == d[j]);
+        }
+        struct hits_t hits = {x, y, 0, 0}, box_hits = {x, y, 0, 0};
+        quadtree_traverse_radius(q, x, y, RADIUS, count_hit, &hits);
+        AABB box;
+        aabb_init(&box, (int)floor(x - RADIUS) - 1, (int)floor(y - RADIUS) - 1,
+                  (int)ceil(x + RADIUS) + 1, (int)ceil(y + RADIUS) + 1);
+        quadtree_traverse(q, &box, count_close, &box_hits);
+        TEST_ASSERT(hits.count == box_hits.count && hits.sum == box_hits.sum);
+    }
+}
+
+// at integer coordinates, radius 0 finds what the 1 by 1 box there
+// does, and those are the ones at distance 0
+static void check_point_boxes(Quadtree *q, const Point *points) {
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        int x = (int)floor(points[i].x), y = (int)floor(points[i].y);
+        struct hits_t hits = {x, y, 0, 0}, box_hits = {x, y, 0, 0};
+        quadtree_traverse_radius(q, x, y, 0.0, count_hit, &hits);
+        AABB box;
+        aabb_init(&box, x, y, x + 1, y + 1);
+        quadtree_traverse(q, &box, count_hit, &box_hits);
+        TEST_ASSERT(hits.count == box_hits.count && hits.sum == box_hits.sum);
+        void *out[K];
+        double d[K];
+        size_t len = quadtree_nearest(q, x, y, K, out, d), zero = 0;
+        for (size_t j = 0; j < len; j++)
+            zero += d[j] == 0.0;
+        TEST_ASSERT(zero == (box_hits.count < len ? box_hits.count : len));
+    }
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES);
+    Point *points = malloc(sizeof(Point) * NUM_QUERIES);
+    struct candidates_t c = {0, 0, malloc(sizeof(struct candidate_t) * NUM_BOXES), 0};
+    random_boxes(boxes, NUM_BOXES, WIDTH, HEIGHT, 4, 16);
+    randomize_points(points);
+    Quadtree q, lq;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    quadtree_init_loose(&lq, &bounds, DEPTH, sizeof(Box), 2.0);
+    // a tree with fewer elements than asked for gives what it has
+    void *out[K];
+    double d[K];
+    TEST_ASSERT(quadtree_nearest(&q, 10.0, 10.0, K, out, d) == 0);
+    // x2 and y2 are outside the box, as in aabb_intersect
+    Box one;
+    aabb_init(&one.aabb, 10, 10, 20, 20);
+    one.idx = 0;
+    quadtree_insert(&q, &one);
+    TEST_ASSERT(quadtree_nearest(&q, 19.0, 19.0, 1, out, d) == 1 && d[0] == 0.0);
+    TEST_ASSERT(quadtree_nearest(&q, 20.0, 15.0, 1, out, d) == 1 && d[0] == 1.0);
+    TEST_ASSERT(quadtree_nearest(&q, 15.0, 20.0, 1, out, d) == 1 && d[0] == 1.0);
+    TEST_ASSERT(quadtree_nearest(&q, 19.5, 9.5, 1, out, d) == 1 && d[0] == 0.5);
+    struct hits_t edge = {0, 0, 0, 0};
+    quadtree_traverse_radius(&q, 20.0, 20.0, 1.0, count_hit, &edge);
+    TEST_ASSERT(edge.count == 0);
+    quadtree_traverse_radius(&q, 20.0, 20.0, 1.5, count_hit, &edge);
+    TEST_ASSERT(edge.count == 1);
+    quadtree_remove(&q, &one, box_equal, NULL);
+    for (int i = 0; i < K / 2; i++)
+        quadtree_insert(&q, &boxes[i]);
+    TEST_ASSERT(quadtree_nearest(&q, 10.0, 10.0, K, out, NULL) == K / 2);
+    for (int i = K / 2; i < NUM_BOXES; i++)
+        quadtree_insert(&q, &boxes[i]);
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_insert(&lq, &boxes[i]);
+    check_queries(&q, &c, points);
+    check_queries(&lq, &c, points);
+    check_point_boxes(&q, points);
+    check_point_boxes(&lq, points);
+    clock_t start, end;
+    double sum = 0, expanding_sum = 0;
+    // begin time expanding nearest
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        size_t len = expanding_nearest(&q, &c, points[i].x, points[i].y, K, d);
+        expanding_sum += d[len - 1];
+    }
+    end = clock();
+    fprintf(stderr, "finding the %d nearest %d times with growing boxes took %.3f ms.\n",
+            K, NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time expanding nearest
+    // begin time nearest
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        size_t len = quadtree_nearest(&q, points[i].x, points[i].y, K, out, d);
+        sum += d[len - 1];
+    }
+    end = clock();
+    fprintf(stderr, "finding the %d nearest %d times with quadtree_nearest took %.3f ms.\n",
+            K, NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time nearest
+    TEST_ASSERT(sum == expanding_sum);
+    struct hits_t total = {0, 0, 0, 0}, box_total = {0, 0, 0, 0};
+    // begin time box radius
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        double x = points[i].x, y = points[i].y;
+        AABB box;
+        aabb_init(&box, (int)floor(x - RADIUS) - 1, (int)floor(y - RADIUS) - 1,
+                  (int)ceil(x + RADIUS) + 1, (int)ceil(y + RADIUS) + 1);
+        box_total.x = x;
+        box_total.y = y;
+        quadtree_traverse(&q, &box, count_close, &box_total);
+    }
+    end = clock();
+    fprintf(stderr, "finding everything within %.0f %d times with a box took %.3f ms.\n",
+            RADIUS, NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time box radius
+    // begin time radius
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse_radius(&q, points[i].x, points[i].y, RADIUS, count_hit, &total);
+    end = clock();
+    fprintf(stderr, "finding everything within %.0f %d times with quadtree_traverse_radius took %.3f ms.\n",
+            RADIUS, NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time radius
+    TEST_ASSERT(total.count == box_total.count && total.sum == box_total.sum);
+    fprintf(stderr, "found %zu within %.0f.\n", total.count, RADIUS);
+    // removing leaves holes in the nodes, which are skipped
+    for (int i = 0; i < NUM_BOXES; i += 3)
+        quadtree_remove(&q, &boxes[i], box_equal, NULL);
+    check_queries(&q, &c, points);
+    quadtree_free(&q);
+    quadtree_free(&lq);
+    free(boxes);
+    free(points);
+    free(c.items);
+    return 0;
+}
@@ -16,6 +16,21 @@
 #ifndef SHIFT_AMOUNT
 #define SHIFT_AMOUNT 64
 #endif
+#ifndef CHURN_ITERATIONS
+#define CHURN_ITERATIONS 16384
+#endif
+#ifndef DENSE_QUERIES
+#define DENSE_QUERIES 4096
+#endif
+#ifndef NUM_PAIR_BOXES
+#define NUM_PAIR_BOXES 16384
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 4096
+#endif
+#ifndef MAX_THREADS
+#define MAX_THREADS 8
+#endif
 
 #ifdef NDEBUG
 #define TEST_ASSERT(x) do { if (!(x)) { fprintf(stderr, "Assertion failed: (%s:%d) %s\n", __FILE__, __LINE__, #x); abort(); } } while (false)
@@ -81,8 +96,42 @@ static bool aabb_equal(AABB *a, AABB *b) {
         && a->y2 == b->y2;
 }
 
+// the bounds arrays have to mirror the elements' AABBs
+static void quadtree_assert_bounds(Quadtree *q, size_t i) {
+    size_t stride = (q->data_cap + 7) / 8 * 8;
+    AABB *box = (AABB *)((char *)q->data + i * q->el_size);
+    TEST_ASSERT(q->bounds[i] == box->x1);
+    TEST_ASSERT(q->bounds[stride + i] == box->y1);
+    TEST_ASSERT(q->bounds[2 * stride + i] == box->x2);
+    TEST_ASSERT(q->bounds[3 * stride + i] == box->y2);
+}
+
+static void count_hit(void *count, void *a) {
+    (void)a;
+    (*(size_t *)count)++;
+}
+
+struct hit_list_t {
+    void **els;
+    size_t len;
+};
+
+static void list_hit(void *list_, void *a) {
+    struct hit_list_t *list = list_;
+    list->els[list->len++] = a;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// pair of indices as one sortable number
+static uint64_t pair_key(unsigned int a, unsigned int b) {
+    return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+}
+
 static void quadtree_assert_equiv(Quadtree *a, Quadtree *b) {
-    static const char FREE_AABB[sizeof(AABB)] = {0};
     if (a == NULL && b == NULL)
         return;
     if (a == b)
@@ -101,15 +150,17 @@ static void quadtree_assert_equiv(Quadtree *a, Quadtree *b) {
     Box *a_data = (Box *)a->data,
         *b_data = (Box *)b->data;
     for (size_t i = 0; i < a->data_len + a->data_free; i++) {
-        if (memcmp(&a_data[i].aabb, FREE_AABB, sizeof(AABB)) == 0)
+        if (!(a->occupied[i / 64] >> (i % 64) & 1))
             continue;
         TEST_ASSERT(temp[a_data[i].idx] == NULL && "duplicate");
+        quadtree_assert_bounds(a, i);
         temp[a_data[i].idx] = (Box *)&a_data[i];
     }
     for (size_t i = 0; i < b->data_len + b->data_free; i++) {
-        if (memcmp(&b_data[i].aabb, FREE_AABB, sizeof(AABB)) == 0)
+        if (!(b->occupied[i / 64] >> (i % 64) & 1))
             continue;
         TEST_ASSERT(temp[b_data[i].idx] != NULL);
+        quadtree_assert_bounds(b, i);
         TEST_ASSERT(aabb_equal(&temp[b_data[i].idx]->aabb, &b_data[i].aabb));
         temp[b_data[i].idx] = NULL;
     }
@@ -124,11 +175,16 @@ int main() {
     srand(RAND_SEED);
     AABB bounds;
     aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
-    Quadtree q, q_new;
+    Quadtree q, q_new, q_handle, q_many;
     quadtree_init(&q, &bounds, 8, sizeof(Box));
     quadtree_init(&q_new, &bounds, 8, sizeof(Box));
+    quadtree_init(&q_handle, &bounds, 8, sizeof(Box));
+    quadtree_init(&q_many, &bounds, 8, sizeof(Box));
     Box *boxes = malloc(sizeof(Box) * NUM_BOXES),
         *new_pos = malloc(sizeof(Box) * NUM_BOXES);
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES),
+                   *many_handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    AABB *new_bounds = malloc(sizeof(AABB) * NUM_BOXES);
     for (int i = 0; i < NUM_BOXES; i++) {
         boxes[i].idx = i;
         new_pos[i].idx = i;
@@ -136,6 +192,8 @@ int main() {
     randomize(boxes);
     memcpy(new_pos, boxes, NUM_BOXES * sizeof(Box));
     shift_random(new_pos);
+    for (int i = 0; i < NUM_BOXES; i++)
+        new_bounds[i] = new_pos[i].aabb;
     clock_t start, end;
     // begin time insert
     start = clock();
@@ -144,6 +202,10 @@ int main() {
     end = clock();
     fprintf(stderr, "inserting %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
     // end time insert
+    for (int i = 0; i < NUM_BOXES; i++)
+        handles[i] = quadtree_insert(&q_handle, &boxes[i]);
+    for (int i = 0; i < NUM_BOXES; i++)
+        many_handles[i] = quadtree_insert(&q_many, &boxes[i]);
     // make sure everything's in there
     quadtree_traverse(&q, &bounds, print_idx, NULL);
     // move everything around and make sure it's the same structure as inserting
@@ -160,6 +222,19 @@ int main() {
     end = clock();
     fprintf(stderr, "moving %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
     // end time move
+    // begin time move by handle
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_move_handle(&q_handle, handles[i], &new_pos[i].aabb, NULL);
+    end = clock();
+    fprintf(stderr, "moving %d elements by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time move by handle
+    // begin time move many
+    start = clock();
+    quadtree_move_many(&q_many, many_handles, new_bounds, NUM_BOXES);
+    end = clock();
+    fprintf(stderr, "moving %d elements in one batch took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time move many
     // update box positions
     for (int i = 0; i < NUM_BOXES; i++)
         boxes[i].aabb = new_pos[i].aabb;
@@ -171,6 +246,107 @@ int main() {
     fprintf(stderr, "inserting %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
     // end time insert
     quadtree_assert_equiv(&q, &q_new);
+    quadtree_assert_equiv(&q_handle, &q_new);
+    quadtree_assert_equiv(&q_many, &q_new);
+    // begin time build
+    Quadtree q_build;
+    QuadtreeHandle *build_handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    start = clock();
+    quadtree_build(&q_build, &bounds, 8, sizeof(Box), boxes, NUM_BOXES, build_handles);
+    end = clock();
+    fprintf(stderr, "building with %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time build
+    quadtree_assert_equiv(&q_build, &q_new);
+    for (int i = 0; i < NUM_BOXES; i++)
+        TEST_ASSERT(((Box *)quadtree_get(&q_build, build_handles[i]))->idx == boxes[i].idx);
+    // the iterator has to give the same elements in the same order
+    struct hit_list_t list;
+    list.els = malloc(sizeof(void *) * NUM_BOXES);
+    void **iter_els = malloc(sizeof(void *) * NUM_BOXES);
+    AABB *queries = malloc(sizeof(AABB) * NUM_QUERIES);
+    for (int n = 0; n < NUM_QUERIES; n++) {
+        int x = rand() % WIDTH, y = rand() % HEIGHT;
+        aabb_init(&queries[n], x, y, x + 1 + rand() % 64, y + 1 + rand() % 64);
+    }
+    size_t total = 0;
+    // begin time traverse
+    start = clock();
+    for (int n = 0; n < NUM_QUERIES; n++)
+        quadtree_traverse(&q_build, &queries[n], count_hit, &total);
+    end = clock();
+    fprintf(stderr, "querying %d times with a callback took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time traverse
+    // begin time iterate
+    size_t iter_total = 0;
+    QuadtreeQuery it;
+    start = clock();
+    for (int n = 0; n < NUM_QUERIES; n++) {
+        quadtree_query_begin(&it, &q_build, &queries[n]);
+        while (quadtree_query_next(&it))
+            iter_total++;
+    }
+    end = clock();
+    fprintf(stderr, "querying %d times with an iterator took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time iterate
+    TEST_ASSERT(iter_total == total);
+    // begin time collect
+    size_t collect_total = 0, got;
+    start = clock();
+    for (int n = 0; n < NUM_QUERIES; n++) {
+        quadtree_query_begin(&it, &q_build, &queries[n]);
+        while ((got = quadtree_query_collect(&it, iter_els, 256)) != 0)
+            collect_total += got;
+    }
+    end = clock();
+    fprintf(stderr, "querying %d times into a buffer took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time collect
+    TEST_ASSERT(collect_total == total);
+    // begin time first hit
+    size_t nonempty = 0;
+    start = clock();
+    for (int n = 0; n < NUM_QUERIES; n++) {
+        quadtree_query_begin(&it, &q_build, &queries[n]);
+        nonempty += quadtree_query_collect(&it, iter_els, 1);
+    }
+    end = clock();
+    fprintf(stderr, "finding the first hit %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time first hit
+    TEST_ASSERT(nonempty <= NUM_QUERIES);
+    for (int n = 0; n < NUM_QUERIES; n++) {
+        list.len = 0;
+        quadtree_traverse(&q_build, &queries[n], list_hit, &list);
+        // collect in small pieces to check that it picks up where it stopped
+        size_t max = 1 + n % 7, k;
+        got = 0;
+        quadtree_query_begin(&it, &q_build, &queries[n]);
+        while ((k = quadtree_query_collect(&it, iter_els + got, max)) == max)
+            got += k;
+        got += k;
+        TEST_ASSERT(got == list.len);
+        TEST_ASSERT(memcmp(iter_els, list.els, got * sizeof(void *)) == 0);
+        TEST_ASSERT(quadtree_query_next(&it) == NULL);
+    }
+    free(list.els);
+    free(iter_els);
+    free(queries);
+    quadtree_free(&q_build);
+    free(build_handles);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        Box *b = quadtree_get(&q_handle, handles[i]);
+        TEST_ASSERT(b->idx == boxes[i].idx);
+        TEST_ASSERT(aabb_equal(&b->aabb, &new_pos[i].aabb));
+    }
+    // a small batch only touches part of the tree
+    size_t batch_len = 0;
+    for (int i = 0; i < NUM_BOXES; i += 61) {
+        int x = rand() % WIDTH, y = rand() % HEIGHT;
+        aabb_init(&new_bounds[batch_len], x, y, x + 1 + rand() % 8, y + 1 + rand() % 8);
+        quadtree_move_handle(&q_handle, handles[i], &new_bounds[batch_len], NULL);
+        many_handles[batch_len++] = many_handles[i];
+    }
+    quadtree_move_many(&q_many, many_handles, new_bounds, batch_len);
+    quadtree_assert_equiv(&q_many, &q_handle);
+    quadtree_free(&q_many);
     // begin time delete
     start = clock();
     quadtree_free(&q_new);
@@ -184,6 +360,34 @@ int main() {
     fprintf(stderr, "cloning with %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
     // end time clone
     quadtree_assert_equiv(&q, &q_new);
+    // begin time snapshot
+    Quadtree q_snap, q_check;
+    start = clock();
+    quadtree_snapshot(&q_snap, &q);
+    end = clock();
+    fprintf(stderr, "taking a snapshot with %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    quadtree_free(&q_snap);
+    start = clock();
+    quadtree_snapshot(&q_snap, &q);
+    for (size_t i = 0, k = 0; k < batch_len; i += 61, k++)
+        quadtree_move_handle(&q_snap, handles[i], &new_bounds[k], NULL);
+    end = clock();
+    fprintf(stderr, "taking a snapshot and moving %zu elements took %.3f ms.\n", batch_len, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // same changes on a clone for comparison
+    start = clock();
+    quadtree_clone(&q_check, &q_new);
+    for (size_t i = 0, k = 0; k < batch_len; i += 61, k++)
+        quadtree_move_handle(&q_check, handles[i], &new_bounds[k], NULL);
+    end = clock();
+    fprintf(stderr, "cloning and moving %zu elements took %.3f ms.\n", batch_len, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time snapshot
+    // changing the snapshot leaves the original alone
+    quadtree_assert_equiv(&q, &q_new);
+    quadtree_assert_equiv(&q_snap, &q_check);
+    quadtree_free(&q_check);
+    quadtree_free(&q_snap);
+    // and the other way around, while the original is emptied below
+    quadtree_snapshot(&q_snap, &q);
     // begin time remove
     start = clock();
     Box temp;
@@ -199,13 +403,243 @@ int main() {
     TEST_ASSERT(q.data_len == 0 && "root has children after removing children");
     // end time remove
     quadtree_free(&q);
+    quadtree_assert_equiv(&q_snap, &q_new);
+    for (size_t i = 0; i < NUM_BOXES; i++)
+        TEST_ASSERT(((Box *)quadtree_get(&q_snap, handles[i]))->idx == i);
+    quadtree_free(&q_snap);
+    // begin time remove by handle
+    start = clock();
+    for (size_t i = 0; i < NUM_BOXES; i++) {
+        quadtree_remove_handle(&q_handle, handles[i], &temp);
+        TEST_ASSERT(temp.idx == boxes[i].idx);
+    }
+    end = clock();
+    fprintf(stderr, "removing %d elements by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    TEST_ASSERT(!q_handle.child[0] && q_handle.data_len == 0);
+    // end time remove by handle
+    quadtree_free(&q_handle);
     // begin time delete
     start = clock();
     quadtree_free(&q_new);
     end = clock();
     fprintf(stderr, "deleting with %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
     // end time delete
+    // begin time split/merge churn
+    // sixteen boxes stacked in one spot subdivide all the way down to
+    // max_depth on insert and unsubdivide all the way back up on remove
+    Box churn[16];
+    for (int i = 0; i < 16; i++) {
+        aabb_init(&churn[i].aabb, 1, 1, 2, 2);
+        churn[i].idx = i;
+    }
+    quadtree_init(&q, &bounds, 8, sizeof(Box));
+    start = clock();
+    for (int n = 0; n < CHURN_ITERATIONS; n++) {
+        for (int i = 0; i < 16; i++)
+            quadtree_insert(&q, &churn[i]);
+        TEST_ASSERT(q.child[0] != NULL);
+        for (int i = 0; i < 16; i++)
+            quadtree_remove(&q, &churn[i], box_equal, NULL);
+        TEST_ASSERT(q.child[0] == NULL);
+    }
+    end = clock();
+    fprintf(stderr, "splitting and merging %d times took %.3f ms.\n", CHURN_ITERATIONS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time split/merge churn
+    // stacked up again, they all end up in the one node at the bottom
+    QuadtreeStats stats;
+    QuadtreeCounters counters;
+    quadtree_reset_counters(&q);
+    for (int i = 0; i < 16; i++)
+        quadtree_insert(&q, &churn[i]);
+    quadtree_stats(&q, &stats);
+    TEST_ASSERT(stats.depth == 8 && stats.nodes == 1 + 4 * 8 && stats.leaves == 1 + 3 * 8);
+    TEST_ASSERT(stats.elements == 16 && stats.elements_per_level[8] == 16);
+    for (int d = 1; d <= 8; d++)
+        TEST_ASSERT(stats.nodes_per_level[d] == 4 && stats.elements_per_level[d - 1] == 0);
+    TEST_ASSERT(stats.holes == 0 && stats.capacity == stats.elements + stats.slack);
+    TEST_ASSERT(stats.node_bytes > 0 && stats.data_bytes > 0);
+    // a query around them goes straight down to it
+    AABB corner;
+    aabb_init(&corner, 0, 0, 3, 3);
+    quadtree_get_counters(&q, &counters);
+    TEST_ASSERT(counters.splits == 8 && counters.reallocs > 0 && counters.queries == 0);
+    size_t corner_hits = 0;
+    quadtree_traverse(&q, &corner, count_hit, &corner_hits);
+    quadtree_get_counters(&q, &counters);
+    TEST_ASSERT(corner_hits == 16 && counters.queries == 1 && counters.nodes_visited == 9);
+    QuadtreeQuery corner_it;
+    quadtree_query_begin(&corner_it, &q, &corner);
+    while (quadtree_query_next(&corner_it));
+    quadtree_get_counters(&q, &counters);
+    TEST_ASSERT(counters.queries == 2 && counters.nodes_visited == 18);
+    quadtree_free(&q);
+    // begin time oscillation
+    // fifteen boxes stay in one spot and a sixteenth moves in and out,
+    // which splits and merges every level with the default thresholds
+    QuadtreeConfig config;
+    AABB near, far;
+    aabb_init(&near, 1, 1, 2, 2);
+    aabb_init(&far, WIDTH - 2, HEIGHT - 2, WIDTH - 1, HEIGHT - 1);
+    for (int mode = 0; mode < 3; mode++) {
+        quadtree_init(&q, &bounds, 8, sizeof(Box));
+        quadtree_default_config(&config);
+        if (mode == 1)
+            config.merge_threshold = 8;
+        else if (mode == 2)
+            config.min_lifetime = 1000;
+        quadtree_set_config(&q, &config);
+        QuadtreeHandle h = QUADTREE_NO_HANDLE;
+        for (int i = 0; i < 16; i++)
+            h = quadtree_insert(&q, &churn[i]);
+        quadtree_reset_counters(&q);
+        start = clock();
+        for (int n = 0; n < CHURN_ITERATIONS; n++) {
+            quadtree_move_handle(&q, h, &far, NULL);
+            quadtree_move_handle(&q, h, &near, NULL);
+        }
+        end = clock();
+        quadtree_get_counters(&q, &counters);
+        fprintf(stderr, "oscillating %d times with merge threshold %zu and lifetime %zu took %.3f ms (%zu splits, %zu merges).\n",
+                CHURN_ITERATIONS, config.merge_threshold, config.min_lifetime,
+                (end - start) * 1000.0 / CLOCKS_PER_SEC, counters.splits, counters.merges);
+        TEST_ASSERT(counters.splits == counters.merges);
+        if (mode == 0)
+            TEST_ASSERT(counters.splits >= (size_t)CHURN_ITERATIONS && counters.splits % CHURN_ITERATIONS == 0);
+        else if (mode == 1)
+            TEST_ASSERT(counters.splits == 0);
+        else
+            TEST_ASSERT(counters.splits <= (size_t)CHURN_ITERATIONS * 8 * 2 / 1000 + 8);
+        TEST_ASSERT(q.child[0] != NULL);
+        quadtree_free(&q);
+    }
+    // end time oscillation
+    // begin time dense query
+    // a tree of depth 0 keeps everything in the root, so every query
+    // has to test all of them. small boxes keep the callbacks rare.
+    for (int i = 0; i < NUM_BOXES; i++) {
+        int x = rand() % WIDTH, y = rand() % HEIGHT;
+        aabb_init(&boxes[i].aabb, x, y, x + 1 + rand() % 16, y + 1 + rand() % 16);
+    }
+    quadtree_build(&q, &bounds, 0, sizeof(Box), boxes, NUM_BOXES, NULL);
+    size_t hits = 0, expected = 0;
+    AABB query;
+    int seed = rand();
+    srand(seed);
+    start = clock();
+    for (int n = 0; n < DENSE_QUERIES; n++) {
+        int x = rand() % WIDTH, y = rand() % HEIGHT;
+        aabb_init(&query, x, y, x + 16, y + 16);
+        quadtree_traverse(&q, &query, count_hit, &hits);
+    }
+    end = clock();
+    fprintf(stderr, "querying one node with %d elements %d times took %.3f ms (%.1f M elements/s).\n",
+            NUM_BOXES, DENSE_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC,
+            (double)NUM_BOXES * DENSE_QUERIES / 1e6 / ((double)(end - start) / CLOCKS_PER_SEC));
+    srand(seed);
+    for (int n = 0; n < DENSE_QUERIES; n++) {
+        int x = rand() % WIDTH, y = rand() % HEIGHT;
+        aabb_init(&query, x, y, x + 16, y + 16);
+        for (int i = 0; i < NUM_BOXES; i++)
+            expected += aabb_intersect(&query, &boxes[i].aabb);
+    }
+    TEST_ASSERT(hits == expected);
+    quadtree_free(&q);
+    // end time dense query
+    // begin time find pairs
+    // boxes are the first NUM_PAIR_BOXES small ones from above
+    quadtree_build(&q, &bounds, 8, sizeof(Box), boxes, NUM_PAIR_BOXES, NULL);
+    size_t pairs_cap = 1024;
+    QuadtreePair *pairs = malloc(sizeof(QuadtreePair) * pairs_cap);
+    start = clock();
+    size_t num_pairs = quadtree_find_pairs(&q, pairs, pairs_cap);
+    if (num_pairs > pairs_cap) {
+        pairs_cap = num_pairs;
+        pairs = realloc(pairs, sizeof(QuadtreePair) * pairs_cap);
+        TEST_ASSERT(quadtree_find_pairs(&q, pairs, pairs_cap) == num_pairs);
+    }
+    end = clock();
+    fprintf(stderr, "finding %zu pairs among %d elements took %.3f ms.\n", num_pairs, NUM_PAIR_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time find pairs
+    // begin time traverse per element
+    hits = 0;
+    start = clock();
+    for (int i = 0; i < NUM_PAIR_BOXES; i++)
+        quadtree_traverse(&q, &boxes[i].aabb, count_hit, &hits);
+    end = clock();
+    fprintf(stderr, "querying each of %d elements took %.3f ms.\n", NUM_PAIR_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time traverse per element
+    // every pair is found twice, and every element finds itself
+    TEST_ASSERT(hits == 2 * num_pairs + NUM_PAIR_BOXES);
+    uint64_t *found = malloc(sizeof(uint64_t) * num_pairs);
+    for (size_t i = 0; i < num_pairs; i++)
+        found[i] = pair_key(((Box *)pairs[i].a)->idx, ((Box *)pairs[i].b)->idx);
+    qsort(found, num_pairs, sizeof(uint64_t), compare_u64);
+    size_t k = 0;
+    for (int i = 0; i < NUM_PAIR_BOXES; i++) {
+        for (int j = i + 1; j < NUM_PAIR_BOXES; j++) {
+            if (aabb_intersect(&boxes[i].aabb, &boxes[j].aabb)) {
+                TEST_ASSERT(k < num_pairs && found[k] == pair_key(boxes[i].idx, boxes[j].idx));
+                k++;
+            }
+        }
+    }
+    TEST_ASSERT(k == num_pairs);
+    free(found);
+    free(pairs);
+    quadtree_free(&q);
+    // begin time query batch
+    // every one of the small boxes looks for what it touches
+    quadtree_build(&q, &bounds, 8, sizeof(Box), boxes, NUM_BOXES, NULL);
+    AABB *batch_queries = malloc(sizeof(AABB) * NUM_BOXES);
+    for (int i = 0; i < NUM_BOXES; i++)
+        batch_queries[i] = boxes[i].aabb;
+    size_t *offsets = malloc(sizeof(size_t) * (NUM_BOXES + 1));
+    // the batch visits the same nodes as querying one at a time to
+    // count the hits, with each thread counting its own
+    quadtree_reset_counters(&q);
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_traverse(&q, &batch_queries[i], count_hit, &hits);
+    quadtree_get_counters(&q, &counters);
+    size_t batch_visited = counters.nodes_visited;
+    quadtree_reset_counters(&q);
+    // too small a buffer still gives the total
+    size_t batch_total = quadtree_query_batch(&q, batch_queries, NUM_BOXES, NULL, 0, offsets, 2);
+    quadtree_get_counters(&q, &counters);
+    TEST_ASSERT(counters.queries == NUM_BOXES && counters.nodes_visited == batch_visited);
+    void **results = malloc(sizeof(void *) * batch_total);
+    list.els = malloc(sizeof(void *) * NUM_BOXES);
+    for (unsigned int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        quadtree_reset_counters(&q);
+        struct timespec wall_start, wall_end;
+        start = clock();
+        timespec_get(&wall_start, TIME_UTC);
+        TEST_ASSERT(quadtree_query_batch(&q, batch_queries, NUM_BOXES, results, batch_total, offsets, threads) == batch_total);
+        timespec_get(&wall_end, TIME_UTC);
+        end = clock();
+        fprintf(stderr, "querying %d times on %u threads took %.3f ms (%.3f ms cpu).\n", NUM_BOXES, threads,
+                (wall_end.tv_sec - wall_start.tv_sec) * 1000.0 + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e6,
+                (end - start) * 1000.0 / CLOCKS_PER_SEC);
+        quadtree_get_counters(&q, &counters);
+        // and then the ones with hits again to write them
+        TEST_ASSERT(counters.queries == NUM_BOXES);
+        TEST_ASSERT(counters.nodes_visited > batch_visited && counters.nodes_visited <= 2 * batch_visited);
+        for (int i = 0; i < NUM_BOXES; i += 97) {
+            list.len = 0;
+            quadtree_traverse(&q, &batch_queries[i], list_hit, &list);
+            TEST_ASSERT(offsets[i + 1] - offsets[i] == list.len);
+            TEST_ASSERT(memcmp(results + offsets[i], list.els, list.len * sizeof(void *)) == 0);
+        }
+    }
+    free(list.els);
+    free(results);
+    free(offsets);
+    free(batch_queries);
+    quadtree_free(&q);
+    // end time query batch
     free(boxes);
     free(new_pos);
+    free(handles);
+    free(many_handles);
+    free(new_bounds);
     return 0;
 }
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 65536
+#endif
+#ifndef NUM_RAYS
+#define NUM_RAYS 65536
+#endif
+#ifndef NUM_CHECKS
+#define NUM_CHECKS 2048
+#endif
+#ifndef RAY_LENGTH
+#define RAY_LENGTH 512
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+
+struct ray_t {
+    double x, y, dx, dy;
+    int width, height;
+};
+
+typedef struct ray_t Ray;
+
+// line of sight checks, some along one axis and some on node lines, and
+// every other one a box
+static void randomize_rays(Ray *rays) {
+    for (int i = 0; i < NUM_RAYS; i++) {
+        Ray *r = &rays[i];
+        r->x = rand() % 8 ? rand() % WIDTH + 0.5 : (rand() % 16) * (WIDTH / 16);
+        r->y = rand() % HEIGHT + (rand() % 8) / 8.0;
+        r->dx = rand() % 8 ? rand() % (2 * RAY_LENGTH + 1) - RAY_LENGTH : 0;
+        r->dy = rand() % 8 ? rand() % (2 * RAY_LENGTH + 1) - RAY_LENGTH : 0;
+        r->width = i % 2 ? 1 + rand() % 16 : 0;
+        r->height = i % 2 ? 1 + rand() % 16 : 0;
+    }
+}
+
+// the old way: everything in the swept bounds, tested one at a time
+struct first_hit_t {
+    const Ray *ray;
+    double t;
+    Box *hit;
+};
+
+static void sweep_hit(void *first_, void *box_) {
+    struct first_hit_t *first = first_;
+    Box *box = box_;
+    const Ray *r = first->ray;
+    double t = aabb_sweep(&box->aabb, r->x, r->y, 1.0 / r->dx, 1.0 / r->dy, r->width, r->height, NULL);
+    if (t >= 0.0 && t < first->t) {
+        first->t = t;
+        first->hit = box;
+    }
+}
+
+static Box *traverse_raycast(Quadtree *q, const Ray *r, double *t) {
+    struct first_hit_t first = {r, 2.0, NULL};
+    AABB bounds;
+    aabb_init_bounding(&bounds, r->x, r->y, r->dx, r->dy, r->width, r->height);
+    // boxes only touching the bounds can still be hit just below t = 1
+    aabb_init(&bounds, bounds.x1 - 1, bounds.y1 - 1, bounds.x2 + 1, bounds.y2 + 1);
+    quadtree_traverse(q, &bounds, sweep_hit, &first);
+    *t = first.hit ? first.t : -1.0;
+    return first.hit;
+}
+
+// checks the first hit against sweeping against every box
+static size_t check_rays(Quadtree *q, const Box *boxes, const bool *removed, const Ray *rays) {
+    size_t found = 0;
+    for (int i = 0; i < NUM_CHECKS; i++) {
+        const Ray *r = &rays[i];
+        double best = 2.0;
+        for (int j = 0; j < NUM_BOXES; j++) {
+            if (removed[j])
+                continue;
+            double th = aabb_sweep(&boxes[j].aabb, r->x, r->y, 1.0 / r->dx, 1.0 / r->dy, r->width, r->height, NULL);
+            if (th >= 0.0 && th < best)
+                best = th;
+        }
+        double th;
+        AABBEdge edge;
+        Box *hit = quadtree_raycast(q, r->x, r->y, r->dx, r->dy, r->width, r->height, &th, &edge);
+        if (best > 1.0) {
+            TEST_ASSERT(hit == NULL && th == -1.0);
+            continue;
+        }
+        TEST_ASSERT(hit != NULL && th == best && !removed[hit->idx]);
+        // ties can pick either box, but the one picked has to be hit there
+        AABBEdge expected;
+        TEST_ASSERT(aabb_sweep(&hit->aabb, r->x, r->y, 1.0 / r->dx, 1.0 / r->dy, r->width, r->height, &expected) == th);
+        TEST_ASSERT(edge == expected);
+        found++;
+    }
+    return found;
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES);
+    Ray *rays = malloc(sizeof(Ray) * NUM_RAYS);
+    bool *removed = calloc(NUM_BOXES, sizeof(bool));
+    random_boxes(boxes, NUM_BOXES, WIDTH, HEIGHT, 4, 16);
+    randomize_rays(rays);
+    Quadtree q, lq;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    quadtree_init_loose(&lq, &bounds, DEPTH, sizeof(Box), 2.0);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        quadtree_insert(&q, &boxes[i]);
+        quadtree_insert(&lq, &boxes[i]);
+    }
+    size_t found = check_rays(&q, boxes, removed, rays);
+    TEST_ASSERT(check_rays(&lq, boxes, removed, rays) == found);
+    fprintf(stderr, "%zu of %d rays hit.\n", found, NUM_CHECKS);
+    clock_t start, end;
+    double sum = 0, traverse_sum = 0;
+    // begin time traverse raycast
+    start = clock();
+    for (int i = 0; i < NUM_RAYS; i++) {
+        double th;
+        traverse_raycast(&q, &rays[i], &th);
+        traverse_sum += th;
+    }
+    end = clock();
+    fprintf(stderr, "casting %d rays by traversing their bounds took %.3f ms.\n",
+            NUM_RAYS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time traverse raycast
+    // begin time raycast
+    start = clock();
+    for (int i = 0; i < NUM_RAYS; i++) {
+        const Ray *r = &rays[i];
+        double th;
+        quadtree_raycast(&q, r->x, r->y, r->dx, r->dy, r->width, r->height, &th, NULL);
+        sum += th;
+    }
+    end = clock();
+    fprintf(stderr, "casting %d rays with quadtree_raycast took %.3f ms.\n",
+            NUM_RAYS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time raycast
+    TEST_ASSERT(sum == traverse_sum);
+    // begin time loose raycast
+    start = clock();
+    for (int i = 0; i < NUM_RAYS; i++) {
+        const Ray *r = &rays[i];
+        quadtree_raycast(&lq, r->x, r->y, r->dx, r->dy, r->width, r->height, NULL, NULL);
+    }
+    end = clock();
+    fprintf(stderr, "casting %d rays with quadtree_raycast on a loose quadtree took %.3f ms.\n",
+            NUM_RAYS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time loose raycast
+    // removing leaves holes in the nodes, which are skipped
+    for (int i = 0; i < NUM_BOXES; i += 3) {
+        quadtree_remove(&q, &boxes[i], box_equal, NULL);
+        removed[i] = true;
+    }
+    found = check_rays(&q, boxes, removed, rays);
+    fprintf(stderr, "%zu of %d rays hit after removing a third.\n", found, NUM_CHECKS);
+    // and an empty tree has nothing to hit
+    Quadtree empty;
+    quadtree_init(&empty, &bounds, DEPTH, sizeof(Box));
+    TEST_ASSERT(quadtree_raycast(&empty, 0.5, 0.5, 100.0, 100.0, 0, 0, NULL, NULL) == NULL);
+    quadtree_free(&empty);
+    quadtree_free(&q);
+    quadtree_free(&lq);
+    free(boxes);
+    free(rays);
+    free(removed);
+    return 0;
+}
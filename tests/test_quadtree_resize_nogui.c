@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+// the world starts out this big and ends up WORLD_SCALE times as wide
+#define START_SIZE 1024
+#define START_DEPTH 4
+#define WORLD_SCALE 32
+#ifndef NUM_BOXES
+#define NUM_BOXES 65536
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 4096
+#endif
+#ifndef NUM_CHECKS
+#define NUM_CHECKS 256
+#endif
+#ifndef QUERY_SIZE
+#define QUERY_SIZE 256
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+
+// half the width of the part of the world that's been streamed in when
+// element i is added
+static int radius_at(int i) {
+    return START_SIZE / 2 + (int)((long long)i * (START_SIZE * WORLD_SCALE / 2 - START_SIZE / 2) / NUM_BOXES);
+}
+
+// boxes around the middle of the starting world, further out over time
+static void randomize(Box *boxes) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        int r = radius_at(i);
+        int x1 = START_SIZE / 2 - r + rand() % (2 * r), y1 = START_SIZE / 2 - r + rand() % (2 * r);
+        aabb_init(&boxes[i].aabb, x1, y1, x1 + 4 + rand() % 16, y1 + 4 + rand() % 16);
+        boxes[i].idx = i;
+    }
+}
+
+static void randomize_query(AABB *query) {
+    int r = radius_at(NUM_BOXES), x1 = START_SIZE / 2 - r + rand() % (2 * r), y1 = START_SIZE / 2 - r + rand() % (2 * r);
+    aabb_init(query, x1, y1, x1 + QUERY_SIZE, y1 + QUERY_SIZE);
+}
+
+struct hits_t {
+    size_t count;
+    unsigned long sum;
+};
+
+static void count_hit(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    hits->count++;
+    hits->sum += box->idx;
+}
+
+// checks queries against every box, and handles against their elements
+static void check_tree(Quadtree *q, const Box *boxes, const bool *removed, const QuadtreeHandle *handles) {
+    for (int i = 0; i < NUM_CHECKS; i++) {
+        AABB query;
+        randomize_query(&query);
+        struct hits_t expected = {0, 0}, hits = {0, 0};
+        for (int j = 0; j < NUM_BOXES; j++) {
+            if (!removed[j] && aabb_intersect(&query, &boxes[j].aabb))
+                count_hit(&expected, (void *)&boxes[j]);
+        }
+        quadtree_traverse(q, &query, count_hit, &hits);
+        TEST_ASSERT(hits.count == expected.count && hits.sum == expected.sum);
+    }
+    if (!handles)
+        return;
+    for (int i = 0; i < NUM_BOXES; i++) {
+        if (!removed[i])
+            TEST_ASSERT(((Box *)quadtree_get(q, handles[i]))->idx == (unsigned int)i);
+    }
+}
+
+static double time_queries(Quadtree *q, const AABB *queries, struct hits_t *hits) {
+    clock_t start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse(q, (AABB *)&queries[i], count_hit, hits);
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static int box_width(const Quadtree *q) {
+    AABB box;
+    quadtree_get_box(q, &box);
+    return box.x2 - box.x1;
+}
+
+int main() {
+    srand(RAND_SEED);
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES);
+    AABB *queries = malloc(sizeof(AABB) * NUM_QUERIES);
+    bool *removed = calloc(NUM_BOXES, sizeof(bool));
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES),
+                   *loose_handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    randomize(boxes);
+    for (int i = 0; i < NUM_QUERIES; i++)
+        randomize_query(&queries[i]);
+    // one tree stuck with the starting box, one that resizes itself, a
+    // loose one that does too, and one made big enough up front with
+    // leaves the same size
+    AABB start_box, world_box;
+    aabb_init(&start_box, 0, 0, START_SIZE, START_SIZE);
+    aabb_init(&world_box, START_SIZE / 2 - radius_at(NUM_BOXES), START_SIZE / 2 - radius_at(NUM_BOXES),
+              START_SIZE / 2 + radius_at(NUM_BOXES), START_SIZE / 2 + radius_at(NUM_BOXES));
+    Quadtree fixed, q, lq, big;
+    QuadtreeConfig config;
+    quadtree_init(&fixed, &start_box, START_DEPTH, sizeof(Box));
+    quadtree_init(&q, &start_box, START_DEPTH, sizeof(Box));
+    quadtree_init_loose(&lq, &start_box, START_DEPTH, sizeof(Box), 2.0);
+    quadtree_init(&big, &world_box, START_DEPTH + 5, sizeof(Box));
+    quadtree_default_config(&config);
+    config.auto_resize = true;
+    quadtree_set_config(&q, &config);
+    quadtree_set_config(&lq, &config);
+    clock_t start, end;
+    // a snapshot taken before anything grows still sees the old tree
+    for (int i = 0; i < NUM_BOXES / 64; i++)
+        handles[i] = quadtree_insert(&q, &boxes[i]);
+    Quadtree snap;
+    quadtree_snapshot(&snap, &q);
+    int snap_width = box_width(&snap);
+    size_t snap_depth = snap.max_depth;
+    for (int i = 0; i < NUM_BOXES; i++) {
+        quadtree_insert(&fixed, &boxes[i]);
+        quadtree_insert(&big, &boxes[i]);
+    }
+    // begin time insert
+    start = clock();
+    for (int i = NUM_BOXES / 64; i < NUM_BOXES; i++)
+        handles[i] = quadtree_insert(&q, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements into a growing quadtree took %.3f ms.\n",
+            NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time insert
+    for (int i = 0; i < NUM_BOXES; i++)
+        loose_handles[i] = quadtree_insert(&lq, &boxes[i]);
+    QuadtreeCounters counters;
+    quadtree_get_counters(&q, &counters);
+    fprintf(stderr, "grew %zu times to %d wide, depth %zu; the fixed tree keeps %zu elements in its root.\n",
+            counters.grows, box_width(&q), q.max_depth, fixed.data_len);
+    // the old root stays where it is, so the box grows lopsided
+    AABB grown;
+    quadtree_get_box(&q, &grown);
+    TEST_ASSERT(aabb_contains(&grown, &world_box) && counters.grows == q.max_depth - START_DEPTH);
+    // the leaves stay the same size
+    TEST_ASSERT(box_width(&q) >> q.max_depth == START_SIZE >> START_DEPTH);
+    TEST_ASSERT(box_width(&snap) == snap_width && snap.max_depth == snap_depth);
+    bool *later = calloc(NUM_BOXES, sizeof(bool));
+    for (int i = NUM_BOXES / 64; i < NUM_BOXES; i++)
+        later[i] = true;
+    check_tree(&snap, boxes, later, handles);
+    free(later);
+    quadtree_free(&snap);
+    check_tree(&q, boxes, removed, handles);
+    check_tree(&lq, boxes, removed, loose_handles);
+    check_tree(&fixed, boxes, removed, NULL);
+    struct hits_t fixed_hits = {0, 0}, hits = {0, 0}, loose_hits = {0, 0}, big_hits = {0, 0};
+    // begin time queries
+    fprintf(stderr, "querying %d times took %.3f ms with the starting box, %.3f ms growing, %.3f ms loose and growing, %.3f ms sized up front.\n",
+            NUM_QUERIES, time_queries(&fixed, queries, &fixed_hits), time_queries(&q, queries, &hits),
+            time_queries(&lq, queries, &loose_hits), time_queries(&big, queries, &big_hits));
+    // end time queries
+    TEST_ASSERT(hits.count == fixed_hits.count && hits.sum == fixed_hits.sum);
+    TEST_ASSERT(loose_hits.count == fixed_hits.count && loose_hits.sum == fixed_hits.sum);
+    TEST_ASSERT(big_hits.count == fixed_hits.count && big_hits.sum == fixed_hits.sum);
+    // moving everything in one batch grows the root first
+    AABB *moved = malloc(sizeof(AABB) * NUM_BOXES), spread;
+    for (int i = 0; i < NUM_BOXES; i++) {
+        const AABB *b = &boxes[i].aabb;
+        aabb_init(&moved[i], b->x1 * 4, b->y1 * 4, b->x1 * 4 + (b->x2 - b->x1), b->y1 * 4 + (b->y2 - b->y1));
+    }
+    aabb_init(&spread, world_box.x1 * 4, world_box.y1 * 4, world_box.x2 * 4, world_box.y2 * 4);
+    quadtree_move_many(&lq, loose_handles, moved, NUM_BOXES);
+    quadtree_get_box(&lq, &grown);
+    TEST_ASSERT(aabb_contains(&grown, &spread) && lq.data_len < (size_t)NUM_BOXES / 64);
+    quadtree_move_many(&lq, loose_handles, (AABB *)boxes, 0);
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_move_handle(&lq, loose_handles[i], &boxes[i].aabb, NULL);
+    check_tree(&lq, boxes, removed, loose_handles);
+    free(moved);
+    // the streamed in part moves on: everything but what's in a node a
+    // few levels down is removed, and the tree shrinks to fit around it.
+    // anything left crossing the root's midlines would stop that.
+    int keep_at = START_SIZE / 2 + radius_at(NUM_BOXES) / 2;
+    AABB keep_box;
+    Quadtree *node = &q;
+    for (int d = 0; d < 3 && node->child[0]; d++) {
+        for (int i = 0; i < 4; i++) {
+            quadtree_get_box(node->child[i], &keep_box);
+            if (keep_box.x1 <= keep_at && keep_at < keep_box.x2 && keep_box.y1 <= keep_at && keep_at < keep_box.y2) {
+                node = node->child[i];
+                break;
+            }
+        }
+    }
+    quadtree_get_box(node, &keep_box);
+    size_t kept = 0;
+    for (int i = 0; i < NUM_BOXES; i++) {
+        if (aabb_contains(&keep_box, &boxes[i].aabb)) {
+            kept++;
+            continue;
+        }
+        quadtree_remove(&q, &boxes[i], box_equal, NULL);
+        quadtree_remove_handle(&lq, loose_handles[i], NULL);
+        quadtree_remove(&fixed, &boxes[i], box_equal, NULL);
+        removed[i] = true;
+    }
+    // it takes as many operations as there are elements to shrink, so
+    // wiggle everything in place
+    for (int n = 0; n < 2; n++) {
+        for (int i = 0; i < NUM_BOXES; i++) {
+            if (removed[i])
+                continue;
+            quadtree_move(&q, &boxes[i], box_equal, &boxes[i].aabb, NULL);
+            quadtree_move_handle(&lq, loose_handles[i], &boxes[i].aabb, NULL);
+        }
+    }
+    quadtree_get_counters(&q, &counters);
+    fprintf(stderr, "shrank %zu times to %d wide around %zu elements.\n", counters.shrinks, box_width(&q), kept);
+    TEST_ASSERT(counters.shrinks == 3 && box_width(&q) == keep_box.x2 - keep_box.x1);
+    TEST_ASSERT(box_width(&q) >> q.max_depth == START_SIZE >> START_DEPTH);
+    quadtree_get_counters(&lq, &counters);
+    TEST_ASSERT(counters.shrinks >= 1);
+    check_tree(&q, boxes, removed, handles);
+    check_tree(&lq, boxes, removed, loose_handles);
+    check_tree(&fixed, boxes, removed, NULL);
+    // and grows back when something comes back
+    quadtree_insert(&q, &boxes[0]);
+    removed[0] = false;
+    check_tree(&q, boxes, removed, NULL);
+    quadtree_free(&fixed);
+    quadtree_free(&q);
+    quadtree_free(&lq);
+    quadtree_free(&big);
+    // a tree can't get deeper than QUADTREE_MAX_DEPTH, so past that
+    // elements outside stay in the root
+    quadtree_init(&q, &start_box, QUADTREE_MAX_DEPTH - 1, sizeof(Box));
+    quadtree_set_config(&q, &config);
+    Box far = {{0, 0, 1, 1}, 0};
+    aabb_init(&far.aabb, START_SIZE * 4, START_SIZE * 4, START_SIZE * 4 + 1, START_SIZE * 4 + 1);
+    quadtree_insert(&q, &far);
+    TEST_ASSERT(q.max_depth == QUADTREE_MAX_DEPTH && box_width(&q) == 2 * START_SIZE && q.data_len == 1);
+    quadtree_traverse(&q, &far.aabb, count_hit, &hits);
+    quadtree_free(&q);
+    free(boxes);
+    free(queries);
+    free(removed);
+    free(handles);
+    free(loose_handles);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 65536
+#endif
+#ifndef NUM_QUERIES
+#define NUM_QUERIES 65536
+#endif
+#ifndef QUERY_SIZE
+#define QUERY_SIZE 64
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+#ifndef SHIFT_AMOUNT
+#define SHIFT_AMOUNT 64
+#endif
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+#ifndef CELL_SIZE
+#define CELL_SIZE 64
+#endif
+
+// tile-sized boxes, mostly 16px with some 64px ones
+static void randomize(Box *boxes) {
+    for (int i = 0; i < NUM_BOXES; i++) {
+        int x1 = rand() % WIDTH, y1 = rand() % HEIGHT;
+        int size = rand() % 4 ? 16 : 64;
+        aabb_init(&boxes[i].aabb, x1, y1, x1 + size, y1 + size);
+    }
+}
+
+struct hits_t {
+    size_t count;
+    unsigned long sum;
+};
+
+static void count_hit(void *hits_, void *box_) {
+    struct hits_t *hits = hits_;
+    Box *box = box_;
+    hits->count++;
+    hits->sum += box->idx;
+}
+
+// runs every query on both and checks that they find the same boxes
+static void query_both(Quadtree *q, SpatialHash *g, AABB *queries) {
+    static struct hits_t hits[NUM_QUERIES], grid_hits[NUM_QUERIES];
+    clock_t start, end;
+    memset(hits, 0, sizeof hits);
+    memset(grid_hits, 0, sizeof grid_hits);
+    // begin time query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        quadtree_traverse(q, &queries[i], count_hit, &hits[i]);
+    end = clock();
+    fprintf(stderr, "querying %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time query
+    // begin time grid query
+    start = clock();
+    for (int i = 0; i < NUM_QUERIES; i++)
+        spatial_hash_traverse(g, &queries[i], count_hit, &grid_hits[i]);
+    end = clock();
+    fprintf(stderr, "querying spatial hash %d times took %.3f ms.\n", NUM_QUERIES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time grid query
+    size_t total = 0;
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        TEST_ASSERT(hits[i].count == grid_hits[i].count);
+        TEST_ASSERT(hits[i].sum == grid_hits[i].sum);
+        total += hits[i].count;
+    }
+    fprintf(stderr, "found %zu intersections.\n", total);
+}
+
+int main() {
+    srand(RAND_SEED);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    SpatialHash g;
+    quadtree_init(&q, &bounds, DEPTH, sizeof(Box));
+    spatial_hash_init(&g, CELL_SIZE, sizeof(Box));
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES),
+        *new_pos = malloc(sizeof(Box) * NUM_BOXES);
+    QuadtreeHandle *handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    SpatialHashHandle *grid_handles = malloc(sizeof(SpatialHashHandle) * NUM_BOXES);
+    AABB *queries = malloc(sizeof(AABB) * NUM_QUERIES);
+    for (int i = 0; i < NUM_BOXES; i++) {
+        boxes[i].idx = i;
+    }
+    randomize(boxes);
+    memcpy(new_pos, boxes, NUM_BOXES * sizeof(Box));
+    // some of them end up outside the world, which the grid doesn't mind
+    shift_boxes(new_pos, NUM_BOXES, SHIFT_AMOUNT);
+    random_queries(queries, NUM_QUERIES, WIDTH, HEIGHT, QUERY_SIZE);
+    clock_t start, end;
+    // begin time insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        handles[i] = quadtree_insert(&q, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time insert
+    // begin time grid insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        grid_handles[i] = spatial_hash_insert(&g, &boxes[i]);
+    end = clock();
+    fprintf(stderr, "inserting %d elements into spatial hash took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time grid insert
+    query_both(&q, &g, queries);
+    // begin time move by handle
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        quadtree_move_handle(&q, handles[i], &new_pos[i].aabb, NULL);
+    end = clock();
+    fprintf(stderr, "moving %d elements by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time move by handle
+    // begin time grid move by handle
+    Box buf;
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        spatial_hash_move_handle(&g, grid_handles[i], &new_pos[i].aabb, &buf);
+    end = clock();
+    fprintf(stderr, "moving %d elements in spatial hash by handle took %.3f ms.\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time grid move by handle
+    TEST_ASSERT(buf.idx == boxes[NUM_BOXES - 1].idx);
+    query_both(&q, &g, queries);
+    // move back by searching for them
+    for (int i = 0; i < NUM_BOXES; i++) {
+        spatial_hash_move(&g, &new_pos[i], box_equal, &boxes[i].aabb, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx && memcmp(&buf.aabb, &boxes[i].aabb, sizeof(AABB)) == 0);
+        quadtree_move_handle(&q, handles[i], &boxes[i].aabb, NULL);
+    }
+    query_both(&q, &g, queries);
+    for (int i = 0; i < NUM_BOXES; i++)
+        TEST_ASSERT(((Box *)spatial_hash_get(&g, grid_handles[i]))->idx == boxes[i].idx);
+    // remove half by handle and half by searching
+    for (int i = 0; i < NUM_BOXES; i++) {
+        if (i % 2)
+            spatial_hash_remove_handle(&g, grid_handles[i], &buf);
+        else
+            spatial_hash_remove(&g, &boxes[i], box_equal, &buf);
+        TEST_ASSERT(buf.idx == boxes[i].idx);
+    }
+    TEST_ASSERT(g.data_len == 0 && g.cells_len == 0);
+    quadtree_free(&q);
+    spatial_hash_free(&g);
+    free(boxes);
+    free(new_pos);
+    free(handles);
+    free(grid_handles);
+    free(queries);
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "test_common.h"
+
+#define WIDTH 4096
+#define HEIGHT 4096
+#ifndef NUM_BOXES
+#define NUM_BOXES 16384
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+// objects only move a little each frame
+#ifndef SHIFT_AMOUNT
+#define SHIFT_AMOUNT 2
+#endif
+#ifndef NUM_FRAMES
+#define NUM_FRAMES 32
+#endif
+
+static void count_hit(void *count, void *a) {
+    (void)a;
+    (*(size_t *)count)++;
+}
+
+struct events_t {
+    size_t added;
+    size_t removed;
+};
+
+static void pair_added(void *events, SweepPruneHandle a, SweepPruneHandle b) {
+    TEST_ASSERT(a < b);
+    ((struct events_t *)events)->added++;
+}
+
+static void pair_removed(void *events, SweepPruneHandle a, SweepPruneHandle b) {
+    TEST_ASSERT(a < b);
+    ((struct events_t *)events)->removed++;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// checks the pairs against every pair of live boxes
+static void assert_pairs(SweepPrune *sp, const Box *boxes, const bool *live, const SweepPruneHandle *handles) {
+    size_t len = sweep_prune_pairs(sp, NULL, 0);
+    SweepPrunePair *pairs = malloc(sizeof(SweepPrunePair) * (len + 1));
+    TEST_ASSERT(sweep_prune_pairs(sp, pairs, len) == len);
+    uint64_t *found = malloc(sizeof(uint64_t) * (len + 1));
+    for (size_t i = 0; i < len; i++) {
+        TEST_ASSERT(pairs[i].a < pairs[i].b);
+        found[i] = (uint64_t)pairs[i].a << 32 | pairs[i].b;
+    }
+    qsort(found, len, sizeof(uint64_t), compare_u64);
+    uint64_t *expected = malloc(sizeof(uint64_t) * (len + 1));
+    size_t k = 0;
+    for (int i = 0; i < NUM_BOXES; i++) {
+        if (!live[i]) continue;
+        for (int j = i + 1; j < NUM_BOXES; j++) {
+            if (live[j] && aabb_intersect(&boxes[i].aabb, &boxes[j].aabb)) {
+                SweepPruneHandle a = handles[i], b = handles[j];
+                TEST_ASSERT(k < len);
+                expected[k++] = a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+            }
+        }
+    }
+    TEST_ASSERT(k == len);
+    qsort(expected, len, sizeof(uint64_t), compare_u64);
+    TEST_ASSERT(memcmp(found, expected, len * sizeof(uint64_t)) == 0);
+    free(expected);
+    free(pairs);
+    free(found);
+}
+
+int main() {
+    srand(RAND_SEED);
+    Box *boxes = malloc(sizeof(Box) * NUM_BOXES);
+    SweepPruneHandle *handles = malloc(sizeof(SweepPruneHandle) * NUM_BOXES);
+    QuadtreeHandle *qt_handles = malloc(sizeof(QuadtreeHandle) * NUM_BOXES);
+    bool *live = malloc(sizeof(bool) * NUM_BOXES);
+    random_boxes(boxes, NUM_BOXES, WIDTH, HEIGHT, 1, 16);
+    for (int i = 0; i < NUM_BOXES; i++)
+        live[i] = true;
+    struct events_t events = {0, 0};
+    SweepPrune sp;
+    sweep_prune_init(&sp, pair_added, pair_removed, &events);
+    clock_t start, end;
+    // begin time insert
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i++)
+        handles[i] = sweep_prune_insert(&sp, &boxes[i].aabb);
+    sweep_prune_update(&sp);
+    end = clock();
+    fprintf(stderr, "inserting %d elements took %.3f ms (%zu pairs).\n", NUM_BOXES, (end - start) * 1000.0 / CLOCKS_PER_SEC, sp.pairs_len);
+    // end time insert
+    TEST_ASSERT(events.added == sp.pairs_len && events.removed == 0);
+    assert_pairs(&sp, boxes, live, handles);
+    AABB bounds;
+    aabb_init(&bounds, 0, 0, WIDTH, HEIGHT);
+    Quadtree q;
+    quadtree_init(&q, &bounds, 8, sizeof(Box));
+    for (int i = 0; i < NUM_BOXES; i++)
+        qt_handles[i] = quadtree_insert(&q, &boxes[i]);
+    // the same frames are played on both, so seed them the same
+    int seed = rand();
+    // begin time sweep and prune frames
+    srand(seed);
+    start = clock();
+    for (int f = 0; f < NUM_FRAMES; f++) {
+        shift_boxes(boxes, NUM_BOXES, SHIFT_AMOUNT);
+        for (int i = 0; i < NUM_BOXES; i++)
+            sweep_prune_move(&sp, handles[i], &boxes[i].aabb);
+    }
+    end = clock();
+    fprintf(stderr, "moving %d elements for %d frames took %.3f ms (%zu pairs added, %zu removed).\n",
+            NUM_BOXES, NUM_FRAMES, (end - start) * 1000.0 / CLOCKS_PER_SEC, events.added, events.removed);
+    // end time sweep and prune frames
+    TEST_ASSERT(events.added - events.removed == sp.pairs_len);
+    assert_pairs(&sp, boxes, live, handles);
+    // begin time quadtree frames
+    // put the boxes back first
+    srand(seed);
+    for (int f = 0; f < NUM_FRAMES; f++) {
+        for (int i = 0; i < NUM_BOXES; i++) {
+            int sx = rand() % (SHIFT_AMOUNT * 2 + 1) - SHIFT_AMOUNT,
+                sy = rand() % (SHIFT_AMOUNT * 2 + 1) - SHIFT_AMOUNT;
+            boxes[i].aabb.x1 -= sx;
+            boxes[i].aabb.x2 -= sx;
+            boxes[i].aabb.y1 -= sy;
+            boxes[i].aabb.y2 -= sy;
+        }
+    }
+    srand(seed);
+    size_t hits = 0;
+    start = clock();
+    for (int f = 0; f < NUM_FRAMES; f++) {
+        shift_boxes(boxes, NUM_BOXES, SHIFT_AMOUNT);
+        hits = 0;
+        for (int i = 0; i < NUM_BOXES; i++)
+            quadtree_move_handle(&q, qt_handles[i], &boxes[i].aabb, NULL);
+        for (int i = 0; i < NUM_BOXES; i++)
+            quadtree_traverse(&q, &boxes[i].aabb, count_hit, &hits);
+    }
+    end = clock();
+    fprintf(stderr, "moving and querying %d elements for %d frames in a quadtree took %.3f ms.\n",
+            NUM_BOXES, NUM_FRAMES, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time quadtree frames
+    // every pair is found twice, and every element finds itself
+    TEST_ASSERT(hits == 2 * sp.pairs_len + NUM_BOXES);
+    quadtree_free(&q);
+    // begin time remove
+    size_t removed = events.removed;
+    start = clock();
+    for (int i = 0; i < NUM_BOXES; i += 2) {
+        sweep_prune_remove(&sp, handles[i]);
+        live[i] = false;
+    }
+    sweep_prune_update(&sp);
+    end = clock();
+    fprintf(stderr, "removing %d elements took %.3f ms.\n", NUM_BOXES / 2, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time remove
+    TEST_ASSERT(events.removed > removed);
+    TEST_ASSERT(events.added - events.removed == sp.pairs_len);
+    assert_pairs(&sp, boxes, live, handles);
+    // handles are reused, and new boxes are found after the update
+    for (int i = 0; i < NUM_BOXES; i += 2) {
+        handles[i] = sweep_prune_insert(&sp, &boxes[i].aabb);
+        live[i] = true;
+    }
+    sweep_prune_update(&sp);
+    TEST_ASSERT(events.added - events.removed == sp.pairs_len);
+    assert_pairs(&sp, boxes, live, handles);
+    for (int i = 0; i < NUM_BOXES; i++)
+        TEST_ASSERT(memcmp(sweep_prune_get(&sp, handles[i]), &boxes[i].aabb, sizeof(AABB)) == 0);
+    sweep_prune_free(&sp);
+    free(boxes);
+    free(handles);
+    free(qt_handles);
+    free(live);
+}
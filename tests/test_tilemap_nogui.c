@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include "test_common.h"
+
+#define TILE_SIZE 16
+#define MAP_X (-1000)
+#define MAP_Y (-500)
+#ifndef MAP_TILES
+#define MAP_TILES 4096
+#endif
+#ifndef NUM_SWEEPS
+#define NUM_SWEEPS 65536
+#endif
+#ifndef NUM_CHECKS
+#define NUM_CHECKS 4096
+#endif
+#ifndef NUM_MOVERS
+#define NUM_MOVERS 1024
+#endif
+#ifndef RAND_SEED
+#define RAND_SEED 42
+#endif
+// most tiles the rectangle a sweep can cover
+#define GATHER_MAX (1 << 20)
+
+struct sweep_t {
+    double x, y, dx, dy;
+    int width, height;
+};
+
+typedef struct sweep_t Sweep;
+
+// mostly sparse, with some dense bands and some empty chunks
+static void randomize_map(Tilemap *m) {
+    for (int ty = 0; ty < MAP_TILES; ty++) {
+        int cy = ty / TILEMAP_CHUNK_SIZE;
+        for (int tx = 0; tx < MAP_TILES; tx++) {
+            int cx = tx / TILEMAP_CHUNK_SIZE;
+            if (cx % 4 == 3)
+                continue;
+            if (rand() % (cy % 8 == 0 ? 2 : 32) == 0)
+                tilemap_set(m, tx, ty, true);
+        }
+    }
+}
+
+// projectiles, some of them long and some along one axis, some starting
+// on tile lines and some outside the map
+static void randomize_sweep(Sweep *s) {
+    int span = MAP_TILES * TILE_SIZE;
+    if (rand() % 4) {
+        s->x = MAP_X - 64 + rand() % (span + 128) + (rand() % 16) / 16.0;
+        s->y = MAP_Y - 64 + rand() % (span + 128) + (rand() % 16) / 16.0;
+    } else {
+        s->x = MAP_X + (rand() % (MAP_TILES + 4) - 2) * TILE_SIZE;
+        s->y = MAP_Y + (rand() % (MAP_TILES + 4) - 2) * TILE_SIZE;
+    }
+    int reach = rand() % 4 ? 64 : 4096;
+    s->dx = rand() % 8 ? (rand() % (2 * reach * 8 + 1) - reach * 8) / 8.0 : 0.0;
+    s->dy = rand() % 8 ? (rand() % (2 * reach * 8 + 1) - reach * 8) / 8.0 : 0.0;
+    s->width = rand() % 4 ? rand() % 33 : 0;
+    s->height = s->width ? rand() % 33 : 0;
+}
+
+// the way main.c used to do it: every solid tile in the swept bounds,
+// row by row, swept against at once
+struct gather_t {
+    int *x1, *y1, *x2, *y2;
+};
+
+static Tilemap map;
+
+static double sweep_rect(void *gather, double x, double y, double dx, double dy,
+                         int width, int height, AABB *hit, AABBEdge *edge) {
+    struct gather_t *g = gather;
+    AABB bounds;
+    aabb_init_bounding(&bounds, x, y, dx, dy, width, height);
+    // one more tile on each side for the ones only touching the bounds
+    int x1 = (int)floor((bounds.x1 - MAP_X) / (double)TILE_SIZE) - 1,
+        y1 = (int)floor((bounds.y1 - MAP_Y) / (double)TILE_SIZE) - 1,
+        x2 = (int)floor((bounds.x2 - MAP_X) / (double)TILE_SIZE) + 1,
+        y2 = (int)floor((bounds.y2 - MAP_Y) / (double)TILE_SIZE) + 1;
+    size_t len = 0;
+    for (int ty = y1 < 0 ? 0 : y1; ty <= y2 && ty < MAP_TILES; ty++) {
+        for (int tx = x1 < 0 ? 0 : x1; tx <= x2 && tx < MAP_TILES; tx++) {
+            if (!tilemap_get(&map, tx, ty))
+                continue;
+            TEST_ASSERT(len < GATHER_MAX);
+            g->x1[len] = MAP_X + tx * TILE_SIZE;
+            g->y1[len] = MAP_Y + ty * TILE_SIZE;
+            g->x2[len] = g->x1[len] + TILE_SIZE;
+            g->y2[len] = g->y1[len] + TILE_SIZE;
+            len++;
+        }
+    }
+    size_t i;
+    double t = aabb_sweep_many(g->x1, g->y1, g->x2, g->y2, len, x, y, 1.0 / dx, 1.0 / dy, width, height, &i, edge);
+    if (t >= 0)
+        aabb_init(hit, g->x1[i], g->y1[i], g->x2[i], g->y2[i]);
+    return t;
+}
+
+static void check_set_get(void) {
+    Tilemap m;
+    tilemap_init(&m, 0, 0, 100, 70, 8, 8);
+    TEST_ASSERT(m.chunks_x == 2 && m.chunks_y == 2);
+    tilemap_set(&m, 99, 69, true);
+    tilemap_set(&m, 63, 0, true);
+    tilemap_set(&m, 64, 0, true);
+    tilemap_set(&m, 64, 0, false);
+    TEST_ASSERT(tilemap_get(&m, 99, 69) && tilemap_get(&m, 63, 0));
+    TEST_ASSERT(!tilemap_get(&m, 64, 0) && !tilemap_get(&m, 0, 0));
+    TEST_ASSERT(!tilemap_get(&m, -1, 0) && !tilemap_get(&m, 100, 69) && !tilemap_get(&m, 99, 70));
+    // chunks only exist once something in them was solid
+    TEST_ASSERT(m.chunks[0] && m.chunks[1] && !m.chunks[2] && m.chunks[3]);
+    // a long move stops at the first tile on the way
+    AABB hit;
+    AABBEdge edge;
+    double t = tilemap_sweep(&m, 2.0, 2.0, 1000.0, 0.0, 4, 4, &hit, &edge);
+    TEST_ASSERT(t == (63 * 8 - 2.0 - 4) * (1.0 / 1000.0) && edge == EDGE_WEST);
+    TEST_ASSERT(hit.x1 == 63 * 8 && hit.y1 == 0 && hit.x2 == 64 * 8 && hit.y2 == 8);
+    TEST_ASSERT(tilemap_sweep(&m, 2.0, 8.0, 1000.0, 0.0, 4, 4, &hit, &edge) == -1.0);
+    // starting left of and above the map, where the first tiles swept
+    // are all off it
+    tilemap_set(&m, 0, 30, true);
+    tilemap_set(&m, 40, 0, true);
+    t = tilemap_sweep(&m, -200.0, 30 * 8 + 2.0, 1000.0, 0.0, 4, 4, &hit, &edge);
+    TEST_ASSERT(t == (0 + 200.0 - 4) * (1.0 / 1000.0) && edge == EDGE_WEST);
+    TEST_ASSERT(hit.x1 == 0 && hit.y1 == 30 * 8);
+    t = tilemap_sweep(&m, 40 * 8 + 2.0, -200.0, 0.0, 1000.0, 4, 4, &hit, &edge);
+    TEST_ASSERT(t == (0 + 200.0 - 4) * (1.0 / 1000.0) && edge == EDGE_NORTH);
+    TEST_ASSERT(hit.x1 == 40 * 8 && hit.y1 == 0);
+    TEST_ASSERT(tilemap_sweep(&m, -200.0, -200.0, 100.0, 100.0, 4, 4, &hit, &edge) == -1.0);
+    t = tilemap_sweep(&m, -100.0, 30 * 8 + 2.0 - 100, 1000.0, 1000.0, 4, 4, &hit, &edge);
+    TEST_ASSERT(t == (0 + 100.0 - 4) * (1.0 / 1000.0) && edge == EDGE_WEST);
+    TEST_ASSERT(hit.x1 == 0 && hit.y1 == 30 * 8);
+    tilemap_free(&m);
+}
+
+int main() {
+    srand(RAND_SEED);
+    check_set_get();
+    tilemap_init(&map, MAP_X, MAP_Y, MAP_TILES, MAP_TILES, TILE_SIZE, TILE_SIZE);
+    randomize_map(&map);
+    struct gather_t g = {
+        malloc(sizeof(int) * GATHER_MAX), malloc(sizeof(int) * GATHER_MAX),
+        malloc(sizeof(int) * GATHER_MAX), malloc(sizeof(int) * GATHER_MAX),
+    };
+    Sweep *sweeps = malloc(sizeof(Sweep) * NUM_SWEEPS);
+    for (int i = 0; i < NUM_SWEEPS; i++)
+        randomize_sweep(&sweeps[i]);
+    size_t hits = 0;
+    for (int i = 0; i < NUM_CHECKS; i++) {
+        const Sweep *s = &sweeps[i];
+        AABB hit, rect_hit;
+        AABBEdge edge = EDGE_WEST, rect_edge = EDGE_WEST;
+        double t = tilemap_sweep(&map, s->x, s->y, s->dx, s->dy, s->width, s->height, &hit, &edge);
+        double rect_t = sweep_rect(&g, s->x, s->y, s->dx, s->dy, s->width, s->height, &rect_hit, &rect_edge);
+        TEST_ASSERT(memcmp(&t, &rect_t, sizeof(double)) == 0);
+        if (t >= 0) {
+            TEST_ASSERT(memcmp(&hit, &rect_hit, sizeof(AABB)) == 0 && edge == rect_edge);
+            hits++;
+        }
+    }
+    fprintf(stderr, "%zu of %d sweeps hit.\n", hits, NUM_CHECKS);
+    clock_t start, end;
+    double sum = 0, rect_sum = 0;
+    AABB hit;
+    AABBEdge edge;
+    // begin time sweep rect
+    start = clock();
+    for (int i = 0; i < NUM_CHECKS; i++) {
+        const Sweep *s = &sweeps[i];
+        rect_sum += sweep_rect(&g, s->x, s->y, s->dx, s->dy, s->width, s->height, &hit, &edge);
+    }
+    end = clock();
+    fprintf(stderr, "sweeping %d times through every tile in the bounds took %.3f ms.\n",
+            NUM_CHECKS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time sweep rect
+    // begin time tilemap sweep
+    start = clock();
+    for (int i = 0; i < NUM_SWEEPS; i++) {
+        const Sweep *s = &sweeps[i];
+        double t = tilemap_sweep(&map, s->x, s->y, s->dx, s->dy, s->width, s->height, &hit, &edge);
+        if (i < NUM_CHECKS)
+            sum += t;
+    }
+    end = clock();
+    fprintf(stderr, "sweeping %d times with tilemap_sweep took %.3f ms.\n",
+            NUM_SWEEPS, (end - start) * 1000.0 / CLOCKS_PER_SEC);
+    // end time tilemap sweep
+    TEST_ASSERT(sum == rect_sum);
+    // the solver gives the same as it does with the old way
+    AABBMover *movers = malloc(sizeof(AABBMover) * NUM_MOVERS),
+              *rect_movers = malloc(sizeof(AABBMover) * NUM_MOVERS);
+    for (int i = 0; i < NUM_MOVERS; i++) {
+        const Sweep *s = &sweeps[NUM_SWEEPS - 1 - i];
+        AABBMover m = {s->x, s->y, s->dx, s->dy, s->width, s->height, 0};
+        movers[i] = m;
+    }
+    memcpy(rect_movers, movers, sizeof(AABBMover) * NUM_MOVERS);
+    aabb_solve_tilemap(&map, movers, NUM_MOVERS, 4);
+    aabb_solve(rect_movers, NUM_MOVERS, 4, sweep_rect, &g);
+    for (int i = 0; i < NUM_MOVERS; i++)
+        TEST_ASSERT(memcmp(&movers[i], &rect_movers[i], sizeof(AABBMover)) == 0);
+    tilemap_free(&map);
+    free(g.x1);
+    free(g.y1);
+    free(g.x2);
+    free(g.y2);
+    free(sweeps);
+    free(movers);
+    free(rect_movers);
+    return 0;
+}